@@ -0,0 +1,183 @@
+/* NAME: Ofir Cohen
+ * ID: 312255847
+ * DATE:
+ *
+ * bump arena the memory of a request comes from, one for every thread.
+ * allocations move a pointer and are all given back at once by a reset.
+ */
+
+/* INCLUDES */
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+
+/* DEFINES */
+#define SUCCESS 0
+#define FAILED 1
+#define ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1))
+
+// the bytes of an added block start after its' header
+#define CHUNK_HEADER ALIGN_UP(sizeof(arena_chunk_t))
+
+
+/* GLOBALS */
+static pthread_key_t arena_key;
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+
+
+/* FUNCTIONS */
+static void make_arena_key(void);
+static void free_thread_arena(void* arena);
+
+
+static void make_arena_key(void)
+{
+    pthread_key_create(&arena_key, free_thread_arena);
+}
+
+
+/* destructor of the key, runs when a thread that has an arena exits */
+static void free_thread_arena(void* arena)
+{
+    arena_destroy((arena_t*)arena);
+    free(arena);
+}
+
+
+int arena_init(arena_t* arena, size_t size)
+{
+    arena->buff = (char*)malloc(size);
+    arena->size = (arena->buff != NULL) ? size : 0;
+    arena->used = 0;
+    arena->extra = NULL;
+    arena->total = 0;
+    return (arena->buff != NULL) ? SUCCESS : FAILED;
+}
+
+
+void* arena_alloc(arena_t* arena, size_t size)
+{
+    size = ALIGN_UP(size);
+    arena->total += size;
+
+    /* malloc aligns the block at least to ARENA_ALIGN, so the offsets are enough */
+    if(arena->used + size <= arena->size)
+    {
+        void* ptr = arena->buff + arena->used;
+        arena->used += size;
+        return ptr;
+    }
+
+    arena_chunk_t* chunk = arena->extra;
+    if(chunk == NULL || chunk->used + size > chunk->size)
+    {
+        size_t chunk_size = (size > ARENA_SIZE) ? size : ARENA_SIZE;
+        chunk = (arena_chunk_t*)malloc(CHUNK_HEADER + chunk_size);
+        if(chunk == NULL)
+            return NULL;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        chunk->next = arena->extra;
+        arena->extra = chunk;
+    }
+
+    void* ptr = (char*)chunk + CHUNK_HEADER + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+
+char* arena_strdup(arena_t* arena, const char* str)
+{
+    size_t len = strlen(str);
+    char* copy = (char*)arena_alloc(arena, len + 1);
+    if(copy != NULL)
+        memcpy(copy, str, len + 1);
+    return copy;
+}
+
+
+char* arena_printf(arena_t* arena, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if(len < 0)
+        return NULL;
+
+    char* str = (char*)arena_alloc(arena, len + 1);
+    if(str == NULL)
+        return NULL;
+    va_start(args, format);
+    vsnprintf(str, len + 1, format, args);
+    va_end(args);
+    return str;
+}
+
+
+void arena_reset(arena_t* arena)
+{
+    int grow = (arena->extra != NULL);
+    while(arena->extra != NULL)
+    {
+        arena_chunk_t* next = arena->extra->next;
+        free(arena->extra);
+        arena->extra = next;
+    }
+
+    /* the block didn't hold the last request, the next one like it fits without adding blocks (the contents don't matter) */
+    if(grow && arena->size < ARENA_MAX)
+    {
+        size_t size = (arena->size > 0) ? arena->size : ARENA_SIZE;
+        while(size < arena->total && size < ARENA_MAX)
+            size *= 2;
+        char* buff = (char*)malloc(size);
+        if(buff != NULL)
+        {
+            free(arena->buff);
+            arena->buff = buff;
+            arena->size = size;
+        }
+    }
+    arena->used = 0;
+    arena->total = 0;
+}
+
+
+void arena_destroy(arena_t* arena)
+{
+    while(arena->extra != NULL)
+    {
+        arena_chunk_t* next = arena->extra->next;
+        free(arena->extra);
+        arena->extra = next;
+    }
+    free(arena->buff);
+    arena->buff = NULL;
+    arena->size = 0;
+}
+
+
+arena_t* arena_thread(void)
+{
+    pthread_once(&arena_once, make_arena_key);
+    arena_t* arena = (arena_t*)pthread_getspecific(arena_key);
+    if(arena != NULL)
+        return arena;
+
+    arena = (arena_t*)malloc(sizeof(arena_t));
+    if(arena == NULL)
+        return NULL;
+    if(arena_init(arena, ARENA_SIZE) == FAILED || pthread_setspecific(arena_key, arena) != 0)
+    {
+        free(arena->buff);
+        free(arena);
+        return NULL;
+    }
+    return arena;
+}
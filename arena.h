@@ -0,0 +1,101 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+
+/**
+ * arena.h
+ *
+ * This file declares the arena the memory of a request comes from.
+ * every pool thread has one: the request struct, the resolved path,
+ * the names of a directory that is listed and the other things that
+ * live as long as the request are taken from its' block by moving a
+ * pointer, nothing is freed one by one, and the whole arena is reset
+ * when the response was sent. a request that needs more than the block
+ * gets more blocks from malloc, they are freed on reset and the block
+ * grows to what that request needed, so after a few requests a thread
+ * answers without calling malloc at all.
+ */
+
+// bytes of the block of a new arena, and the most it grows to
+#define ARENA_SIZE (16 * 1024)
+#define ARENA_MAX (1024 * 1024)
+
+// every allocation is aligned to this
+#define ARENA_ALIGN 16
+
+
+/**
+ * a block that was added when the arena was full
+ */
+typedef struct arena_chunk_st{
+    struct arena_chunk_st* next;
+    size_t size;
+    size_t used;
+} arena_chunk_t;
+
+
+/**
+ * the arena itself
+ */
+typedef struct arena_st{
+    char* buff;             //the block that is kept between requests
+    size_t size;
+    size_t used;
+    arena_chunk_t* extra;   //blocks that were added since the last reset, the newest first
+    size_t total;           //bytes taken since the last reset, the size the block grows to
+} arena_t;
+
+
+/**
+ * arena_init makes an empty arena with a block of size bytes.
+ * returns SUCCESS, or FAILED if there is no memory.
+ */
+int arena_init(arena_t* arena, size_t size);
+
+
+/**
+ * arena_alloc takes size bytes (aligned to ARENA_ALIGN) from the arena,
+ * they stay valid until the arena is reset.
+ * returns NULL if there is no memory.
+ */
+void* arena_alloc(arena_t* arena, size_t size);
+
+
+/**
+ * arena_strdup copies str into the arena.
+ * returns NULL if there is no memory.
+ */
+char* arena_strdup(arena_t* arena, const char* str);
+
+
+/**
+ * arena_printf formats into the arena.
+ * returns the string, NULL if there is no memory.
+ */
+char* arena_printf(arena_t* arena, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+
+/**
+ * arena_reset gives back everything that was taken, the added blocks
+ * are freed and the block grows (up to ARENA_MAX) if they were needed.
+ */
+void arena_reset(arena_t* arena);
+
+
+/**
+ * arena_destroy frees the arena's memory.
+ */
+void arena_destroy(arena_t* arena);
+
+
+/**
+ * arena_thread returns the arena of the calling thread, it is made the
+ * first time and freed when the thread exits.
+ * returns NULL if there is no memory.
+ */
+arena_t* arena_thread(void);
+
+
+#endif
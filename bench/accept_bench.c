@@ -0,0 +1,285 @@
+/* NAME: Ofir Cohen
+ * ID: 312255847
+ * DATE:
+ *
+ * connection burst benchmark of the listening socket.
+ * opens connections non-blocking connects to a running server at once,
+ * sends a request on each one as soon as it is connected and waits for
+ * the first byte of the response. prints how long the connects took
+ * (a SYN that was dropped because the accept queue was full shows up as
+ * a retransmit after 1 second or more), how long until the first byte
+ * (the server has to accept the connection first), and how many SYNs
+ * the kernel dropped (ListenOverflows/ListenDrops of /proc/net/netstat).
+ * run it against "server -b 5 ..." (the old backlog) and against the
+ * default backlog to compare.
+ *
+ * usage: accept_bench <port> [connections] [path]
+ */
+
+/* INCLUDES */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+/* DEFINES */
+#define CONNECTIONS 1000
+#define PATH "/"
+#define TIMEOUT_MS 20000
+
+// a connect that took longer than this lost its' first SYN (the first retransmit is after 1 second)
+#define RETRANSMIT_MS 900
+
+// state of a connection
+#define CONNECTING 0
+#define WAITING 1
+#define DONE 2
+#define FAILED_CONN 3
+
+
+/* STRUCTS */
+typedef struct client_st{
+    int fd;
+    int state;
+    double started;     //ms
+    double connected;   //ms, time of the connect
+    double first_byte;  //ms, time of the first byte of the response
+} client_t;
+
+
+/* FUNCTIONS */
+static double now_ms(void);
+static void listen_drops(unsigned long* overflows, unsigned long* drops);
+static int compare(const void* a, const void* b);
+static void print_times(const char* name, double* times, int count);
+
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2 || atoi(argv[1]) <= 0)
+    {
+        printf("usage: accept_bench <port> [connections] [path]\n");
+        return 1;
+    }
+    int port = atoi(argv[1]);
+    int connections = (argc > 2) ? atoi(argv[2]) : CONNECTIONS;
+    const char* path = (argc > 3) ? argv[3] : PATH;
+    if(connections <= 0)
+    {
+        printf("usage: accept_bench <port> [connections] [path]\n");
+        return 1;
+    }
+
+    /* every connection is a fd */
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)connections + 16)
+    {
+        limit.rlim_cur = (limit.rlim_max < (rlim_t)connections + 16) ? limit.rlim_max : (rlim_t)connections + 16;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    char request[512];
+    int request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.0\r\n\r\n", path);
+
+    client_t* clients = (client_t*)calloc(connections, sizeof(client_t));
+    int epfd = epoll_create1(0);
+    if(clients == NULL || epfd < 0)
+    {
+        perror("setup");
+        return 1;
+    }
+
+    struct sockaddr_in srv;
+    memset(&srv, 0, sizeof(srv));
+    srv.sin_family = AF_INET;
+    srv.sin_port = htons(port);
+    srv.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    unsigned long overflows_before, drops_before;
+    listen_drops(&overflows_before, &drops_before);
+
+    /* the burst, every connect is started before any of them is looked at */
+    int pending = 0;
+    int i;
+    for(i = 0; i < connections; i++)
+    {
+        client_t* client = &clients[i];
+        client->state = FAILED_CONN;
+        client->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if(client->fd < 0)
+        {
+            perror("socket");
+            continue;
+        }
+
+        client->started = now_ms();
+        if(connect(client->fd, (struct sockaddr*)&srv, sizeof(srv)) < 0 && errno != EINPROGRESS)
+        {
+            close(client->fd);
+            continue;
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLOUT | EPOLLIN;
+        ev.data.ptr = client;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, client->fd, &ev);
+        client->state = CONNECTING;
+        pending++;
+    }
+
+    /* connected: send the request, readable: the first byte of the response arrived */
+    double deadline = now_ms() + TIMEOUT_MS;
+    struct epoll_event events[256];
+    while(pending > 0 && now_ms() < deadline)
+    {
+        int count = epoll_wait(epfd, events, 256, 100);
+        int j;
+        for(j = 0; j < count; j++)
+        {
+            client_t* client = (client_t*)events[j].data.ptr;
+            if(client->state == CONNECTING && (events[j].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(client->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if(err != 0 || send(client->fd, request, request_len, MSG_NOSIGNAL) != request_len)
+                {
+                    client->state = FAILED_CONN;
+                    close(client->fd);
+                    pending--;
+                    continue;
+                }
+                client->connected = now_ms();
+                client->state = WAITING;
+
+                struct epoll_event ev;
+                ev.events = EPOLLIN;
+                ev.data.ptr = client;
+                epoll_ctl(epfd, EPOLL_CTL_MOD, client->fd, &ev);
+                continue;
+            }
+
+            if(client->state == WAITING && (events[j].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+            {
+                char byte;
+                client->state = (recv(client->fd, &byte, 1, 0) == 1) ? DONE : FAILED_CONN;
+                client->first_byte = now_ms();
+                close(client->fd);
+                pending--;
+            }
+        }
+    }
+
+    unsigned long overflows_after, drops_after;
+    listen_drops(&overflows_after, &drops_after);
+
+    /* what happened to every connection */
+    double* connect_times = (double*)malloc(sizeof(double)*connections);
+    double* byte_times = (double*)malloc(sizeof(double)*connections);
+    int done = 0;
+    int failed = 0;
+    int retransmitted = 0;
+    for(i = 0; i < connections; i++)
+    {
+        client_t* client = &clients[i];
+        if(client->state != DONE)
+        {
+            failed++;
+            if(client->state == CONNECTING || client->state == WAITING)
+                close(client->fd);
+            continue;
+        }
+        connect_times[done] = client->connected - client->started;
+        byte_times[done] = client->first_byte - client->started;
+        if(connect_times[done] > RETRANSMIT_MS)
+            retransmitted++;
+        done++;
+    }
+
+    printf("%d connections to port %d, %d answered, %d failed or timed out\n", connections, port, done, failed);
+    printf("SYNs dropped by the kernel: %lu listen overflows, %lu listen drops\n",
+           overflows_after - overflows_before, drops_after - drops_before);
+    printf("connects that waited for a SYN retransmit (> %d ms): %d\n", RETRANSMIT_MS, retransmitted);
+    print_times("connect", connect_times, done);
+    print_times("first byte", byte_times, done);
+
+    free(connect_times);
+    free(byte_times);
+    free(clients);
+    close(epfd);
+    return 0;
+}
+
+
+/* time on the monotonic clock in ms */
+static double now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+
+/* reads the TcpExt counters of SYNs that were dropped because an accept queue was full */
+static void listen_drops(unsigned long* overflows, unsigned long* drops)
+{
+    *overflows = 0;
+    *drops = 0;
+
+    FILE* file = fopen("/proc/net/netstat", "r");
+    if(file == NULL)
+        return;
+
+    /* the names are on one "TcpExt:" line and the values on the next one */
+    char names[8192];
+    char values[8192];
+    while(fgets(names, sizeof(names), file) != NULL && fgets(values, sizeof(values), file) != NULL)
+    {
+        if(strncmp(names, "TcpExt:", 7) != 0)
+            continue;
+
+        char* name_save;
+        char* value_save;
+        char* name = strtok_r(names, " \n", &name_save);
+        char* value = strtok_r(values, " \n", &value_save);
+        while(name != NULL && value != NULL)
+        {
+            if(strcmp(name, "ListenOverflows") == 0)
+                *overflows = strtoul(value, NULL, 10);
+            else if(strcmp(name, "ListenDrops") == 0)
+                *drops = strtoul(value, NULL, 10);
+            name = strtok_r(NULL, " \n", &name_save);
+            value = strtok_r(NULL, " \n", &value_save);
+        }
+        break;
+    }
+    fclose(file);
+}
+
+
+static int compare(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+
+/* prints the median, 99th percentile and max of times (ms) */
+static void print_times(const char* name, double* times, int count)
+{
+    if(count == 0)
+        return;
+
+    qsort(times, count, sizeof(double), compare);
+    printf("%-10s  p50 %9.2f ms  p99 %9.2f ms  max %9.2f ms\n", name,
+           times[count / 2], times[(int)(count * 0.99)], times[count - 1]);
+}
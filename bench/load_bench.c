@@ -0,0 +1,258 @@
+/* NAME: Ofir Cohen
+ * ID: 312255847
+ * DATE:
+ *
+ * load benchmark of a running server.
+ * every client thread keeps one persistent connection and sends the
+ * same GET again as soon as the response arrived, for the given number
+ * of seconds. the body is read and thrown away as it arrives, so a big
+ * file measures how fast the server moves it. prints requests per
+ * second, MB per second and the average latency of a request, compare
+ * the front ends of the server (-m blocking|epoll|uring) with a small
+ * file and with a big one.
+ * a connection the server closes (max requests per connection) is
+ * opened again, run the server with a big -r so it doesn't matter.
+ *
+ * usage: load_bench <port> [connections] [seconds] [path]
+ */
+
+/* INCLUDES */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+
+/* DEFINES */
+#define CONNECTIONS 16
+#define SECONDS 5
+#define PATH "/"
+#define MAX_CONNECTIONS 1024
+#define READ_SIZE (256 * 1024)
+
+
+/* STRUCTS */
+typedef struct client_st{
+    pthread_t thread;
+    int port;
+    const char* request;
+    int request_len;
+    double stop;            //when the client stops sending (ms)
+    long requests;          //responses that were read completely
+    long long bytes;        //bytes of those responses
+    double latency;         //sum of their latencies (ms)
+    int connections;
+    int failed;             //the server couldn't be reached
+} client_t;
+
+
+/* FUNCTIONS */
+static double now_ms(void);
+static int connect_server(int port);
+static void* run_client(void* arg);
+static long long read_response(int fd, char* buff);
+
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2 || atoi(argv[1]) <= 0)
+    {
+        printf("usage: load_bench <port> [connections] [seconds] [path]\n");
+        return 1;
+    }
+    int port = atoi(argv[1]);
+    int connections = (argc > 2) ? atoi(argv[2]) : CONNECTIONS;
+    int seconds = (argc > 3) ? atoi(argv[3]) : SECONDS;
+    const char* path = (argc > 4) ? argv[4] : PATH;
+    if(connections <= 0 || connections > MAX_CONNECTIONS || seconds <= 0)
+    {
+        printf("usage: load_bench <port> [connections 1-%d] [seconds] [path]\n", MAX_CONNECTIONS);
+        return 1;
+    }
+
+    char request[512];
+    int request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", path);
+
+    client_t* clients = (client_t*)calloc(connections, sizeof(client_t));
+    if(clients == NULL)
+        return 1;
+
+    double start = now_ms();
+    int i;
+    for(i = 0; i < connections; i++)
+    {
+        clients[i].port = port;
+        clients[i].request = request;
+        clients[i].request_len = request_len;
+        clients[i].stop = start + seconds * 1000.0;
+        if(pthread_create(&clients[i].thread, NULL, run_client, &clients[i]) != 0)
+        {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    long requests = 0;
+    long long bytes = 0;
+    double latency = 0;
+    int reconnects = 0;
+    int failed = 0;
+    for(i = 0; i < connections; i++)
+    {
+        pthread_join(clients[i].thread, NULL);
+        requests += clients[i].requests;
+        bytes += clients[i].bytes;
+        latency += clients[i].latency;
+        reconnects += clients[i].connections - 1;
+        failed |= clients[i].failed;
+    }
+    double elapsed = (now_ms() - start) / 1000.0;
+    free(clients);
+
+    if(failed)
+        return 1;
+
+    printf("%d connections, %d seconds of %s on port %d\n", connections, seconds, path, port);
+    printf("%12s %10s %12s %12s\n", "requests/s", "MB/s", "latency ms", "reconnects");
+    printf("%12.0f %10.1f %12.3f %12d\n", requests / elapsed, bytes / elapsed / (1024 * 1024),
+           (requests > 0) ? latency / requests : 0, reconnects);
+    return 0;
+}
+
+
+/* time on the monotonic clock in ms */
+static double now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+
+static int connect_server(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    struct sockaddr_in srv;
+    memset(&srv, 0, sizeof(srv));
+    srv.sin_family = AF_INET;
+    srv.sin_port = htons(port);
+    srv.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(connect(fd, (struct sockaddr*)&srv, sizeof(srv)) < 0)
+    {
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+
+/* thread of one client, sends a request, reads its' response and sends the next one until stop */
+static void* run_client(void* arg)
+{
+    client_t* client = (client_t*)arg;
+    char* buff = (char*)malloc(READ_SIZE);
+    if(buff == NULL)
+    {
+        client->failed = 1;
+        return NULL;
+    }
+
+    int fd = -1;
+    double sent;
+    while((sent = now_ms()) < client->stop)
+    {
+        if(fd < 0)
+        {
+            if((fd = connect_server(client->port)) < 0)
+            {
+                client->failed = 1;
+                break;
+            }
+            client->connections++;
+        }
+
+        if(send(fd, client->request, client->request_len, MSG_NOSIGNAL) != client->request_len)
+        {
+            close(fd);
+            fd = -1;
+            continue;
+        }
+
+        /* a connection the server closed is opened again, the request is sent on the new one */
+        long long len = read_response(fd, buff);
+        if(len < 0)
+        {
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        client->requests++;
+        client->bytes += len;
+        client->latency += now_ms() - sent;
+    }
+
+    if(fd >= 0)
+        close(fd);
+    free(buff);
+    return NULL;
+}
+
+
+/* reads one response, the body is thrown away as it arrives. returns its' length, -1 if the server closed before it was complete */
+static long long read_response(int fd, char* buff)
+{
+    int len = 0;
+    char* end = NULL;
+    while(end == NULL)
+    {
+        if(len == READ_SIZE)
+            return -1;
+        int nbytes = recv(fd, buff + len, READ_SIZE - len, 0);
+        if(nbytes <= 0)
+            return -1;
+        len += nbytes;
+        end = memmem(buff, len, "\r\n\r\n", 4);
+    }
+    int head_len = end + 4 - buff;
+
+    long long body_len = 0;
+    const char* line = buff;
+    while(line < end)
+    {
+        const char* next = memmem(line, end + 2 - line, "\r\n", 2);
+        if(next == NULL)
+            break;
+        if(next - line > 15 && strncasecmp(line, "Content-Length:", 15) == 0)
+            body_len = strtoll(line + 15, NULL, 10);
+        line = next + 2;
+    }
+
+    /* the server sends nothing after the response until the next request, so what was read past the head is body */
+    long long left = head_len + body_len - len;
+    while(left > 0)
+    {
+        int nbytes = recv(fd, buff, (left < READ_SIZE) ? left : READ_SIZE, 0);
+        if(nbytes <= 0)
+            return -1;
+        left -= nbytes;
+    }
+    return head_len + body_len;
+}
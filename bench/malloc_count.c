@@ -0,0 +1,126 @@
+/* NAME: Ofir Cohen
+ * ID: 312255847
+ * DATE:
+ *
+ * counts the memory allocations of a program, it is loaded into the
+ * server with LD_PRELOAD. malloc, calloc, realloc, the aligned
+ * allocations and free are counted (the ones libc makes for the program
+ * too, e.g. opendir and strdup) and handed to glibc's allocator.
+ * SIGUSR1 prints the counts since the last SIGUSR1 (or since the start)
+ * to stderr and starts counting again, so signal the server once after
+ * it started (its' caches and threads), send the requests and signal it
+ * again. with MALLOC_COUNT_REQUESTS set to the number of requests that
+ * were sent the counts are also printed per request.
+ *
+ * usage: MALLOC_COUNT_REQUESTS=<requests> LD_PRELOAD=./bench/malloc_count.so ./server ...
+ *        kill -USR1 <pid>; <send the requests>; kill -USR1 <pid>
+ */
+
+/* INCLUDES */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+
+
+/* GLOBALS */
+static unsigned long mallocs = 0;
+static unsigned long reallocs = 0;
+static unsigned long frees = 0;
+
+
+/* FUNCTIONS */
+// glibc's allocator, the calls are counted and passed to it
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void* ptr);
+
+static void start_counting(void) __attribute__((constructor));
+static void print_counts(int sig);
+
+
+void* malloc(size_t size)
+{
+    __atomic_add_fetch(&mallocs, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+
+void* calloc(size_t count, size_t size)
+{
+    __atomic_add_fetch(&mallocs, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+
+void* realloc(void* ptr, size_t size)
+{
+    __atomic_add_fetch(&reallocs, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+
+void* memalign(size_t alignment, size_t size)
+{
+    __atomic_add_fetch(&mallocs, 1, __ATOMIC_RELAXED);
+    return __libc_memalign(alignment, size);
+}
+
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+
+int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+    void* mem = memalign(alignment, size);
+    if(mem == NULL)
+        return ENOMEM;
+    *ptr = mem;
+    return 0;
+}
+
+
+void free(void* ptr)
+{
+    if(ptr != NULL)
+        __atomic_add_fetch(&frees, 1, __ATOMIC_RELAXED);
+    __libc_free(ptr);
+}
+
+
+/* runs when the program is loaded */
+static void start_counting(void)
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = print_counts;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+}
+
+
+/* SIGUSR1, prints the counts and starts again (the counts are taken atomically, the text is written with one write) */
+static void print_counts(int sig)
+{
+    unsigned long allocs = __atomic_exchange_n(&mallocs, 0, __ATOMIC_RELAXED);
+    unsigned long moves = __atomic_exchange_n(&reallocs, 0, __ATOMIC_RELAXED);
+    unsigned long released = __atomic_exchange_n(&frees, 0, __ATOMIC_RELAXED);
+
+    char text[256];
+    int len = snprintf(text, sizeof(text), "malloc_count: %lu allocations, %lu reallocs, %lu frees\n", allocs, moves, released);
+
+    const char* env = getenv("MALLOC_COUNT_REQUESTS");
+    long requests = (env != NULL) ? atol(env) : 0;
+    if(requests > 0)
+        len += snprintf(text + len, sizeof(text) - len, "malloc_count: %.2f allocations, %.2f reallocs per request (%ld requests)\n",
+                        (double)allocs / requests, (double)moves / requests, requests);
+    if(write(STDERR_FILENO, text, len) < 0)
+        return;
+}
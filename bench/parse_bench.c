@@ -0,0 +1,221 @@
+/* NAME: Ofir Cohen
+ * ID: 312255847
+ * DATE:
+ *
+ * microbenchmark of the request parser.
+ * parses every request of a corpus many times with each scan kernel the
+ * CPU has (scalar, SSE4.2, AVX2) and prints the time of one parse. the
+ * built-in corpus is requests the way curl, Chrome, Firefox and Safari
+ * send them, a file of captured requests (raw, every one ending with the
+ * empty line, e.g. what "nc -l" printed) may be given instead.
+ *
+ * usage: parse_bench [iterations] [corpus-file]
+ */
+
+/* INCLUDES */
+#include "../http_parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+/* DEFINES */
+#define SUCCESS 0
+#define FAILED 1
+#define ITERATIONS 1000000
+#define MAX_REQUESTS 1024
+
+
+/* GLOBALS */
+static const char* corpus[] = {
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: curl/7.88.1\r\n"
+    "Accept: */*\r\n"
+    "\r\n",
+
+    "GET /folder/index.html HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"122\", \"Not(A:Brand\";v=\"24\", \"Google Chrome\";v=\"122\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/122.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Referer: http://www.example.com/folder/\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: en-US,en;q=0.9,he;q=0.8\r\n"
+    "Cookie: _ga=GA1.1.1234567890.1700000000; _ga_ABCDEF1234=GS1.1.1700000000.1.1.1700000100.0.0.0; session=4f2a9c1e7b3d8e6f0a5b2c9d1e4f7a8b; theme=dark\r\n"
+    "If-None-Match: \"5e1f-61a2b3c4d5e6f\"\r\n"
+    "If-Modified-Since: Tue, 05 Mar 2024 10:15:30 GMT\r\n"
+    "\r\n",
+
+    "GET /folder/img.jpg HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:123.0) Gecko/20100101 Firefox/123.0\r\n"
+    "Accept: image/avif,image/webp,*/*\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: keep-alive\r\n"
+    "Referer: http://www.example.com/folder/\r\n"
+    "Sec-Fetch-Dest: image\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "\r\n",
+
+    "GET /folder/sounds/ufo.mp3 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Accept: */*\r\n"
+    "Range: bytes=0-\r\n"
+    "Accept-Language: en-GB,en;q=0.9\r\n"
+    "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.3 Safari/605.1.15\r\n"
+    "Referer: http://www.example.com/folder/sounds/\r\n"
+    "Accept-Encoding: identity\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+};
+
+static const char* kernel_names[] = { "scalar", "sse4.2", "avx2" };
+
+
+/* FUNCTIONS */
+static double now_ns(void);
+static int read_corpus(const char* file_name, char** requests, int* lens);
+
+
+int main(int argc, char* argv[])
+{
+    int iterations = (argc > 1) ? atoi(argv[1]) : ITERATIONS;
+    if(iterations <= 0)
+    {
+        printf("usage: parse_bench [iterations] [corpus-file]\n");
+        return 1;
+    }
+
+    char* requests[MAX_REQUESTS];
+    int lens[MAX_REQUESTS];
+    int count = 0;
+    if(argc > 2)
+    {
+        count = read_corpus(argv[2], requests, lens);
+        if(count <= 0)
+        {
+            printf("no requests in %s\n", argv[2]);
+            return 1;
+        }
+    }
+    else
+    {
+        for(count = 0; count < (int)(sizeof(corpus) / sizeof(corpus[0])); count++)
+        {
+            requests[count] = (char*)corpus[count];
+            lens[count] = strlen(corpus[count]);
+        }
+    }
+
+    /* every request must parse, else the times mean nothing */
+    http_request_t req;
+    int i;
+    for(i = 0; i < count; i++)
+    {
+        http_parser_init(&req);
+        if(http_parse(&req, requests[i], lens[i]) != PARSE_COMPLETE)
+        {
+            printf("request %d doesn't parse\n", i);
+            return 1;
+        }
+    }
+
+    printf("%d requests, %d parses of each\n", count, iterations);
+    printf("%-8s", "kernel");
+    for(i = 0; i < count; i++)
+        printf("  req%-2d %5dB", i, lens[i]);
+    printf("\n");
+
+    int kernel;
+    for(kernel = HTTP_SCAN_SCALAR; kernel <= HTTP_SCAN_AVX2; kernel++)
+    {
+        if(http_parser_setup(kernel) == FAILED)
+        {
+            printf("%-8s  not supported by this CPU\n", kernel_names[kernel]);
+            continue;
+        }
+
+        printf("%-8s", kernel_names[kernel]);
+        for(i = 0; i < count; i++)
+        {
+            /* the number of headers is read back so the parse can't be optimized away */
+            volatile int headers = 0;
+            double start = now_ns();
+            int j;
+            for(j = 0; j < iterations; j++)
+            {
+                http_parser_init(&req);
+                http_parse(&req, requests[i], lens[i]);
+                headers += req.num_headers;
+            }
+            printf("  %9.1f ns", (now_ns() - start) / iterations);
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+
+/* time on the monotonic clock in ns */
+static double now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+
+/* splits a file of captured requests at the empty lines, returns the number of requests */
+static int read_corpus(const char* file_name, char** requests, int* lens)
+{
+    FILE* file = fopen(file_name, "rb");
+    if(file == NULL)
+    {
+        perror("fopen");
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* data = (char*)malloc(size + 1);
+    if(data == NULL || fread(data, 1, size, file) != (size_t)size)
+    {
+        fclose(file);
+        free(data);
+        return -1;
+    }
+    fclose(file);
+    data[size] = '\0';
+
+    int count = 0;
+    char* start = data;
+    char* end;
+    while(count < MAX_REQUESTS)
+    {
+        /* empty lines between two requests are skipped */
+        while(*start == '\r' || *start == '\n')
+            start++;
+        end = strstr(start, "\r\n\r\n");
+        if(end == NULL)
+            break;
+        requests[count] = start;
+        lens[count] = end + 4 - start;
+        count++;
+        start = end + 4;
+    }
+    return count;
+}
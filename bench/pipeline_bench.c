@@ -0,0 +1,246 @@
+/* NAME: Ofir Cohen
+ * ID: 312255847
+ * DATE:
+ *
+ * pipelining benchmark of a running server.
+ * sends the same GET depth times on one persistent connection without
+ * waiting, then reads the depth responses, and does it again until
+ * requests were answered. prints requests per second and the number of
+ * reads the responses took at depth 1, 8 and 32 (or the depths that are
+ * given): when the server sends the responses of a batch together the
+ * client needs about one read per batch instead of one per response.
+ * a connection the server closes (max requests per connection) is opened
+ * again and the requests that weren't answered are sent again, run the
+ * server with a big -r so the number of connections doesn't matter.
+ *
+ * usage: pipeline_bench <port> [requests] [path] [depth...]
+ */
+
+/* INCLUDES */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+
+/* DEFINES */
+#define REQUESTS 100000
+#define PATH "/"
+#define MAX_DEPTH 256
+#define READ_SIZE (256 * 1024)
+
+
+/* FUNCTIONS */
+static double now_ms(void);
+static int connect_server(int port);
+static int run_depth(int port, const char* request, int request_len, int depth, int requests, long* reads, int* connections);
+static int read_responses(int fd, char* buff, int* len, int wanted, long* reads);
+static int response_length(const char* buff, int len);
+
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2 || atoi(argv[1]) <= 0)
+    {
+        printf("usage: pipeline_bench <port> [requests] [path] [depth...]\n");
+        return 1;
+    }
+    int port = atoi(argv[1]);
+    int requests = (argc > 2) ? atoi(argv[2]) : REQUESTS;
+    const char* path = (argc > 3) ? argv[3] : PATH;
+    if(requests <= 0)
+    {
+        printf("usage: pipeline_bench <port> [requests] [path] [depth...]\n");
+        return 1;
+    }
+
+    int depths[MAX_DEPTH] = { 1, 8, 32 };
+    int num_depths = 3;
+    if(argc > 4)
+    {
+        for(num_depths = 0; num_depths + 4 < argc && num_depths < MAX_DEPTH; num_depths++)
+        {
+            depths[num_depths] = atoi(argv[num_depths + 4]);
+            if(depths[num_depths] <= 0 || depths[num_depths] > MAX_DEPTH)
+            {
+                printf("depth must be 1-%d\n", MAX_DEPTH);
+                return 1;
+            }
+        }
+    }
+
+    char request[512];
+    int request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", path);
+
+    printf("%d requests of %s on port %d\n", requests, path, port);
+    printf("%-6s %12s %14s %12s\n", "depth", "requests/s", "reads/request", "connections");
+    int i;
+    for(i = 0; i < num_depths; i++)
+    {
+        long reads = 0;
+        int connections = 0;
+        double start = now_ms();
+        if(run_depth(port, request, request_len, depths[i], requests, &reads, &connections) == -1)
+            return 1;
+        double elapsed = now_ms() - start;
+        printf("%-6d %12.0f %14.3f %12d\n", depths[i], requests / (elapsed / 1000.0), (double)reads / requests, connections);
+    }
+    return 0;
+}
+
+
+/* time on the monotonic clock in ms */
+static double now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+
+static int connect_server(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    struct sockaddr_in srv;
+    memset(&srv, 0, sizeof(srv));
+    srv.sin_family = AF_INET;
+    srv.sin_port = htons(port);
+    srv.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(connect(fd, (struct sockaddr*)&srv, sizeof(srv)) < 0)
+    {
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+
+    /* the requests of a batch leave in one packet */
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+
+/* sends the requests in batches of depth and reads their responses, returns -1 if the server can't be reached */
+static int run_depth(int port, const char* request, int request_len, int depth, int requests, long* reads, int* connections)
+{
+    char* batch = (char*)malloc(request_len * depth);
+    char* buff = (char*)malloc(READ_SIZE);
+    if(batch == NULL || buff == NULL)
+    {
+        free(batch);
+        free(buff);
+        return -1;
+    }
+    int i;
+    for(i = 0; i < depth; i++)
+        memcpy(batch + i * request_len, request, request_len);
+
+    int fd = -1;
+    int len = 0;
+    int answered = 0;
+    while(answered < requests)
+    {
+        if(fd < 0)
+        {
+            if((fd = connect_server(port)) < 0)
+            {
+                free(batch);
+                free(buff);
+                return -1;
+            }
+            (*connections)++;
+            len = 0;
+        }
+
+        int wanted = (requests - answered < depth) ? requests - answered : depth;
+        if(send(fd, batch, request_len * wanted, MSG_NOSIGNAL) != request_len * wanted)
+        {
+            close(fd);
+            fd = -1;
+            continue;
+        }
+
+        /* a connection the server closed in the middle of the batch is opened again for the rest */
+        int got = read_responses(fd, buff, &len, wanted, reads);
+        answered += got;
+        if(got < wanted)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    if(fd >= 0)
+        close(fd);
+    free(batch);
+    free(buff);
+    return 0;
+}
+
+
+/* reads until wanted responses are complete or the server closes, returns the number of complete responses */
+static int read_responses(int fd, char* buff, int* len, int wanted, long* reads)
+{
+    int got = 0;
+    while(got < wanted)
+    {
+        /* take the complete responses that are in the buffer */
+        int response_len;
+        while(got < wanted && (response_len = response_length(buff, *len)) > 0)
+        {
+            memmove(buff, buff + response_len, *len - response_len);
+            *len -= response_len;
+            got++;
+        }
+        if(got == wanted)
+            break;
+
+        if(*len == READ_SIZE)
+            return got;
+        int nbytes = recv(fd, buff + *len, READ_SIZE - *len, 0);
+        (*reads)++;
+        if(nbytes <= 0)
+            return got;
+        *len += nbytes;
+    }
+    return got;
+}
+
+
+/* length of the response at the beginning of buff (head and Content-Length bytes of body), 0 if it isn't all there */
+static int response_length(const char* buff, int len)
+{
+    const char* end = memmem(buff, len, "\r\n\r\n", 4);
+    if(end == NULL)
+        return 0;
+    int head_len = end + 4 - buff;
+
+    long body_len = 0;
+    const char* line = buff;
+    while(line < end)
+    {
+        const char* next = memmem(line, end + 2 - line, "\r\n", 2);
+        if(next == NULL)
+            break;
+        if(next - line > 15 && strncasecmp(line, "Content-Length:", 15) == 0)
+            body_len = strtol(line + 15, NULL, 10);
+        line = next + 2;
+    }
+
+    if(head_len + body_len > len)
+        return 0;
+    return head_len + body_len;
+}
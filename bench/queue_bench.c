@@ -0,0 +1,169 @@
+/* NAME: Ofir Cohen
+ * ID: 312255847
+ * DATE:
+ *
+ * contention benchmark of the threadpool job queues.
+ * producer threads dispatch empty jobs into a pool with the linked list
+ * queue (qhead/qtail under qlock), a pool with the lock-free ring and a
+ * work-stealing pool, for pools of 1 to MAXT_IN_POOL threads, and print
+ * the jobs per second from the first dispatch until destroy_threadpool
+ * returned. with children > 0 every job dispatches that many more jobs
+ * from inside the pool, like follow-up work of a request.
+ *
+ * usage: queue_bench [jobs] [producers] [children]
+ */
+
+/* INCLUDES */
+#include "../threadpool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+
+
+/* DEFINES */
+#define JOBS 1000000
+#define PRODUCERS 1
+#define CHILDREN 0
+
+
+/* STRUCTS */
+typedef struct producer_st{
+    threadpool* tp;
+    int jobs;       //jobs this producer dispatches
+} producer_t;
+
+
+/* GLOBALS */
+static long done = 0;
+static int children = CHILDREN;
+static threadpool* pool = NULL;
+
+
+/* FUNCTIONS */
+static int empty_job(void* arg);
+static int parent_job(void* arg);
+static void* produce(void* arg);
+static double run(int queue, int num_threads, int jobs, int producers);
+static double now_sec(void);
+
+
+int main(int argc, char* argv[])
+{
+    int jobs = (argc > 1) ? atoi(argv[1]) : JOBS;
+    int producers = (argc > 2) ? atoi(argv[2]) : PRODUCERS;
+    children = (argc > 3) ? atoi(argv[3]) : CHILDREN;
+    if(jobs <= 0 || producers <= 0 || children < 0)
+    {
+        printf("usage: queue_bench [jobs] [producers] [children]\n");
+        return 1;
+    }
+
+    int threads[] = { 1, 2, 4, 8, 16, 32, 64, 128, MAXT_IN_POOL };
+    int i;
+
+    printf("%d jobs, %d producers, %d children per job\n", jobs, producers, children);
+    printf("%8s %14s %14s %14s %10s %10s\n", "threads", "list jobs/s", "ring jobs/s", "steal jobs/s", "ring/list", "steal/list");
+    for(i = 0; i < (int)(sizeof(threads) / sizeof(threads[0])); i++)
+    {
+        double list = run(QUEUE_LIST, threads[i], jobs, producers);
+        double ring = run(QUEUE_RING, threads[i], jobs, producers);
+        double steal = run(QUEUE_STEAL, threads[i], jobs, producers);
+        printf("%8d %14.0f %14.0f %14.0f %10.2f %10.2f\n", threads[i], list, ring, steal, ring / list, steal / list);
+    }
+    return 0;
+}
+
+
+/* dispatches jobs (counting their children) into the pool and returns the jobs per second */
+static double run(int queue, int num_threads, int jobs, int producers)
+{
+    threadpool_config_t config;
+    config.num_threads = num_threads;
+    config.queue = queue;
+    config.ring_size = RING_SIZE;
+    config.max_threads = num_threads;
+    config.grow_wait = GROW_WAIT;
+    config.grow_qsize = 0;
+    config.idle_timeout = IDLE_TIMEOUT;
+    threadpool* tp = create_threadpool_ex(&config);
+    pool = tp;
+    if(tp == NULL)
+    {
+        printf("error on creating the threadpool\n");
+        exit(1);
+    }
+
+    pthread_t* ids = (pthread_t*)malloc(sizeof(pthread_t)*producers);
+    producer_t* args = (producer_t*)malloc(sizeof(producer_t)*producers);
+    if(ids == NULL || args == NULL)
+    {
+        printf("error on allocating memory\n");
+        exit(1);
+    }
+
+    done = 0;
+    double start = now_sec();
+    int i;
+    for(i = 0; i < producers; i++)
+    {
+        args[i].tp = tp;
+        int parents = jobs / (children + 1);
+        args[i].jobs = parents / producers + (i < parents % producers);
+        pthread_create(&ids[i], NULL, produce, &args[i]);
+    }
+    for(i = 0; i < producers; i++)
+        pthread_join(ids[i], NULL);
+
+    /* children are dispatched from inside the pool, which stops accepting jobs once it is destroyed */
+    long expected = (long)(jobs / (children + 1)) * (children + 1);
+    while(__atomic_load_n(&done, __ATOMIC_RELAXED) < expected)
+        sched_yield();
+
+    destroy_threadpool(tp);
+    double elapsed = now_sec() - start;
+
+    free(ids);
+    free(args);
+    return expected / elapsed;
+}
+
+
+/* producer thread */
+static void* produce(void* arg)
+{
+    producer_t* producer = (producer_t*)arg;
+    int i;
+    for(i = 0; i < producer->jobs; i++)
+        dispatch(producer->tp, children > 0 ? parent_job : empty_job, NULL);
+    return NULL;
+}
+
+
+/* the job, only counts itself */
+static int empty_job(void* arg)
+{
+    __atomic_add_fetch(&done, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+
+/* a job that dispatches its' children and counts itself */
+static int parent_job(void* arg)
+{
+    int i;
+    for(i = 0; i < children; i++)
+        dispatch(pool, empty_job, NULL);
+
+    __atomic_add_fetch(&done, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+
+/* seconds of the monotonic clock */
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
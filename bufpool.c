@@ -0,0 +1,161 @@
+/* NAME: Ofir Cohen
+ * ID: 312255847
+ * DATE:
+ *
+ * per-thread pool of I/O buffers in size classes, buffers are taken and
+ * put back without locking and are reused instead of freed.
+ */
+
+/* INCLUDES */
+#include "bufpool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+
+/* DEFINES */
+// the bytes of a buffer start after its' header, on the next cache line
+#define BUFFER_HEADER ((sizeof(bufpool_buffer_t) + BUFPOOL_ALIGN - 1) & ~((size_t)BUFPOOL_ALIGN - 1))
+#define HEADER_OF(buff) ((bufpool_buffer_t*)((char*)(buff) - BUFFER_HEADER))
+
+
+/* GLOBALS */
+static pthread_key_t bufpool_key;
+static pthread_once_t bufpool_once = PTHREAD_ONCE_INIT;
+
+
+/* FUNCTIONS */
+static void make_bufpool_key(void);
+static void free_thread_pool(void* pool);
+static bufpool_t* thread_pool(void);
+static int size_class(size_t size);
+
+
+static void make_bufpool_key(void)
+{
+    pthread_key_create(&bufpool_key, free_thread_pool);
+}
+
+
+/* destructor of the key, runs when a thread that has a pool exits */
+static void free_thread_pool(void* pool)
+{
+    bufpool_t* buffers = (bufpool_t*)pool;
+    int cls;
+    for(cls = 0; cls < BUFPOOL_CLASSES; cls++)
+    {
+        while(buffers->free[cls] != NULL)
+        {
+            bufpool_buffer_t* next = buffers->free[cls]->next;
+            free(buffers->free[cls]);
+            buffers->free[cls] = next;
+        }
+    }
+    free(buffers);
+}
+
+
+/* the pool of the calling thread, made the first time */
+static bufpool_t* thread_pool(void)
+{
+    pthread_once(&bufpool_once, make_bufpool_key);
+    bufpool_t* pool = (bufpool_t*)pthread_getspecific(bufpool_key);
+    if(pool != NULL)
+        return pool;
+
+    pool = (bufpool_t*)calloc(1, sizeof(bufpool_t));
+    if(pool == NULL)
+        return NULL;
+    if(pthread_setspecific(bufpool_key, pool) != 0)
+    {
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+
+/* the smallest class that holds size bytes, -1 if it is bigger than BUFPOOL_MAX */
+static int size_class(size_t size)
+{
+    int cls = 0;
+    size_t class_size = BUFPOOL_MIN;
+    while(class_size < size)
+    {
+        if(++cls == BUFPOOL_CLASSES)
+            return -1;
+        class_size *= 2;
+    }
+    return cls;
+}
+
+
+void* bufpool_get(size_t size)
+{
+    int cls = size_class(size);
+    bufpool_t* pool = (cls >= 0) ? thread_pool() : NULL;
+
+    bufpool_buffer_t* buffer;
+    if(pool != NULL && pool->free[cls] != NULL)
+    {
+        buffer = pool->free[cls];
+        pool->free[cls] = buffer->next;
+        pool->count[cls]--;
+        return (char*)buffer + BUFFER_HEADER;
+    }
+
+    size_t buffer_size = (cls >= 0) ? (size_t)BUFPOOL_MIN << cls : size;
+    void* mem;
+    if(posix_memalign(&mem, BUFPOOL_ALIGN, BUFFER_HEADER + buffer_size) != 0)
+        return NULL;
+    buffer = (bufpool_buffer_t*)mem;
+    buffer->next = NULL;
+    buffer->size = buffer_size;
+    buffer->cls = cls;
+    return (char*)buffer + BUFFER_HEADER;
+}
+
+
+void* bufpool_grow(void* buff, size_t len, size_t size)
+{
+    if(buff != NULL && bufpool_capacity(buff) >= size)
+        return buff;
+
+    void* bigger = bufpool_get(size);
+    if(bigger == NULL)
+        return NULL;
+    if(buff != NULL)
+    {
+        memcpy(bigger, buff, len);
+        bufpool_put(buff);
+    }
+    return bigger;
+}
+
+
+void bufpool_put(void* buff)
+{
+    if(buff == NULL)
+        return;
+
+    bufpool_buffer_t* buffer = HEADER_OF(buff);
+    int cls = buffer->cls;
+    bufpool_t* pool = (cls >= 0) ? thread_pool() : NULL;
+
+    /* the class keeps up to BUFPOOL_KEEP bytes (one buffer at least), the newest on top so its' lines are still in the cache */
+    if(pool != NULL && (pool->count[cls] == 0 || (size_t)(pool->count[cls] + 1) * buffer->size <= BUFPOOL_KEEP))
+    {
+        buffer->next = pool->free[cls];
+        pool->free[cls] = buffer;
+        pool->count[cls]++;
+        return;
+    }
+    free(buffer);
+}
+
+
+size_t bufpool_capacity(const void* buff)
+{
+    return HEADER_OF(buff)->size;
+}
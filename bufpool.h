@@ -0,0 +1,85 @@
+#ifndef _BUFPOOL_H_
+#define _BUFPOOL_H_
+
+#include <stddef.h>
+
+
+/**
+ * bufpool.h
+ *
+ * This file declares the pool the I/O buffers come from: the read
+ * buffer of a connection, the batch of pipelined responses, a body that
+ * is read or compressed before it is cached and a listing that outgrew
+ * the arena of its' request. every thread has its' own pool, so a
+ * buffer is handed out and taken back without a lock. the sizes are
+ * rounded up to size classes (powers of two from BUFPOOL_MIN to
+ * BUFPOOL_MAX) and a buffer that is put back waits in the list of its'
+ * class for the next one of that size, after a few requests a thread
+ * answers with buffers it already touched instead of new pages.
+ * every buffer starts on a cache line. a buffer may be put back by
+ * another thread than the one that got it, it then joins that thread's
+ * pool. bigger buffers than BUFPOOL_MAX are allocated and freed each time.
+ */
+
+// the smallest and the biggest size class
+#define BUFPOOL_MIN (4 * 1024)
+#define BUFPOOL_MAX (1024 * 1024)
+#define BUFPOOL_CLASSES 9
+
+// bytes of free buffers a thread keeps in one class, more are freed
+#define BUFPOOL_KEEP (1024 * 1024)
+
+// buffers start on a cache line
+#define BUFPOOL_ALIGN 64
+
+
+/**
+ * header in front of every buffer, a free buffer is linked through it
+ */
+typedef struct bufpool_buffer_st{
+    struct bufpool_buffer_st* next;     //next free buffer of the class
+    size_t size;                        //bytes after the header
+    int cls;                            //size class, -1 if the buffer is bigger than BUFPOOL_MAX
+} bufpool_buffer_t;
+
+
+/**
+ * the free buffers of one thread
+ */
+typedef struct bufpool_st{
+    bufpool_buffer_t* free[BUFPOOL_CLASSES];
+    int count[BUFPOOL_CLASSES];         //buffers in every list
+} bufpool_t;
+
+
+/**
+ * bufpool_get takes a buffer of at least size bytes from the pool of
+ * the calling thread.
+ * returns NULL if there is no memory.
+ */
+void* bufpool_get(size_t size);
+
+
+/**
+ * bufpool_grow moves the first len bytes of buff to a buffer of at
+ * least size bytes and puts buff back (a buffer that is big enough is
+ * kept), buff may be NULL.
+ * returns the buffer, NULL if there is no memory (buff is still valid).
+ */
+void* bufpool_grow(void* buff, size_t len, size_t size);
+
+
+/**
+ * bufpool_put gives buff back to the pool of the calling thread, buff
+ * may be NULL.
+ */
+void bufpool_put(void* buff);
+
+
+/**
+ * bufpool_capacity returns the bytes buff can hold, its' size class.
+ */
+size_t bufpool_capacity(const void* buff);
+
+
+#endif
@@ -0,0 +1,228 @@
+/* NAME: Ofir Cohen
+ * ID: 312255847
+ * DATE:
+ *
+ * cache of rendered responses, shared by all the threads of the server.
+ * a table (table.c) keyed by the resolved path whose budget is in bytes.
+ */
+
+/* INCLUDES */
+#include "cache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+
+/* FUNCTIONS */
+static int entry_stale(table_t* table, table_entry_t* link, unsigned long generation);
+static int metadata_changed(cache_entry_t* entry, const struct stat* st);
+static int stat_key(cache_t* cache, const char* key, struct stat* st);
+static void free_entry(table_entry_t* link);
+
+
+/**
+ * create_cache creates an empty cache that holds up to max_bytes,
+ * bodies bigger than max_entry are never cached.
+ */
+cache_t* create_cache(size_t max_bytes, size_t max_entry, int revalidate_ms)
+{
+    if(max_bytes == 0)
+        return NULL;
+
+    cache_t* cache = (cache_t*)malloc(sizeof(cache_t));
+    if(cache == NULL)
+        return NULL;
+    bzero(cache, sizeof(cache_t));
+
+    if(table_init(&cache->table, CACHE_BUCKETS, max_bytes, revalidate_ms, entry_stale, free_entry) < 0)
+    {
+        free(cache);
+        return NULL;
+    }
+
+    cache->max_entry = (max_entry < max_bytes) ? max_entry : max_bytes;
+    return cache;
+}
+
+
+/**
+ * cache_lookup returns the entry of key with a reference for the caller, or NULL on a miss.
+ */
+cache_entry_t* cache_lookup(cache_t* cache, const char* key)
+{
+    if(cache == NULL)
+        return NULL;
+
+    return (cache_entry_t*)table_lookup(&cache->table, key);
+}
+
+
+/**
+ * cache_insert copies header and body into a new entry for key and makes room for it.
+ */
+cache_entry_t* cache_insert(cache_t* cache, const char* key, const char* header, int header_len, const char* body, size_t body_len, const struct stat* st, unsigned long generation)
+{
+    if(cache == NULL || body_len > cache->max_entry)
+        return NULL;
+
+    /* build the entry before taking the lock */
+    cache_entry_t* entry = (cache_entry_t*)malloc(sizeof(cache_entry_t));
+    if(entry == NULL)
+        return NULL;
+    bzero(entry, sizeof(cache_entry_t));
+
+    entry->link.key = strdup(key);
+    entry->header = (char*)malloc(sizeof(char)*(header_len + 1));
+    entry->body = (char*)malloc(sizeof(char)*(body_len + 1));
+    if(entry->link.key == NULL || entry->header == NULL || entry->body == NULL)
+    {
+        free_entry(&entry->link);
+        return NULL;
+    }
+    memcpy(entry->header, header, header_len);
+    entry->header[header_len] = '\0';
+    entry->header_len = header_len;
+    memcpy(entry->body, body, body_len);
+    entry->body[body_len] = '\0';
+    entry->body_len = body_len;
+
+    entry->mtime = st->st_mtim;
+    entry->ctime = st->st_ctim;
+    entry->size = st->st_size;
+    entry->ino = st->st_ino;
+    entry->link.checked = table_now();
+    entry->link.generation = generation;
+    entry->link.weight = body_len + header_len;
+
+    table_insert(&cache->table, &entry->link);
+    return entry;
+}
+
+
+/**
+ * cache_generation returns the current generation of the file system, 0 if it isn't watched.
+ */
+unsigned long cache_generation(cache_t* cache)
+{
+    return (cache != NULL) ? table_generation(&cache->table) : 0;
+}
+
+
+/**
+ * cache_set_generation makes the cache trust its' entries until generation() changes.
+ */
+void cache_set_generation(cache_t* cache, unsigned long (*generation)(void))
+{
+    if(cache != NULL)
+        cache->table.generation = generation;
+}
+
+
+/**
+ * cache_set_stat makes the cache compare its' entries with stat.
+ */
+void cache_set_stat(cache_t* cache, int (*stat)(const char* path, struct stat* st))
+{
+    if(cache != NULL)
+        cache->stat = stat;
+}
+
+
+/**
+ * cache_release gives back a reference, the last one frees the entry.
+ */
+void cache_release(cache_t* cache, cache_entry_t* entry)
+{
+    if(cache == NULL || entry == NULL)
+        return;
+
+    table_release(&cache->table, &entry->link);
+}
+
+
+/**
+ * cache_get_stats fills the counters of the cache.
+ */
+void cache_get_stats(cache_t* cache, cache_stats_t* stats)
+{
+    bzero(stats, sizeof(cache_stats_t));
+    if(cache == NULL)
+        return;
+
+    stats->hits = __atomic_load_n(&cache->table.hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&cache->table.misses, __ATOMIC_RELAXED);
+    stats->invalidations = __atomic_load_n(&cache->table.invalidations, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&cache->table.lock);
+    stats->evictions = cache->table.evictions;
+    stats->bytes = cache->table.weight;
+    stats->entries = cache->table.entries;
+    pthread_mutex_unlock(&cache->table.lock);
+}
+
+
+/**
+ * destroy_cache frees every entry and the cache itself.
+ */
+void destroy_cache(cache_t* cache)
+{
+    if(cache == NULL)
+        return;
+
+    table_destroy(&cache->table);
+    free(cache);
+}
+
+
+/* returns TRUE if the entry has to be built again. an entry with the cache's own stat that was trusted in an older
+   generation is dropped, something under the document root changed */
+static int entry_stale(table_t* table, table_entry_t* link, unsigned long generation)
+{
+    cache_t* cache = (cache_t*)table;
+    struct stat st;
+    return (cache->stat != NULL && generation != 0 && link->generation != 0) ||
+           stat_key(cache, link->key, &st) < 0 || metadata_changed((cache_entry_t*)link, &st);
+}
+
+
+/* free all the memory of an entry */
+static void free_entry(table_entry_t* link)
+{
+    cache_entry_t* entry = (cache_entry_t*)link;
+    if(entry->link.key)
+        free(entry->link.key);
+
+    if(entry->header)
+        free(entry->header);
+
+    if(entry->body)
+        free(entry->body);
+
+    free(entry);
+}
+
+
+/* returns TRUE if the file isn't the one the entry was built from */
+static int metadata_changed(cache_entry_t* entry, const struct stat* st)
+{
+    return st->st_ino != entry->ino || st->st_size != entry->size ||
+           st->st_mtim.tv_sec != entry->mtime.tv_sec || st->st_mtim.tv_nsec != entry->mtime.tv_nsec ||
+           st->st_ctim.tv_sec != entry->ctime.tv_sec || st->st_ctim.tv_nsec != entry->ctime.tv_nsec;
+}
+
+
+/* stat of the file of a key (with the stat of the cache if it has one), the file is the part before the '\t' of a variant key */
+static int stat_key(cache_t* cache, const char* key, struct stat* st)
+{
+    int (*stat_file)(const char*, struct stat*) = (cache->stat != NULL) ? cache->stat : stat;
+    const char* tab = strchr(key, '\t');
+    if(tab == NULL)
+        return stat_file(key, st);
+
+    char* file = strndup(key, tab - key);
+    if(file == NULL)
+        return -1;
+    int check = stat_file(file, st);
+    free(file);
+    return check;
+}
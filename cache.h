@@ -0,0 +1,144 @@
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "table.h"
+
+
+/**
+ * cache.h
+ *
+ * This file declares a shared, byte-budgeted cache of rendered
+ * responses (header lines and body) keyed by the resolved path, kept in
+ * a table (table.h) whose weight is the bytes of the entries.
+ * entries are validated against the file's metadata (mtime, ctime,
+ * size, inode) at most once every revalidate_ms (or, when the file
+ * system is watched, only after it changed), so hits don't touch the
+ * file system at all, and the least recently
+ * used entries are evicted when the budget is exceeded.
+ * a key may be the path, a '\t' and the name of a variant of the file
+ * (e.g. "index.html\tgzip", its' compressed bytes), such an entry is
+ * validated against the file before the '\t'.
+ * a response that shows more than its' file (a directory listing shows
+ * its' entries) is validated with the stat function of the cache.
+ */
+
+// number of hash buckets of a cache
+#define CACHE_BUCKETS 4096
+
+
+/**
+ * one cached response, entries are reference counted so an entry
+ * that is evicted while a worker still sends it stays valid
+ */
+typedef struct cache_entry_st{
+    table_entry_t link;         //resolved path, lru, reference count and when it was validated, the weight is header_len + body_len
+    char* header;               //header lines that don't change between requests (Content-Type, Content-Length...)
+    int header_len;
+    char* body;                 //the whole body
+    size_t body_len;
+    struct timespec mtime;      //metadata of the file when the entry was built
+    struct timespec ctime;
+    off_t size;
+    ino_t ino;
+} cache_entry_t;
+
+
+/**
+ * the cache itself
+ */
+typedef struct cache_st{
+    table_t table;              //entries, their bytes and the budget, revalidation, lock and counters
+    size_t max_entry;           //biggest body that is cached
+    int (*stat)(const char* path, struct stat* st);     //what an entry is compared to, NULL for stat()
+} cache_t;
+
+
+/**
+ * counters of a cache
+ */
+typedef struct cache_stats_st{
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long invalidations;
+    unsigned long entries;
+    size_t bytes;
+} cache_stats_t;
+
+
+/**
+ * create_cache creates an empty cache that holds up to max_bytes,
+ * bodies bigger than max_entry are never cached.
+ * returns NULL on failure.
+ */
+cache_t* create_cache(size_t max_bytes, size_t max_entry, int revalidate_ms);
+
+
+/**
+ * cache_lookup returns the entry of key with a reference the caller
+ * has to give back with cache_release, or NULL on a miss.
+ * an entry whose file changed (or is gone) is dropped and counts as a miss.
+ */
+cache_entry_t* cache_lookup(cache_t* cache, const char* key);
+
+
+/**
+ * cache_insert copies header and body into a new entry for key,
+ * replacing an older entry of the same key, and evicts least recently
+ * used entries until the cache is within its' budget. generation is
+ * the value of cache_generation() from before the file was looked at,
+ * the entry is trusted in it without being compared again.
+ * returns the new entry with a reference for the caller, NULL if it
+ * can't be cached (too big or no memory).
+ */
+cache_entry_t* cache_insert(cache_t* cache, const char* key, const char* header, int header_len, const char* body, size_t body_len, const struct stat* st, unsigned long generation);
+
+
+/**
+ * cache_generation returns the current generation of the file system
+ * the cache trusts its' entries in, 0 if it isn't watched.
+ */
+unsigned long cache_generation(cache_t* cache);
+
+
+/**
+ * cache_set_generation makes the cache trust a validated entry until
+ * generation() returns another value instead of for revalidate_ms,
+ * as long as generation() isn't 0.
+ */
+void cache_set_generation(cache_t* cache, unsigned long (*generation)(void));
+
+
+/**
+ * cache_set_stat makes the cache compare its' entries with what stat
+ * returns for their path instead of stat(), for responses that show
+ * more than the file itself. such an entry costs as much to compare as
+ * to build again, so once it was trusted in a generation it is dropped
+ * when the generation changes instead of being compared.
+ */
+void cache_set_stat(cache_t* cache, int (*stat)(const char* path, struct stat* st));
+
+
+/**
+ * cache_release gives back a reference that was returned by
+ * cache_lookup or cache_insert.
+ */
+void cache_release(cache_t* cache, cache_entry_t* entry);
+
+
+/**
+ * cache_get_stats fills the counters of the cache.
+ */
+void cache_get_stats(cache_t* cache, cache_stats_t* stats);
+
+
+/**
+ * destroy_cache frees every entry and the cache itself,
+ * no entry may be in use.
+ */
+void destroy_cache(cache_t* cache);
+
+
+#endif
@@ -0,0 +1,1042 @@
+/* NAME: Ofir Cohen
+ * ID: 312255847
+ * DATE:
+ *
+ * epoll front end of the HTTP Server.
+ * the main thread owns every socket (non-blocking, edge-triggered),
+ * reads requests until they are complete and only then hands them
+ * to the threadpool, so a slow client never pins a worker.
+ * persistent connections are handed back to the loop by the worker
+ * after the response and wait in the idle list for the next request,
+ * the rest of a rejected request is read and thrown away by the loop too.
+ * the io_uring front end is the same loop with the sockets in a ring
+ * instead of an epoll set: a multishot accept, one recv per connection
+ * into a provided buffer and one system call for every batch.
+ */
+
+/* INCLUDES */
+#define _GNU_SOURCE
+#include "server.h"
+#include "bufpool.h"
+#include "uring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+
+/* DEFINES */
+#define MAX_EVENTS 1024
+#define DRAIN_TIMEOUT 100
+
+// result of reading from a connection
+#define CONN_READY 0
+#define CONN_AGAIN 1
+#define CONN_CLOSED 2
+
+// io_uring front end: submission entries, the provided buffers the requests are received into and their group
+#define URING_ENTRIES 4096
+#define URING_BUFFERS 1024
+#define URING_BUFFER_SIZE 4096
+#define URING_GROUP 0
+
+
+/* STRUCTS */
+typedef struct conn_st{
+    int fd;                 //client socket
+    char* read_buff;        //the request that was read so far, NULL while the connection waits with nothing read
+    int read_size;          //size of read buffer, it grows up to READ_BUFFER_MAX
+    int read_len;           //number of bytes in read buffer
+    http_request_t http;    //the request in read buffer, parsed as far as it was read
+    int served;             //number of requests answered on this connection
+    long long last_active;  //when the client sent something last (ms), for the idle timeout
+    int in_flight;          //TRUE while a recv of the io_uring loop is in flight
+    int closing;            //the io_uring loop closes the connection when its' recv comes back
+    int draining;           //a rejected request was answered and the sending side shut down, what the client still sends is thrown away
+    struct conn_st* prev;   //idle list of the event loop / list of connections handed back by workers
+    struct conn_st* next;
+} conn_t;
+
+
+/* GLOBALS */
+// number of client sockets that are still open, workers close them so it is accessed atomically
+static int open_conns = 0;
+
+// connections that wait for a request, ordered by last_active. only the event loop touches this list
+static conn_t* idle_head = NULL;
+static conn_t* idle_tail = NULL;
+
+// draining connections, ordered by when they started to drain. they are closed at the end of file or after LINGER_TIMEOUT
+static conn_t* drain_head = NULL;
+static conn_t* drain_tail = NULL;
+
+// persistent connections that workers finished with, the event loop arms them again
+static conn_t* returned_head = NULL;
+static pthread_mutex_t returned_lock = PTHREAD_MUTEX_INITIALIZER;
+static int wake_fd = -1;
+
+// epoll data pointers of the listening socket and of the wake up eventfd (user data of their io_uring requests)
+static int listen_tag;
+static int wake_tag;
+
+// ring of the io_uring front end, NULL in the epoll one. only the event loop touches it
+static uring_t* ring = NULL;
+static int multishot_accept = TRUE;
+static uint64_t wake_count;
+static int cancel_tag;
+
+
+/* FUNCTIONS */
+static int set_nonblocking(int fd);
+static long long monotonic_now(void);
+static conn_t* create_conn(int fd);
+static void free_conn(conn_t* conn);
+static void close_conn(conn_t* conn);
+static int arm_conn(int epfd, conn_t* conn);
+static void idle_append(conn_t* conn);
+static void idle_remove(conn_t* conn);
+static void expire_idle(conn_t** head, long long oldest);
+static void close_kept_alive(void);
+static void close_idle(conn_t* conn);
+static int read_conn(conn_t* conn);
+static int discard_conn(conn_t* conn);
+static int accept_conns(int sockfd, int epfd, int* accepted, int max_requests);
+static void take_returned(int epfd, threadpool* tp, int listening);
+static void return_conn(conn_t* conn);
+static int serve_connection(void* arg);
+static int uring_accept(int sockfd);
+static int uring_recv(conn_t* conn);
+static int uring_wait_wake(void);
+static int uring_cancel(void* tag);
+static void uring_accepted(int fd, int* accepted);
+static void uring_received(threadpool* tp, conn_t* conn, struct io_uring_cqe* cqe);
+
+
+/* the event loop itself, returns after max_requests connections were accepted and answered */
+int run_event_loop(int sockfd, threadpool* tp, int max_requests)
+{
+    struct epoll_event ev;
+    struct epoll_event events[MAX_EVENTS];
+
+    if(set_nonblocking(sockfd) == FAILED)
+    {
+        perror("fcntl");
+        return FAILED;
+    }
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(epfd < 0)
+    {
+        perror("epoll_create1");
+        return FAILED;
+    }
+
+    /* workers wake the loop up with this eventfd when they give a connection back */
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(wake_fd < 0)
+    {
+        perror("eventfd");
+        close(epfd);
+        return FAILED;
+    }
+
+    bzero(&ev, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &wake_tag;
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, wake_fd, &ev) < 0)
+    {
+        perror("epoll_ctl");
+        close(wake_fd);
+        close(epfd);
+        return FAILED;
+    }
+
+    /* the listening socket is level triggered so no pending connection is ever lost */
+    bzero(&ev, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listen_tag;
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev) < 0)
+    {
+        perror("epoll_ctl");
+        close(wake_fd);
+        close(epfd);
+        return FAILED;
+    }
+
+    int accepted = 0;
+    int listening = TRUE;
+
+    /* run until we stopped accepting and every connection we accepted was closed */
+    while(listening || __atomic_load_n(&open_conns, __ATOMIC_ACQUIRE) > 0)
+    {
+        /* wake up when the oldest idle connection times out, or the oldest draining one */
+        int timeout = -1;
+        if(idle_head != NULL)
+        {
+            long long left = idle_head->last_active + server_config.keepalive_timeout * 1000LL - monotonic_now();
+            timeout = (left > 0) ? (int)left : 0;
+        }
+        if(drain_head != NULL)
+        {
+            long long left = drain_head->last_active + LINGER_TIMEOUT - monotonic_now();
+            if(timeout < 0 || left < timeout)
+                timeout = (left > 0) ? (int)left : 0;
+        }
+        if(!listening)
+            timeout = DRAIN_TIMEOUT;
+
+        int n = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        int i;
+        for(i = 0; i < n; i++)
+        {
+            /* new connections on the listening socket */
+            if(events[i].data.ptr == &listen_tag)
+            {
+                accept_conns(sockfd, epfd, &accepted, max_requests);
+                if(accepted >= max_requests)
+                {
+                    /* stop accepting, connections that wait for another request are closed now */
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, sockfd, NULL);
+                    listening = FALSE;
+                    close_kept_alive();
+                }
+                continue;
+            }
+
+            /* workers gave back persistent connections */
+            if(events[i].data.ptr == &wake_tag)
+            {
+                take_returned(epfd, tp, listening);
+                continue;
+            }
+
+            /* data on a client socket, read it all and check if the request is complete */
+            conn_t* conn = (conn_t*)events[i].data.ptr;
+            idle_remove(conn);
+
+            /* the rest of a rejected request, it keeps draining from when it started */
+            if(conn->draining)
+            {
+                if(discard_conn(conn) == CONN_AGAIN && arm_conn(epfd, conn) == SUCCESS)
+                    idle_append(conn);
+                else
+                    close_conn(conn);
+                continue;
+            }
+
+            int state = read_conn(conn);
+
+            if(state == CONN_READY)
+            {
+                /* the socket stays disarmed (oneshot) while a worker owns the connection, an overloaded pool turns it away */
+                if(try_dispatch(tp, serve_connection, (void*)conn) == FAILED)
+                {
+                    shed_response(conn->fd);
+                    close_conn(conn);
+                }
+            }
+            else if(state == CONN_AGAIN && arm_conn(epfd, conn) == SUCCESS)
+            {
+                conn->last_active = monotonic_now();
+                idle_append(conn);
+            }
+            else
+                close_conn(conn);
+        }
+
+        /* close connections that were idle for longer than the keep-alive timeout, and the ones that drained for LINGER_TIMEOUT */
+        long long now = monotonic_now();
+        expire_idle(&idle_head, now - server_config.keepalive_timeout * 1000LL);
+        expire_idle(&drain_head, now - LINGER_TIMEOUT);
+    }
+
+    close(wake_fd);
+    close(epfd);
+    return SUCCESS;
+}
+
+
+/* the io_uring front end, the same loop as run_event_loop with the sockets in a ring. falls back to it when the kernel can't run this one */
+int run_uring_loop(int sockfd, threadpool* tp, int max_requests)
+{
+    ring = create_uring(URING_ENTRIES);
+    if(ring == NULL || !uring_supports(ring, IORING_OP_ACCEPT) || !uring_supports(ring, IORING_OP_RECV) ||
+       !uring_supports(ring, IORING_OP_READ) || !uring_supports(ring, IORING_OP_ASYNC_CANCEL) ||
+       !(ring->features & IORING_FEAT_EXT_ARG) || uring_add_buffers(ring, URING_GROUP, URING_BUFFERS, URING_BUFFER_SIZE) < 0)
+    {
+        printf("io_uring is not available, using epoll\r\n");
+        destroy_uring(ring);
+        ring = NULL;
+        return run_event_loop(sockfd, tp, max_requests);
+    }
+
+    /* workers wake the loop up with this eventfd, it is read through the ring so it blocks */
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if(wake_fd < 0)
+    {
+        perror("eventfd");
+        destroy_uring(ring);
+        ring = NULL;
+        return FAILED;
+    }
+
+    if(uring_accept(sockfd) == FAILED || uring_wait_wake() == FAILED)
+    {
+        printf("io_uring: submission ring is full\r\n");
+        destroy_uring(ring);
+        ring = NULL;
+        close(wake_fd);
+        return FAILED;
+    }
+
+    int accepted = 0;
+    int listening = TRUE;
+
+    /* run until we stopped accepting and every connection we accepted was closed */
+    while(listening || __atomic_load_n(&open_conns, __ATOMIC_ACQUIRE) > 0)
+    {
+        /* wake up when the oldest idle connection times out, or the oldest draining one */
+        int timeout = -1;
+        if(idle_head != NULL)
+        {
+            long long left = idle_head->last_active + server_config.keepalive_timeout * 1000LL - monotonic_now();
+            timeout = (left > 0) ? (int)left : 0;
+        }
+        if(drain_head != NULL)
+        {
+            long long left = drain_head->last_active + LINGER_TIMEOUT - monotonic_now();
+            if(timeout < 0 || left < timeout)
+                timeout = (left > 0) ? (int)left : 0;
+        }
+        if(!listening)
+            timeout = DRAIN_TIMEOUT;
+
+        /* every recv, accept and cancel that was filled since the last time is submitted with the wait, in one system call */
+        int check = uring_submit_and_wait(ring, timeout);
+        if(check < 0 && check != -ETIME && check != -EINTR && check != -EBUSY && check != -EAGAIN)
+        {
+            errno = -check;
+            perror("io_uring_enter");
+            break;
+        }
+
+        struct io_uring_cqe* cqe;
+        while((cqe = uring_peek_cqe(ring)) != NULL)
+        {
+            void* tag = (void*)(uintptr_t)cqe->user_data;
+
+            /* new connection, the multishot accept stays armed as long as IORING_CQE_F_MORE is set */
+            if(tag == &listen_tag)
+            {
+                if(cqe->res >= 0)
+                {
+                    /* it was accepted before the cancel of the accept was seen */
+                    if(listening)
+                        uring_accepted(cqe->res, &accepted);
+                    else
+                        close(cqe->res);
+                }
+                else if(cqe->res == -EINVAL && multishot_accept)
+                    multishot_accept = FALSE;
+                else if(cqe->res == -EMFILE || cqe->res == -ENFILE)
+                {
+                    /* out of descriptors, the files nobody sends right now are closed to make room */
+                    if(fd_cache_trim(fd_cache) == 0)
+                    {
+                        errno = -cqe->res;
+                        perror("accept");
+                    }
+                }
+                else if(cqe->res != -ECANCELED && cqe->res != -EINTR && cqe->res != -ECONNABORTED && cqe->res != -EAGAIN)
+                {
+                    errno = -cqe->res;
+                    perror("accept");
+                }
+
+                if(listening && accepted >= max_requests)
+                {
+                    /* stop accepting, connections that wait for another request are closed now */
+                    uring_cancel(&listen_tag);
+                    listening = FALSE;
+                    close_kept_alive();
+                }
+                else if(listening && !(cqe->flags & IORING_CQE_F_MORE))
+                    uring_accept(sockfd);
+            }
+
+            /* workers gave back persistent connections */
+            else if(tag == &wake_tag)
+            {
+                take_returned(-1, tp, listening);
+                if(uring_wait_wake() == FAILED)
+                    printf("io_uring: submission ring is full\r\n");
+            }
+
+            /* data (or the end of it) on a client socket */
+            else if(tag != &cancel_tag)
+                uring_received(tp, (conn_t*)tag, cqe);
+
+            uring_cqe_seen(ring);
+        }
+
+        /* close connections that were idle for longer than the keep-alive timeout, and the ones that drained for LINGER_TIMEOUT */
+        long long now = monotonic_now();
+        expire_idle(&idle_head, now - server_config.keepalive_timeout * 1000LL);
+        expire_idle(&drain_head, now - LINGER_TIMEOUT);
+    }
+
+    /* the kernel cancels the read of the eventfd with the ring */
+    destroy_uring(ring);
+    ring = NULL;
+    close(wake_fd);
+    return SUCCESS;
+}
+
+
+/* arm the accept of the listening socket, one request accepts every connection while it is multishot */
+static int uring_accept(int sockfd)
+{
+    struct io_uring_sqe* sqe = uring_get_sqe(ring);
+    if(sqe == NULL)
+        return FAILED;
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = sockfd;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    if(multishot_accept)
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = (uintptr_t)&listen_tag;
+    return SUCCESS;
+}
+
+
+/* arm one recv on a connection, the kernel picks a provided buffer when data arrives so a waiting connection holds none.
+ * it isn't multishot: like the oneshot epoll event, nothing is received while a worker owns the connection */
+static int uring_recv(conn_t* conn)
+{
+    struct io_uring_sqe* sqe = uring_get_sqe(ring);
+    if(sqe == NULL)
+        return FAILED;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_GROUP;
+    sqe->user_data = (uintptr_t)conn;
+    conn->in_flight = TRUE;
+    return SUCCESS;
+}
+
+
+/* arm the read of the wake up eventfd */
+static int uring_wait_wake(void)
+{
+    struct io_uring_sqe* sqe = uring_get_sqe(ring);
+    if(sqe == NULL)
+        return FAILED;
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wake_fd;
+    sqe->addr = (uintptr_t)&wake_count;
+    sqe->len = sizeof(wake_count);
+    sqe->user_data = (uintptr_t)&wake_tag;
+    return SUCCESS;
+}
+
+
+/* cancel the request with the user data tag, it completes with -ECANCELED (or with what it got before) */
+static int uring_cancel(void* tag)
+{
+    struct io_uring_sqe* sqe = uring_get_sqe(ring);
+    if(sqe == NULL)
+    {
+        /* a recv also returns when its' socket is shut down */
+        if(tag != &listen_tag)
+            shutdown(((conn_t*)tag)->fd, SHUT_RDWR);
+        return FAILED;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = (uintptr_t)tag;
+    sqe->user_data = (uintptr_t)&cancel_tag;
+    return SUCCESS;
+}
+
+
+/* a connection the multishot accept returned, it waits for its' first request like an idle one */
+static void uring_accepted(int fd, int* accepted)
+{
+    tune_client(fd);
+
+    conn_t* conn = create_conn(fd);
+    if(conn == NULL)
+    {
+        close(fd);
+        return;
+    }
+
+    if(uring_recv(conn) == FAILED)
+    {
+        close(fd);
+        free_conn(conn);
+        return;
+    }
+
+    conn->last_active = monotonic_now();
+    idle_append(conn);
+
+    (*accepted)++;
+    __atomic_add_fetch(&open_conns, 1, __ATOMIC_RELEASE);
+}
+
+
+/* the recv of a connection completed, what came is copied to the read buffer and the provided buffer goes back to the kernel */
+static void uring_received(threadpool* tp, conn_t* conn, struct io_uring_cqe* cqe)
+{
+    conn->in_flight = FALSE;
+    idle_remove(conn);
+
+    char* data = NULL;
+    unsigned int id = 0;
+    if(cqe->flags & IORING_CQE_F_BUFFER)
+    {
+        id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        data = uring_buffer(ring, id);
+    }
+
+    int state = CONN_AGAIN;
+    int res = cqe->res;
+
+    /* the rest of a rejected request is thrown away with its' buffer, it keeps draining from when it started */
+    if(conn->draining && !conn->closing)
+    {
+        if(data != NULL)
+            uring_recycle_buffer(ring, id);
+        if((res > 0 || res == -ENOBUFS || res == -EINTR || res == -EAGAIN) && uring_recv(conn) == SUCCESS)
+            idle_append(conn);
+        else
+            close_conn(conn);
+        return;
+    }
+
+    /* -ENOBUFS: every provided buffer was in use, the recv is armed again once they came back */
+    if(conn->closing || (res < 0 && res != -ENOBUFS && res != -EINTR && res != -EAGAIN))
+        state = CONN_CLOSED;
+    else if(res == 0)
+    {
+        /* client closed its' side, what it sent so far is answered like in the blocking front end */
+        if(conn->read_len == 0)
+            state = CONN_CLOSED;
+        else
+        {
+            http_parse(&conn->http, conn->read_buff, conn->read_len);
+            http_parse_end(&conn->http);
+            state = CONN_READY;
+        }
+    }
+    else if(res > 0 && data != NULL)
+    {
+        /* the read buffer is taken from the pool of the event loop when the client sends something */
+        if(conn->read_buff == NULL)
+        {
+            conn->read_buff = (char*)bufpool_get(BUFFER_SIZE);
+            conn->read_size = BUFFER_SIZE;
+        }
+
+        if(conn->read_buff == NULL)
+            state = CONN_CLOSED;
+        else
+        {
+            /* the parser stops the request before the buffer reaches READ_BUFFER_MAX, the rest isn't needed */
+            int copied = 0;
+            while(copied < res)
+            {
+                if(conn->read_len == conn->read_size && grow_read_buffer(&conn->read_buff, &conn->read_size) == FAILED)
+                    break;
+
+                int nbytes = res - copied;
+                if(nbytes > conn->read_size - conn->read_len)
+                    nbytes = conn->read_size - conn->read_len;
+                memcpy(conn->read_buff + conn->read_len, data + copied, nbytes);
+                conn->read_len += nbytes;
+                copied += nbytes;
+            }
+
+            if(http_parse(&conn->http, conn->read_buff, conn->read_len) != PARSE_PARTIAL)
+                state = CONN_READY;
+        }
+    }
+
+    if(data != NULL)
+        uring_recycle_buffer(ring, id);
+
+    if(state == CONN_READY)
+    {
+        /* nothing is received on the connection while a worker owns it, an overloaded pool turns it away */
+        if(try_dispatch(tp, serve_connection, (void*)conn) == FAILED)
+        {
+            shed_response(conn->fd);
+            close_conn(conn);
+        }
+    }
+    else if(state == CONN_AGAIN && uring_recv(conn) == SUCCESS)
+    {
+        conn->last_active = monotonic_now();
+        idle_append(conn);
+    }
+    else
+        close_conn(conn);
+}
+
+
+/* accept every pending connection and register it in the epoll set */
+static int accept_conns(int sockfd, int epfd, int* accepted, int max_requests)
+{
+    struct epoll_event ev;
+
+    while(*accepted < max_requests)
+    {
+        int fd = accept4(sockfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0)
+        {
+            if(errno == EINTR || errno == ECONNABORTED || errno == EPROTO)
+                continue;
+
+            /* no more pending connections */
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                return SUCCESS;
+
+            /* out of descriptors, the files nobody sends right now are closed to make room */
+            if((errno == EMFILE || errno == ENFILE) && fd_cache_trim(fd_cache) > 0)
+                continue;
+
+            perror("accept");
+            return FAILED;
+        }
+
+        tune_client(fd);
+
+        conn_t* conn = create_conn(fd);
+        if(conn == NULL)
+        {
+            close(fd);
+            continue;
+        }
+
+        bzero(&ev, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+        ev.data.ptr = conn;
+        if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            perror("epoll_ctl");
+            close(fd);
+            free_conn(conn);
+            continue;
+        }
+
+        /* a client that connects and never sends a request times out like an idle one */
+        conn->last_active = monotonic_now();
+        idle_append(conn);
+
+        (*accepted)++;
+        __atomic_add_fetch(&open_conns, 1, __ATOMIC_RELEASE);
+    }
+    return SUCCESS;
+}
+
+
+/* read everything the client sent so far, edge triggered so we read until EAGAIN */
+static int read_conn(conn_t* conn)
+{
+    /* the read buffer is taken from the pool of the event loop when the client sends something */
+    if(conn->read_buff == NULL)
+    {
+        conn->read_buff = (char*)bufpool_get(BUFFER_SIZE);
+        if(conn->read_buff == NULL)
+            return CONN_CLOSED;
+        conn->read_size = BUFFER_SIZE;
+    }
+
+    while(TRUE)
+    {
+        /* the parser stops the request before the buffer reaches READ_BUFFER_MAX, then there is nothing more to read */
+        if(conn->read_len == conn->read_size && grow_read_buffer(&conn->read_buff, &conn->read_size) == FAILED)
+            break;
+
+        int nbytes = read(conn->fd, conn->read_buff + conn->read_len, conn->read_size - conn->read_len);
+        if(nbytes < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return CONN_CLOSED;
+        }
+
+        /* client closed its' side, what it sent so far is answered like in the blocking front end */
+        if(nbytes == 0)
+        {
+            if(conn->read_len == 0)
+                return CONN_CLOSED;
+            http_parse(&conn->http, conn->read_buff, conn->read_len);
+            http_parse_end(&conn->http);
+            return CONN_READY;
+        }
+
+        conn->read_len += nbytes;
+    }
+
+    /* the parser goes on from where the last read stopped, an invalid request is answered too */
+    if(http_parse(&conn->http, conn->read_buff, conn->read_len) != PARSE_PARTIAL)
+        return CONN_READY;
+
+    return CONN_AGAIN;
+}
+
+
+/* read and throw away what the client of a draining connection sent, until EAGAIN (CONN_AGAIN) or the end of file (CONN_CLOSED) */
+static int discard_conn(conn_t* conn)
+{
+    char discard[BUFFER_SIZE];
+    while(TRUE)
+    {
+        int nbytes = read(conn->fd, discard, sizeof(discard));
+        if(nbytes < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                return CONN_AGAIN;
+            return CONN_CLOSED;
+        }
+        if(nbytes == 0)
+            return CONN_CLOSED;
+    }
+}
+
+
+/* threadpool job, answers a complete request and gives a persistent connection back to the event loop */
+static int serve_connection(void* arg)
+{
+    conn_t* conn = (conn_t*)arg;
+    int fd = conn->fd;
+
+    /* every complete request that is already in the read buffer is answered now (pipelining) and the responses are sent together */
+    out_batch_t batch;
+    batch_start(&batch, fd);
+
+    int keep_alive;
+    while(TRUE)
+    {
+        /* the request borrows the read buffer and the parsed request of the connection */
+        request_t* request = new_request(conn->read_buff, &conn->http, (++conn->served < server_config.keepalive_max) ? TRUE : FALSE);
+        if(request == NULL)
+        {
+            batch_stop();
+            close_conn(conn);
+            return FAILED;
+        }
+
+        batch_gather((conn->read_len > conn->http.head_len) ? TRUE : FALSE);
+        process_request(request, fd);
+
+        keep_alive = request->keep_alive;
+        free_struct(request);
+        if(!keep_alive)
+            break;
+
+        /* keep whatever the client sent after this request, it is the beginning of the next one */
+        conn->read_len -= conn->http.head_len;
+        memmove(conn->read_buff, conn->read_buff + conn->http.head_len, conn->read_len);
+        http_parser_init(&conn->http);
+        if(http_parse(&conn->http, conn->read_buff, conn->read_len) == PARSE_PARTIAL)
+            break;
+    }
+
+    if(batch_stop() == FAILED)
+        keep_alive = FALSE;
+
+    if(!keep_alive)
+    {
+        /* the client may still be sending a request that was too large, the event loop reads the rest so this worker doesn't wait for it */
+        if(conn->http.result != PARSE_COMPLETE && shutdown(fd, SHUT_WR) == 0)
+        {
+            conn->draining = TRUE;
+            return_conn(conn);
+            return SUCCESS;
+        }
+        close_conn(conn);
+        return SUCCESS;
+    }
+
+    /* the rest of the next request is waited for by the event loop */
+    return_conn(conn);
+    return SUCCESS;
+}
+
+
+/* worker side, hand a persistent (or draining) connection back to the event loop */
+static void return_conn(conn_t* conn)
+{
+    pthread_mutex_lock(&returned_lock);
+    conn->next = returned_head;
+    returned_head = conn;
+    pthread_mutex_unlock(&returned_lock);
+
+    uint64_t one = 1;
+    if(write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        perror("write");
+}
+
+
+/* event loop side, arm the connections that workers gave back (or serve them right away if the next request is already here) */
+static void take_returned(int epfd, threadpool* tp, int listening)
+{
+    /* the io_uring loop already read the eventfd through its' ring */
+    uint64_t count;
+    if(ring == NULL && read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        perror("read");
+
+    pthread_mutex_lock(&returned_lock);
+    conn_t* conn = returned_head;
+    returned_head = NULL;
+    pthread_mutex_unlock(&returned_lock);
+
+    long long now = monotonic_now();
+    while(conn != NULL)
+    {
+        conn_t* next = conn->next;
+        conn->prev = NULL;
+        conn->next = NULL;
+
+        if(conn->draining)
+        {
+            /* closing a socket with unread bytes resets the connection, the response is lost if the client didn't read it yet */
+            if(((ring != NULL) ? uring_recv(conn) : arm_conn(epfd, conn)) == SUCCESS)
+            {
+                bufpool_put(conn->read_buff);
+                conn->read_buff = NULL;
+                conn->read_size = 0;
+                conn->read_len = 0;
+                conn->last_active = now;
+                idle_append(conn);
+            }
+            else
+                close_conn(conn);
+        }
+        else if(conn->http.result != PARSE_PARTIAL)
+        {
+            if(try_dispatch(tp, serve_connection, (void*)conn) == FAILED)
+            {
+                shed_response(conn->fd);
+                close_conn(conn);
+            }
+        }
+        else if(listening && ((ring != NULL) ? uring_recv(conn) : arm_conn(epfd, conn)) == SUCCESS)
+        {
+            /* an idle connection doesn't hold a buffer, it goes back to the pool until the next request */
+            if(conn->read_len == 0)
+            {
+                bufpool_put(conn->read_buff);
+                conn->read_buff = NULL;
+                conn->read_size = 0;
+            }
+            conn->last_active = now;
+            idle_append(conn);
+        }
+        else
+            close_conn(conn);
+
+        conn = next;
+    }
+}
+
+
+/* arm the oneshot event of a connection again, if data already arrived the event fires right away */
+static int arm_conn(int epfd, conn_t* conn)
+{
+    struct epoll_event ev;
+    bzero(&ev, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+    ev.data.ptr = conn;
+    if(epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev) < 0)
+        return FAILED;
+
+    return SUCCESS;
+}
+
+
+/* add connection to the tail of the idle list, or of the drain list if it is draining (it is the most recently active) */
+static void idle_append(conn_t* conn)
+{
+    conn_t** head = conn->draining ? &drain_head : &idle_head;
+    conn_t** tail = conn->draining ? &drain_tail : &idle_tail;
+
+    conn->next = NULL;
+    conn->prev = *tail;
+    if(*tail)
+        (*tail)->next = conn;
+    else
+        *head = conn;
+    *tail = conn;
+}
+
+
+/* remove connection from the idle list (or the drain list), does nothing if it isn't there */
+static void idle_remove(conn_t* conn)
+{
+    conn_t** head = conn->draining ? &drain_head : &idle_head;
+    conn_t** tail = conn->draining ? &drain_tail : &idle_tail;
+
+    if(conn->prev)
+        conn->prev->next = conn->next;
+    else if(*head == conn)
+        *head = conn->next;
+    else
+        return;
+
+    if(conn->next)
+        conn->next->prev = conn->prev;
+    else
+        *tail = conn->prev;
+
+    conn->prev = NULL;
+    conn->next = NULL;
+}
+
+
+/* close the idle connections that were already served, new ones still wait for their first request */
+static void close_kept_alive(void)
+{
+    conn_t* conn = idle_head;
+    while(conn != NULL)
+    {
+        conn_t* next = conn->next;
+        if(conn->served > 0)
+        {
+            idle_remove(conn);
+            close_idle(conn);
+        }
+        conn = next;
+    }
+}
+
+
+/* close every connection of the idle list (or the drain list) at head that was last active before oldest */
+static void expire_idle(conn_t** head, long long oldest)
+{
+    while(*head != NULL && (*head)->last_active < oldest)
+    {
+        conn_t* conn = *head;
+        idle_remove(conn);
+        close_idle(conn);
+    }
+}
+
+
+/* close a connection that was taken off the idle list, one the io_uring loop still receives on is closed when its' recv was cancelled */
+static void close_idle(conn_t* conn)
+{
+    if(conn->in_flight)
+    {
+        conn->closing = TRUE;
+        uring_cancel(conn);
+        return;
+    }
+    close_conn(conn);
+}
+
+
+/* create connection struct for a client socket */
+static conn_t* create_conn(int fd)
+{
+    conn_t* conn = (conn_t*)malloc(sizeof(conn_t));
+    if(conn == NULL)
+        return NULL;
+
+    conn->read_buff = NULL;
+    conn->read_size = 0;
+    conn->read_len = 0;
+    http_parser_init(&conn->http);
+    conn->served = 0;
+    conn->in_flight = FALSE;
+    conn->closing = FALSE;
+    conn->draining = FALSE;
+    conn->fd = fd;
+    conn->prev = NULL;
+    conn->next = NULL;
+    return conn;
+}
+
+
+/* close the socket of a connection and free it */
+static void close_conn(conn_t* conn)
+{
+    close(conn->fd);
+    free_conn(conn);
+    __atomic_sub_fetch(&open_conns, 1, __ATOMIC_RELEASE);
+}
+
+
+/* free connection struct, the socket is closed by the caller */
+static void free_conn(conn_t* conn)
+{
+    bufpool_put(conn->read_buff);
+    free(conn);
+}
+
+
+/* set O_NONBLOCK on a socket */
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if(flags < 0)
+        return FAILED;
+
+    if(fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return FAILED;
+
+    return SUCCESS;
+}
+
+
+/* milliseconds of the monotonic clock, the idle timeout must not jump with the wall clock */
+static long long monotonic_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/* tens of thousands of connections need more descriptors than the default soft limit, it is raised before the caches take their share */
+void raise_fd_limit(void)
+{
+    struct rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE, &rl) < 0)
+        return;
+
+    if(rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
@@ -0,0 +1,217 @@
+/* NAME: Ofir Cohen
+ * ID: 312255847
+ * DATE:
+ *
+ * cache of open files, shared by all the threads of the server.
+ * a table (table.c) keyed by the path whose budget is the number of
+ * open descriptors.
+ */
+
+/* INCLUDES */
+#include "fd_cache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/resource.h>
+
+
+/* FUNCTIONS */
+static int open_file(fd_cache_t* cache, const char* path, fd_entry_t* entry);
+static int entry_stale(table_t* table, table_entry_t* link, unsigned long generation);
+static int metadata_changed(fd_entry_t* entry, const struct stat* st);
+static void free_entry(table_entry_t* link);
+
+
+/**
+ * create_fd_cache creates an empty cache that keeps up to max_fds descriptors open.
+ */
+fd_cache_t* create_fd_cache(int max_fds, int revalidate_ms)
+{
+    /* the rest of the descriptors are left for the sockets and for the files that aren't cached */
+    struct rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && (rlim_t)max_fds > rl.rlim_cur / FD_CACHE_SHARE)
+        max_fds = rl.rlim_cur / FD_CACHE_SHARE;
+    if(max_fds <= 0)
+        return NULL;
+
+    fd_cache_t* cache = (fd_cache_t*)malloc(sizeof(fd_cache_t));
+    if(cache == NULL)
+        return NULL;
+    bzero(cache, sizeof(fd_cache_t));
+
+    if(table_init(&cache->table, FD_CACHE_BUCKETS, max_fds, revalidate_ms, entry_stale, free_entry) < 0)
+    {
+        free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+
+/**
+ * fd_cache_open returns the open file of path with a reference for the caller, NULL if it can't be opened.
+ */
+fd_entry_t* fd_cache_open(fd_cache_t* cache, const char* path, fd_entry_t* uncached)
+{
+    if(cache == NULL)
+        return (open_file(NULL, path, uncached) == 0) ? uncached : NULL;
+
+    long long now = table_now();
+
+    /* taken before the file is looked at, so a change after it is never hidden */
+    unsigned long generation = table_generation(&cache->table);
+
+    fd_entry_t* entry = (fd_entry_t*)table_lookup(&cache->table, path);
+    if(entry != NULL)
+        return entry;
+
+    /* build the entry before taking the lock, without memory the file is still sent from an uncached descriptor */
+    entry = (fd_entry_t*)malloc(sizeof(fd_entry_t));
+    char* key = strdup(path);
+    if(entry == NULL || key == NULL)
+    {
+        free(entry);
+        free(key);
+        return (open_file(cache, path, uncached) == 0) ? uncached : NULL;
+    }
+    if(open_file(cache, path, entry) < 0)
+    {
+        free(entry);
+        free(key);
+        return NULL;
+    }
+    entry->link.key = key;
+    entry->link.checked = now;
+    entry->link.generation = generation;
+    entry->link.weight = 1;
+
+    table_insert(&cache->table, &entry->link);
+    return entry;
+}
+
+
+/**
+ * fd_cache_set_generation makes the cache trust its' entries until generation() changes.
+ */
+void fd_cache_set_generation(fd_cache_t* cache, unsigned long (*generation)(void))
+{
+    if(cache != NULL)
+        cache->table.generation = generation;
+}
+
+
+/**
+ * fd_cache_release gives back a reference, the last one closes the file.
+ */
+void fd_cache_release(fd_cache_t* cache, fd_entry_t* entry)
+{
+    if(entry == NULL)
+        return;
+
+    /* the descriptor was opened for this request only */
+    if(entry->link.key == NULL)
+    {
+        close(entry->fd);
+        entry->fd = -1;
+        return;
+    }
+
+    table_release(&cache->table, &entry->link);
+}
+
+
+/**
+ * fd_cache_trim closes every cached descriptor nobody is using.
+ */
+int fd_cache_trim(fd_cache_t* cache)
+{
+    if(cache == NULL)
+        return 0;
+
+    return table_trim(&cache->table);
+}
+
+
+/**
+ * fd_cache_get_stats fills the counters of the cache.
+ */
+void fd_cache_get_stats(fd_cache_t* cache, fd_cache_stats_t* stats)
+{
+    bzero(stats, sizeof(fd_cache_stats_t));
+    if(cache == NULL)
+        return;
+
+    stats->hits = __atomic_load_n(&cache->table.hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&cache->table.misses, __ATOMIC_RELAXED);
+    stats->invalidations = __atomic_load_n(&cache->table.invalidations, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&cache->table.lock);
+    stats->evictions = cache->table.evictions;
+    stats->entries = cache->table.entries;
+    stats->max_fds = cache->table.max_weight;
+    pthread_mutex_unlock(&cache->table.lock);
+}
+
+
+/**
+ * destroy_fd_cache closes every descriptor and frees the cache.
+ */
+void destroy_fd_cache(fd_cache_t* cache)
+{
+    if(cache == NULL)
+        return;
+
+    table_destroy(&cache->table);
+    free(cache);
+}
+
+
+/* opens path into entry (an uncached one until the caller says otherwise), the unused cached descriptors are closed when the process has no more. returns 0, -1 on failure */
+static int open_file(fd_cache_t* cache, const char* path, fd_entry_t* entry)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0 && (errno == EMFILE || errno == ENFILE) && fd_cache_trim(cache) > 0)
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return -1;
+
+    bzero(entry, sizeof(fd_entry_t));
+    if(fstat(fd, &entry->st) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    entry->fd = fd;
+    entry->link.refs = 1;
+    return 0;
+}
+
+
+/* returns TRUE if the path doesn't lead to the file the entry has open anymore, or the file changed */
+static int metadata_changed(fd_entry_t* entry, const struct stat* st)
+{
+    return st->st_ino != entry->st.st_ino || st->st_dev != entry->st.st_dev || st->st_size != entry->st.st_size ||
+           st->st_mtim.tv_sec != entry->st.st_mtim.tv_sec || st->st_mtim.tv_nsec != entry->st.st_mtim.tv_nsec ||
+           st->st_ctim.tv_sec != entry->st.st_ctim.tv_sec || st->st_ctim.tv_nsec != entry->st.st_ctim.tv_nsec;
+}
+
+
+/* the path may lead to another file now (renamed over), or the file changed */
+static int entry_stale(table_t* table, table_entry_t* link, unsigned long generation)
+{
+    struct stat st;
+    return stat(link->key, &st) < 0 || metadata_changed((fd_entry_t*)link, &st);
+}
+
+
+/* close the file and free the entry */
+static void free_entry(table_entry_t* link)
+{
+    fd_entry_t* entry = (fd_entry_t*)link;
+    close(entry->fd);
+    free(entry->link.key);
+    free(entry);
+}
@@ -0,0 +1,119 @@
+#ifndef _FD_CACHE_H_
+#define _FD_CACHE_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "table.h"
+
+
+/**
+ * fd_cache.h
+ *
+ * This file declares a shared cache of open files keyed by their path,
+ * every entry keeps the descriptor and its' fstat, so a hot file that
+ * is too big for the file cache is sent without open, fstat and close.
+ * the entries are kept in a table (table.h) where every one weighs 1.
+ * entries are validated against the file's metadata (inode, size,
+ * mtime, ctime) at most once every revalidate_ms (or, when the file
+ * system is watched, only after it changed) and a file that was
+ * replaced or changed is opened again. the cache holds at most max_fds
+ * descriptors and never more than a FD_CACHE_SHARE part of the soft
+ * RLIMIT_NOFILE, the least recently used ones are closed first and the
+ * unused ones are given back when the process runs out of descriptors.
+ * the descriptors are shared by the threads, the file is read at an
+ * offset (pread, sendfile) and never moved.
+ */
+
+// number of hash buckets of the cache
+#define FD_CACHE_BUCKETS 1024
+
+// the cache takes at most 1/FD_CACHE_SHARE of the descriptors the process may open
+#define FD_CACHE_SHARE 4
+
+
+/**
+ * one open file, entries are reference counted so a descriptor that is
+ * evicted while a worker still sends from it stays open
+ */
+typedef struct fd_entry_st{
+    table_entry_t link;         //path of the file (NULL if the entry isn't in the cache, the caller's storage), lru, reference count and when it was validated
+    int fd;
+    struct stat st;             //fstat of fd when it was opened
+} fd_entry_t;
+
+
+/**
+ * the cache itself
+ */
+typedef struct fd_cache_st{
+    table_t table;              //open files, the most descriptors the cache keeps open is its' budget, revalidation, lock and counters
+} fd_cache_t;
+
+
+/**
+ * counters of the cache
+ */
+typedef struct fd_cache_stats_st{
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long invalidations;
+    int entries;
+    int max_fds;
+} fd_cache_stats_t;
+
+
+/**
+ * create_fd_cache creates an empty cache that keeps up to max_fds
+ * descriptors open (less if RLIMIT_NOFILE is low).
+ * returns NULL on failure or if max_fds is 0.
+ */
+fd_cache_t* create_fd_cache(int max_fds, int revalidate_ms);
+
+
+/**
+ * fd_cache_open returns the open file of path with a reference the
+ * caller has to give back with fd_cache_release. a file that can't be
+ * kept in the cache (cache is NULL, no memory) is opened into uncached.
+ * returns NULL if the file can't be opened.
+ */
+fd_entry_t* fd_cache_open(fd_cache_t* cache, const char* path, fd_entry_t* uncached);
+
+
+/**
+ * fd_cache_set_generation makes the cache trust a validated entry until
+ * generation() returns another value instead of for revalidate_ms,
+ * as long as generation() isn't 0.
+ */
+void fd_cache_set_generation(fd_cache_t* cache, unsigned long (*generation)(void));
+
+
+/**
+ * fd_cache_release gives back a reference that was returned by
+ * fd_cache_open, an entry that isn't in the cache is closed.
+ */
+void fd_cache_release(fd_cache_t* cache, fd_entry_t* entry);
+
+
+/**
+ * fd_cache_trim closes every cached descriptor nobody is using, it is
+ * called when the process ran out of descriptors.
+ * returns the number of descriptors that were closed.
+ */
+int fd_cache_trim(fd_cache_t* cache);
+
+
+/**
+ * fd_cache_get_stats fills the counters of the cache.
+ */
+void fd_cache_get_stats(fd_cache_t* cache, fd_cache_stats_t* stats);
+
+
+/**
+ * destroy_fd_cache closes every descriptor and frees the cache,
+ * no entry may be in use.
+ */
+void destroy_fd_cache(fd_cache_t* cache);
+
+
+#endif
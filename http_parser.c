@@ -0,0 +1,631 @@
+/* NAME: Ofir Cohen
+ * ID: 312255847
+ * DATE:
+ *
+ * parser of HTTP requests, a state machine that can stop at any byte
+ * and go on when more bytes were read. the request line and the
+ * headers are kept as offsets into the read buffer.
+ * the method, the path, the header names and the values are skipped in
+ * bulk by scan kernels (SSE4.2, AVX2 or scalar) that are chosen at run
+ * time, so the server runs on any x86-64 CPU and on other architectures.
+ */
+
+/* INCLUDES */
+#include "http_parser.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define X86_SIMD
+#include <immintrin.h>
+#endif
+
+
+/* DEFINES */
+#define TRUE 1
+#define FALSE 0
+#define SUCCESS 0
+#define FAILED 1
+
+// states of the parser
+#define S_START 0           //before the method, empty lines are skipped
+#define S_METHOD 1
+#define S_PATH_START 2
+#define S_PATH 3
+#define S_VERSION 4
+#define S_LINE_LF 5         //'\r' that ends the request line was seen
+#define S_HEADER_START 6    //beginning of a header line, or of the empty line that ends the head
+#define S_HEADER_NAME 7
+#define S_VALUE_START 8     //white space before the value
+#define S_VALUE 9
+#define S_VALUE_LF 10       //'\r' that ends a header line was seen
+#define S_END_LF 11         //'\r' of the empty line was seen
+#define S_DONE 12
+
+// a path ends at a byte below PATH_LIMIT (a space or a control character), a header value at a byte below VALUE_LIMIT, both at DEL
+#define PATH_LIMIT 0x21
+#define VALUE_LIMIT 0x20
+#define DEL 0x7f
+
+// a byte is a token character when bit (byte >> 4) of TOKEN_GROUPS[byte & 0xf] is set (the high nibble picks the bit, 8 and up are never
+// tokens), the SIMD kernels look both up with PSHUFB
+#define TOKEN_GROUPS (char)0xe8, (char)0xfc, (char)0xf8, (char)0xfc, (char)0xfc, (char)0xfc, (char)0xfc, (char)0xfc, \
+                     (char)0xf8, (char)0xf8, (char)0xf4, (char)0x54, (char)0xd0, (char)0x54, (char)0xf4, (char)0x70
+#define HIGH_NIBBLE_BITS 1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0
+
+
+/* GLOBALS */
+// kernels that skip the bytes of a path or a value, and of a method or a header name. scan(buff, pos, end, limit) returns the
+// first position (before end) of a byte below limit or DEL, scan_token(buff, pos, end) of a byte that isn't a token character, end if there is none
+static int scan_scalar(const char* buff, int pos, int end, unsigned char limit);
+static int scan_token_scalar(const char* buff, int pos, int end);
+static int (*scan)(const char* buff, int pos, int end, unsigned char limit) = scan_scalar;
+static int (*scan_token)(const char* buff, int pos, int end) = scan_token_scalar;
+static int scan_kernel = HTTP_SCAN_SCALAR;
+
+// characters of a method or a header name (tchar of RFC 7230), one row for every 16 bytes
+static const unsigned char token_chars[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 1, 0, 1, 1, 1, 1, 1, 0, 0, 1, 1, 0, 1, 1, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 0, 1, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+
+/* FUNCTIONS */
+#ifdef X86_SIMD
+static int scan_sse42(const char* buff, int pos, int end, unsigned char limit);
+static int scan_avx2(const char* buff, int pos, int end, unsigned char limit);
+static int scan_token_sse42(const char* buff, int pos, int end);
+static int scan_token_avx2(const char* buff, int pos, int end);
+
+/* 16 bytes at a time, the group of the low nibble and the bit of the high nibble of every byte are looked up with PSHUFB */
+__attribute__((target("sse4.2")))
+static int scan_token_sse42(const char* buff, int pos, int end)
+{
+    const __m128i groups = _mm_setr_epi8(TOKEN_GROUPS);
+    const __m128i bits = _mm_setr_epi8(HIGH_NIBBLE_BITS);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    while(pos + 16 <= end)
+    {
+        __m128i data = _mm_loadu_si128((const __m128i*)(buff + pos));
+        __m128i low = _mm_and_si128(data, nibble);
+        __m128i high = _mm_and_si128(_mm_srli_epi16(data, 4), nibble);
+        __m128i hit = _mm_and_si128(_mm_shuffle_epi8(groups, low), _mm_shuffle_epi8(bits, high));
+        unsigned int stop = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(hit, _mm_setzero_si128()));
+        if(stop != 0)
+            return pos + __builtin_ctz(stop);
+        pos += 16;
+    }
+    return scan_token_scalar(buff, pos, end);
+}
+
+
+/* 32 bytes at a time, the same lookup (PSHUFB looks up in each 16 byte lane, so the tables are in both) */
+__attribute__((target("avx2")))
+static int scan_token_avx2(const char* buff, int pos, int end)
+{
+    const __m256i groups = _mm256_broadcastsi128_si256(_mm_setr_epi8(TOKEN_GROUPS));
+    const __m256i bits = _mm256_broadcastsi128_si256(_mm_setr_epi8(HIGH_NIBBLE_BITS));
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    while(pos + 32 <= end)
+    {
+        __m256i data = _mm256_loadu_si256((const __m256i*)(buff + pos));
+        __m256i low = _mm256_and_si256(data, nibble);
+        __m256i high = _mm256_and_si256(_mm256_srli_epi16(data, 4), nibble);
+        __m256i hit = _mm256_and_si256(_mm256_shuffle_epi8(groups, low), _mm256_shuffle_epi8(bits, high));
+        unsigned int stop = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hit, _mm256_setzero_si256()));
+        if(stop != 0)
+            return pos + __builtin_ctz(stop);
+        pos += 32;
+    }
+
+    /* the rest is shorter than 32 bytes, header names almost always are */
+    if(pos + 16 <= end)
+    {
+        __m128i data = _mm_loadu_si128((const __m128i*)(buff + pos));
+        __m128i low = _mm_and_si128(data, _mm256_castsi256_si128(nibble));
+        __m128i high = _mm_and_si128(_mm_srli_epi16(data, 4), _mm256_castsi256_si128(nibble));
+        __m128i hit = _mm_and_si128(_mm_shuffle_epi8(_mm256_castsi256_si128(groups), low), _mm_shuffle_epi8(_mm256_castsi256_si128(bits), high));
+        unsigned int stop = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(hit, _mm_setzero_si128()));
+        if(stop != 0)
+            return pos + __builtin_ctz(stop);
+        pos += 16;
+    }
+    return scan_token_scalar(buff, pos, end);
+}
+#endif
+static int is_token(unsigned char c);
+static int header_done(http_request_t* req, const char* buff, int end);
+static int parse_version(http_request_t* req, const char* buff);
+static int has_token(const char* value, int len, const char* token);
+static int finish(http_request_t* req, int pos, int result);
+
+
+/**
+ * http_parser_setup chooses the kernel http_parse scans with, it is
+ * called once before the parser is used (the scalar kernel is used
+ * until then).
+ * returns SUCCESS, or FAILED if the CPU doesn't have that kernel (the
+ * kernel that was used stays).
+ */
+int http_parser_setup(int kernel)
+{
+    int avx2 = FALSE;
+    int sse42 = FALSE;
+#ifdef X86_SIMD
+    __builtin_cpu_init();
+    avx2 = __builtin_cpu_supports("avx2") ? TRUE : FALSE;
+    sse42 = __builtin_cpu_supports("sse4.2") ? TRUE : FALSE;
+#endif
+
+    if(kernel == HTTP_SCAN_BEST)
+        kernel = avx2 ? HTTP_SCAN_AVX2 : (sse42 ? HTTP_SCAN_SSE42 : HTTP_SCAN_SCALAR);
+
+    switch(kernel)
+    {
+        case HTTP_SCAN_SCALAR:
+            scan = scan_scalar;
+            scan_token = scan_token_scalar;
+            break;
+
+#ifdef X86_SIMD
+        case HTTP_SCAN_SSE42:
+            if(!sse42)
+                return FAILED;
+            scan = scan_sse42;
+            scan_token = scan_token_sse42;
+            break;
+
+        case HTTP_SCAN_AVX2:
+            if(!avx2)
+                return FAILED;
+            scan = scan_avx2;
+            scan_token = scan_token_avx2;
+            break;
+#endif
+
+        default:
+            return FAILED;
+    }
+    scan_kernel = kernel;
+    return SUCCESS;
+}
+
+
+/**
+ * http_parser_kernel returns the kernel http_parse scans with.
+ */
+int http_parser_kernel(void)
+{
+    return scan_kernel;
+}
+
+
+/**
+ * http_parser_init makes req ready for a new request.
+ */
+void http_parser_init(http_request_t* req)
+{
+    req->result = PARSE_PARTIAL;
+    req->state = S_START;
+    req->pos = 0;
+    req->method.off = req->method.len = 0;
+    req->path.off = req->path.len = 0;
+    req->version.off = req->version.len = 0;
+    req->major = req->minor = 0;
+    req->num_headers = 0;
+    req->head_len = 0;
+    req->connection = 0;
+    req->content_length = -1;
+    req->transfer_encoding = FALSE;
+}
+
+
+/**
+ * http_parse goes on parsing the request from where it stopped, buff
+ * holds len bytes from the beginning of the request (the same bytes
+ * as before and maybe more).
+ * returns PARSE_PARTIAL until the head of the request is complete,
+ * then PARSE_COMPLETE or the error, and the same result from then on.
+ */
+int http_parse(http_request_t* req, const char* buff, int len)
+{
+    if(req->result != PARSE_PARTIAL)
+        return req->result;
+
+    /* every state consumes as many bytes as it can before the next one is looked up, the long runs with the scan kernels */
+    const unsigned char* bytes = (const unsigned char*)buff;
+    int head_end = (len < HTTP_MAX_HEAD) ? len : HTTP_MAX_HEAD;
+    int pos = req->pos;
+    int end;
+    http_header_t* header = &req->headers[req->num_headers];
+    while(pos < head_end)
+    {
+        unsigned char c = bytes[pos];
+        switch(req->state)
+        {
+            /* empty lines before the request line are ignored (RFC 7230 3.5) */
+            case S_START:
+                if(c == '\r' || c == '\n')
+                {
+                    pos++;
+                    break;
+                }
+                if(!is_token(c))
+                    return finish(req, pos, PARSE_INVALID);
+                req->method.off = pos;
+                req->state = S_METHOD;
+                break;
+
+            case S_METHOD:
+                pos = scan_token(buff, pos, head_end);
+                if(pos == head_end)
+                    break;
+                if(bytes[pos] != ' ')
+                    return finish(req, pos, PARSE_INVALID);
+                req->method.len = pos - req->method.off;
+                req->state = S_PATH_START;
+                pos++;
+                break;
+
+            case S_PATH_START:
+                if(c <= ' ' || c == DEL)
+                    return finish(req, pos, PARSE_INVALID);
+                req->path.off = pos;
+                req->state = S_PATH;
+                break;
+
+            /* the path runs until the space before the version */
+            case S_PATH:
+                end = (req->path.off + HTTP_MAX_URI < head_end) ? req->path.off + HTTP_MAX_URI : head_end;
+                pos = scan(buff, pos, end, PATH_LIMIT);
+                if(pos == head_end)
+                    break;
+                if(bytes[pos] != ' ')
+                    return finish(req, pos, (pos - req->path.off >= HTTP_MAX_URI) ? PARSE_URI_TOO_LONG : PARSE_INVALID);
+                req->path.len = pos - req->path.off;
+                req->version.off = pos + 1;
+                req->state = S_VERSION;
+                pos++;
+                break;
+
+            /* almost always "HTTP/1.1" and the line end, else one byte at a time */
+            case S_VERSION:
+                if(pos == req->version.off && pos + 8 < head_end && (bytes[pos+8] == '\r' || bytes[pos+8] == '\n'))
+                    pos += 8;
+                while(pos < head_end && bytes[pos] != '\r' && bytes[pos] != '\n')
+                {
+                    if(pos - req->version.off >= (int)strlen("HTTP/1.1"))
+                        return finish(req, pos, PARSE_INVALID);
+                    pos++;
+                }
+                if(pos == head_end)
+                    break;
+                req->version.len = pos - req->version.off;
+                if(parse_version(req, buff) == FAILED)
+                    return finish(req, pos, PARSE_INVALID);
+                req->state = (bytes[pos] == '\r') ? S_LINE_LF : S_HEADER_START;
+                pos++;
+                break;
+
+            /* '\n' after a '\r' */
+            case S_LINE_LF:
+            case S_VALUE_LF:
+                if(c != '\n')
+                    return finish(req, pos, PARSE_INVALID);
+                req->state = S_HEADER_START;
+                pos++;
+                break;
+
+            /* a header line, or the empty line that ends the head (a bare '\n' is taken as a line end too) */
+            case S_HEADER_START:
+                if(c == '\r')
+                {
+                    req->state = S_END_LF;
+                    pos++;
+                    break;
+                }
+                if(c == '\n')
+                    return finish(req, pos + 1, PARSE_COMPLETE);
+                if(!is_token(c))
+                    return finish(req, pos, PARSE_INVALID);     //including obsolete line folding
+                if(req->num_headers == HTTP_MAX_HEADERS)
+                    return finish(req, pos, PARSE_TOO_LARGE);
+                header->name.off = pos;
+                req->state = S_HEADER_NAME;
+                break;
+
+            case S_HEADER_NAME:
+                pos = scan_token(buff, pos, head_end);
+                if(pos == head_end)
+                    break;
+                if(bytes[pos] != ':')
+                    return finish(req, pos, PARSE_INVALID);
+                header->name.len = pos - header->name.off;
+                req->state = S_VALUE_START;
+                pos++;
+                break;
+
+            /* white space before the value */
+            case S_VALUE_START:
+                while(pos < head_end && (bytes[pos] == ' ' || bytes[pos] == '\t'))
+                    pos++;
+                if(pos == head_end)
+                    break;
+                header->value.off = pos;
+                req->state = S_VALUE;
+                break;
+
+            /* the value runs until the end of the line, a tab inside it stops the scan but is part of it */
+            case S_VALUE:
+                pos = scan(buff, pos, head_end, VALUE_LIMIT);
+                if(pos == head_end)
+                    break;
+                c = bytes[pos];
+                if(c == '\t')
+                {
+                    pos++;
+                    break;
+                }
+                if(c != '\r' && c != '\n')
+                    return finish(req, pos, PARSE_INVALID);
+                if(header_done(req, buff, pos) == FAILED)
+                    return finish(req, pos, PARSE_INVALID);
+                header = &req->headers[req->num_headers];
+                req->state = (c == '\r') ? S_VALUE_LF : S_HEADER_START;
+                pos++;
+                break;
+
+            case S_END_LF:
+                if(c != '\n')
+                    return finish(req, pos, PARSE_INVALID);
+                return finish(req, pos + 1, PARSE_COMPLETE);
+        }
+    }
+
+    /* the head may not be bigger than HTTP_MAX_HEAD, the path not bigger than HTTP_MAX_URI */
+    if(len > HTTP_MAX_HEAD)
+        return finish(req, pos, (req->state == S_PATH) ? PARSE_URI_TOO_LONG : PARSE_TOO_LARGE);
+
+    req->pos = pos;
+    return PARSE_PARTIAL;
+}
+
+
+/**
+ * http_parse_end tells the parser no more bytes will come (the client
+ * closed its' side). a request that stopped between two header lines
+ * is taken as complete without the empty line, any other request that
+ * isn't complete is invalid.
+ * returns the result of the request.
+ */
+int http_parse_end(http_request_t* req)
+{
+    if(req->result != PARSE_PARTIAL)
+        return req->result;
+
+    if(req->state == S_HEADER_START)
+        return finish(req, req->pos, PARSE_COMPLETE);
+    return finish(req, req->pos, PARSE_INVALID);
+}
+
+
+/**
+ * http_find_header looks for the first header called name (case
+ * insensitive) and fills value with where its' value is.
+ * returns SUCCESS, or FAILED if the request has no such header.
+ */
+int http_find_header(const http_request_t* req, const char* buff, const char* name, http_span_t* value)
+{
+    int len = strlen(name);
+    int i;
+    for(i = 0; i < req->num_headers; i++)
+    {
+        const http_header_t* header = &req->headers[i];
+        if(header->name.len == len && strncasecmp(buff + header->name.off, name, len) == 0)
+        {
+            *value = header->value;
+            return SUCCESS;
+        }
+    }
+    return FAILED;
+}
+
+
+/**
+ * http_span_is compares a part of the buffer to str, case sensitive.
+ * returns TRUE if they are equal.
+ */
+int http_span_is(const char* buff, http_span_t span, const char* str)
+{
+    return ((int)strlen(str) == span.len && memcmp(buff + span.off, str, span.len) == 0) ? TRUE : FALSE;
+}
+
+
+/* the parser is done, it won't look at the buffer again */
+static int finish(http_request_t* req, int pos, int result)
+{
+    req->pos = pos;
+    req->state = S_DONE;
+    req->result = result;
+    if(result == PARSE_COMPLETE)
+        req->head_len = pos;
+    return result;
+}
+
+
+/* TRUE if c may be part of a method or a header name */
+static int is_token(unsigned char c)
+{
+    return token_chars[c];
+}
+
+
+/* one byte at a time, for short spans and for CPUs without SSE4.2 */
+static int scan_scalar(const char* buff, int pos, int end, unsigned char limit)
+{
+    while(pos < end)
+    {
+        unsigned char c = (unsigned char)buff[pos];
+        if(c < limit || c == DEL)
+            break;
+        pos++;
+    }
+    return pos;
+}
+
+
+/* one byte at a time, for CPUs without SSE4.2 */
+static int scan_token_scalar(const char* buff, int pos, int end)
+{
+    while(pos < end && is_token((unsigned char)buff[pos]))
+        pos++;
+    return pos;
+}
+
+
+#ifdef X86_SIMD
+/* 16 bytes at a time, PCMPESTRI finds the first byte in the ranges 0..limit-1 and DEL */
+__attribute__((target("sse4.2")))
+static int scan_sse42(const char* buff, int pos, int end, unsigned char limit)
+{
+    const __m128i ranges = _mm_setr_epi8(0x00, limit - 1, DEL, DEL, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    while(pos + 16 <= end)
+    {
+        __m128i data = _mm_loadu_si128((const __m128i*)(buff + pos));
+        int i = _mm_cmpestri(ranges, 4, data, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if(i != 16)
+            return pos + i;
+        pos += 16;
+    }
+    return scan_scalar(buff, pos, end, limit);
+}
+
+
+/* 32 bytes at a time, a byte stops the scan if it is below limit (unsigned max(byte, limit) isn't the byte) or DEL */
+__attribute__((target("avx2")))
+static int scan_avx2(const char* buff, int pos, int end, unsigned char limit)
+{
+    const __m256i low = _mm256_set1_epi8((char)limit);
+    const __m256i del = _mm256_set1_epi8(DEL);
+    while(pos + 32 <= end)
+    {
+        __m256i data = _mm256_loadu_si256((const __m256i*)(buff + pos));
+        unsigned int plain = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(data, low), data));
+        unsigned int dels = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(data, del));
+        unsigned int stop = ~plain | dels;
+        if(stop != 0)
+            return pos + __builtin_ctz(stop);
+        pos += 32;
+    }
+
+    /* the rest is shorter than 32 bytes (most header values are), 16 bytes with the same compare and then one by one */
+    if(pos + 16 <= end)
+    {
+        __m128i data = _mm_loadu_si128((const __m128i*)(buff + pos));
+        unsigned int plain = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(data, _mm256_castsi256_si128(low)), data));
+        unsigned int dels = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(data, _mm256_castsi256_si128(del)));
+        unsigned int stop = (~plain & 0xffff) | dels;
+        if(stop != 0)
+            return pos + __builtin_ctz(stop);
+        pos += 16;
+    }
+    return scan_scalar(buff, pos, end, limit);
+}
+#endif
+
+
+/* "HTTP/" digit "." digit */
+static int parse_version(http_request_t* req, const char* buff)
+{
+    const char* version = buff + req->version.off;
+    if(req->version.len != (int)strlen("HTTP/1.1") || strncmp(version, "HTTP/", 5) != 0)
+        return FAILED;
+    if(version[5] < '0' || version[5] > '9' || version[6] != '.' || version[7] < '0' || version[7] > '9')
+        return FAILED;
+
+    req->major = version[5] - '0';
+    req->minor = version[7] - '0';
+    return SUCCESS;
+}
+
+
+/* a header line ended at end, the white space after the value is cut and the headers the server cares about are read */
+static int header_done(http_request_t* req, const char* buff, int end)
+{
+    http_header_t* header = &req->headers[req->num_headers];
+    while(end > header->value.off && (buff[end-1] == ' ' || buff[end-1] == '\t'))
+        end--;
+    header->value.len = end - header->value.off;
+    req->num_headers++;
+
+    const char* name = buff + header->name.off;
+    const char* value = buff + header->value.off;
+    int name_len = header->name.len;
+    int value_len = header->value.len;
+
+    if(name_len == 10 && strncasecmp(name, "Connection", 10) == 0)
+    {
+        if(has_token(value, value_len, "close"))
+            req->connection |= HTTP_CONN_CLOSE;
+        if(has_token(value, value_len, "keep-alive"))
+            req->connection |= HTTP_CONN_KEEP_ALIVE;
+    }
+    else if(name_len == 14 && strncasecmp(name, "Content-Length", 14) == 0)
+    {
+        /* digits only, two different lengths make the request invalid (RFC 7230 3.3.3) */
+        long long length = 0;
+        int i;
+        if(value_len == 0 || value_len > 18)
+            return FAILED;
+        for(i = 0; i < value_len; i++)
+        {
+            if(value[i] < '0' || value[i] > '9')
+                return FAILED;
+            length = length * 10 + (value[i] - '0');
+        }
+        if(req->content_length >= 0 && req->content_length != length)
+            return FAILED;
+        req->content_length = length;
+    }
+    else if(name_len == 17 && strncasecmp(name, "Transfer-Encoding", 17) == 0)
+        req->transfer_encoding = TRUE;
+
+    return SUCCESS;
+}
+
+
+/* TRUE if the comma separated list value has token in it (case insensitive) */
+static int has_token(const char* value, int len, const char* token)
+{
+    int token_len = strlen(token);
+    int i = 0;
+    while(i < len)
+    {
+        while(i < len && (value[i] == ' ' || value[i] == '\t' || value[i] == ','))
+            i++;
+        int start = i;
+        while(i < len && value[i] != ',')
+            i++;
+        int end = i;
+        while(end > start && (value[end-1] == ' ' || value[end-1] == '\t'))
+            end--;
+        if(end - start == token_len && strncasecmp(value + start, token, token_len) == 0)
+            return TRUE;
+    }
+    return FALSE;
+}
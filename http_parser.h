@@ -0,0 +1,138 @@
+#ifndef _HTTP_PARSER_H_
+#define _HTTP_PARSER_H_
+
+
+/**
+ * http_parser.h
+ *
+ * This file declares the parser of HTTP requests. it is a resumable
+ * state machine: it is fed with the read buffer every time more bytes
+ * arrive and goes on from where it stopped, so a request that comes in
+ * many TCP segments is parsed once. nothing is copied, the method, path,
+ * version and headers are kept as offsets into the buffer, so the buffer
+ * may grow (realloc) between two calls. both front ends use it.
+ * the path and the header values, most of the bytes of a request, are
+ * skipped 16 or 32 bytes at a time with SSE4.2 or AVX2 when the CPU has
+ * them (chosen once by http_parser_setup), byte by byte otherwise.
+ */
+
+// limits of a request: bytes of the request line and headers, bytes of the path, number of headers
+#define HTTP_MAX_HEAD (16 * 1024)
+#define HTTP_MAX_URI (8 * 1024)
+#define HTTP_MAX_HEADERS 64
+
+// result of http_parse
+#define PARSE_COMPLETE 0        //the request line and the headers are all there
+#define PARSE_PARTIAL 1         //more bytes are needed
+#define PARSE_INVALID 2         //not a valid request
+#define PARSE_URI_TOO_LONG 3    //the path is longer than HTTP_MAX_URI
+#define PARSE_TOO_LARGE 4       //the head is longer than HTTP_MAX_HEAD, or has more than HTTP_MAX_HEADERS headers
+
+// kernels the path and the header values are scanned with, HTTP_SCAN_BEST picks the best one the CPU has
+#define HTTP_SCAN_BEST (-1)
+#define HTTP_SCAN_SCALAR 0
+#define HTTP_SCAN_SSE42 1
+#define HTTP_SCAN_AVX2 2
+
+// Connection header tokens that were seen
+#define HTTP_CONN_CLOSE 1
+#define HTTP_CONN_KEEP_ALIVE 2
+
+
+/**
+ * part of the buffer, off is from the beginning of the buffer
+ */
+typedef struct http_span_st{
+    int off;
+    int len;
+} http_span_t;
+
+
+/**
+ * one header line, the value is without the white space around it
+ */
+typedef struct http_header_st{
+    http_span_t name;
+    http_span_t value;
+} http_header_t;
+
+
+/**
+ * a request that is being parsed, or was parsed
+ */
+typedef struct http_request_st{
+    int result;             //PARSE_PARTIAL until the parser is done, then how it ended
+    int state;              //where the parser stopped
+    int pos;                //bytes of the buffer that were looked at
+    http_span_t method;
+    http_span_t path;
+    http_span_t version;
+    int major;              //HTTP/major.minor
+    int minor;
+    http_header_t headers[HTTP_MAX_HEADERS];
+    int num_headers;
+    int head_len;           //bytes of the request line, headers and the empty line, when complete
+    int connection;         //HTTP_CONN_CLOSE and HTTP_CONN_KEEP_ALIVE
+    long long content_length;   //-1 if there is no Content-Length header
+    int transfer_encoding;  //TRUE if there is a Transfer-Encoding header (the request has a body)
+} http_request_t;
+
+
+/**
+ * http_parser_setup chooses the kernel http_parse scans with, it is
+ * called once before the parser is used (the scalar kernel is used
+ * until then).
+ * returns SUCCESS, or FAILED if the CPU doesn't have that kernel (the
+ * kernel that was used stays).
+ */
+int http_parser_setup(int kernel);
+
+
+/**
+ * http_parser_kernel returns the kernel http_parse scans with.
+ */
+int http_parser_kernel(void);
+
+
+/**
+ * http_parser_init makes req ready for a new request.
+ */
+void http_parser_init(http_request_t* req);
+
+
+/**
+ * http_parse goes on parsing the request from where it stopped, buff
+ * holds len bytes from the beginning of the request (the same bytes
+ * as before and maybe more).
+ * returns PARSE_PARTIAL until the head of the request is complete,
+ * then PARSE_COMPLETE or the error, and the same result from then on.
+ */
+int http_parse(http_request_t* req, const char* buff, int len);
+
+
+/**
+ * http_parse_end tells the parser no more bytes will come (the client
+ * closed its' side). a request that stopped between two header lines
+ * is taken as complete without the empty line, any other request that
+ * isn't complete is invalid.
+ * returns the result of the request.
+ */
+int http_parse_end(http_request_t* req);
+
+
+/**
+ * http_find_header looks for the first header called name (case
+ * insensitive) and fills value with where its' value is.
+ * returns SUCCESS, or FAILED if the request has no such header.
+ */
+int http_find_header(const http_request_t* req, const char* buff, const char* name, http_span_t* value);
+
+
+/**
+ * http_span_is compares a part of the buffer to str, case sensitive.
+ * returns TRUE if they are equal.
+ */
+int http_span_is(const char* buff, http_span_t span, const char* str);
+
+
+#endif
@@ -0,0 +1,618 @@
+/* NAME: Ofir Cohen
+ * ID: 312255847
+ * DATE:
+ *
+ * cache of resolved request paths, shared by all the threads of the server.
+ * a sharded hash table that is invalidated by a thread that watches the
+ * document root with inotify.
+ */
+
+/* INCLUDES */
+#define _GNU_SOURCE
+#include "server.h"
+#include "meta_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+
+/* DEFINES */
+// changes that can change the verdict or the metadata of a path
+#define WATCH_MASK (IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MODIFY | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW)
+#define EVENTS_SIZE 8192
+
+
+/* GLOBALS */
+static meta_shard_t shards[META_SHARDS];
+static size_t shard_max = 0;
+
+// bumped by the watch thread after every batch of changes, read by everyone
+static unsigned long tree_generation = 1;
+static int watching = FALSE;
+
+static unsigned long hits = 0;
+static unsigned long negative_hits = 0;
+static unsigned long misses = 0;
+static unsigned long evictions = 0;
+
+// only the watch thread touches these after meta_init
+static int inotify_fd = -1;
+static int stop_fd = -1;
+static pthread_t watch_thread;
+static int thread_started = FALSE;
+static int root_wd = -1;                //watch descriptor of the document root
+static char* root_path = NULL;          //the document root, watched again when events were lost
+static char** watch_paths = NULL;       //path of every watch descriptor
+static int watch_paths_len = 0;
+static uint32_t moved_cookie = 0;       //a directory that was moved away, until its' new name arrives
+static char* moved_path = NULL;
+
+
+/* FUNCTIONS */
+static void* watch_tree_changes(void* arg);
+static int handle_event(struct inotify_event* event);
+static int watch_tree(const char* dir);
+static int add_watch(const char* dir);
+static void rename_watches(const char* from, const char* to);
+static void stop_watching(void);
+static char* join_path(const char* dir, const char* name);
+static unsigned int hash_key(const char* key);
+static void free_meta_entry(meta_entry_t* entry);
+
+
+/**
+ * meta_init starts watching the tree under root and enables the cache.
+ */
+int meta_init(const char* root, size_t max_entries)
+{
+    int i;
+    for(i = 0; i < META_SHARDS; i++)
+    {
+        bzero(&shards[i], sizeof(meta_shard_t));
+        pthread_rwlock_init(&shards[i].lock, NULL);
+    }
+    shard_max = max_entries / META_SHARDS;
+    if(shard_max == 0)
+        return FAILED;
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(inotify_fd < 0)
+        return FAILED;
+
+    root_path = strdup(root);
+    if(root_path == NULL)
+    {
+        stop_watching();
+        return FAILED;
+    }
+
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if(stop_fd < 0 || watch_tree(root) == FAILED)
+    {
+        stop_watching();
+        return FAILED;
+    }
+
+    /* watching the same directory again returns its' descriptor */
+    root_wd = inotify_add_watch(inotify_fd, root, WATCH_MASK);
+
+    __atomic_store_n(&watching, TRUE, __ATOMIC_RELEASE);
+    if(pthread_create(&watch_thread, NULL, watch_tree_changes, NULL) != 0)
+    {
+        stop_watching();
+        return FAILED;
+    }
+    thread_started = TRUE;
+    return SUCCESS;
+}
+
+
+/**
+ * meta_generation returns the current generation of the document root, 0 if it isn't watched.
+ */
+unsigned long meta_generation(void)
+{
+    if(!__atomic_load_n(&watching, __ATOMIC_ACQUIRE))
+        return 0;
+    return __atomic_load_n(&tree_generation, __ATOMIC_ACQUIRE);
+}
+
+
+/**
+ * meta_lookup fills result with the verdict of key if it was resolved in the current generation.
+ */
+int meta_lookup(const char* key, meta_result_t* result, arena_t* arena)
+{
+    unsigned long current = meta_generation();
+    if(current == 0)
+        return FAILED;
+
+    unsigned int hash = hash_key(key);
+    meta_shard_t* shard = &shards[hash % META_SHARDS];
+
+    pthread_rwlock_rdlock(&shard->lock);
+    meta_entry_t* entry = shard->buckets[(hash / META_SHARDS) % META_BUCKETS];
+    while(entry != NULL && strcmp(entry->key, key) != 0)
+        entry = entry->hnext;
+
+    if(entry == NULL || entry->generation != current)
+    {
+        pthread_rwlock_unlock(&shard->lock);
+        __atomic_add_fetch(&misses, 1, __ATOMIC_RELAXED);
+        return FAILED;
+    }
+
+    /* the clock gives it a second chance, the flag is written only when it isn't set so hot entries stay read only */
+    if(!__atomic_load_n(&entry->referenced, __ATOMIC_RELAXED))
+        __atomic_store_n(&entry->referenced, TRUE, __ATOMIC_RELAXED);
+
+    result->type = entry->type;
+    result->st = entry->st;
+    memcpy(result->etag, entry->etag, ETAG_SIZE);
+    result->path = NULL;
+    int no_memory = FALSE;
+    if(entry->path != NULL)
+    {
+        result->path = arena_strdup(arena, entry->path);
+        no_memory = (result->path == NULL);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+
+    if(no_memory)
+        return FAILED;
+
+    if(result->type == NOT_FOUND || result->type == FORBIDDEN)
+        __atomic_add_fetch(&negative_hits, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&hits, 1, __ATOMIC_RELAXED);
+    return SUCCESS;
+}
+
+
+/**
+ * meta_insert keeps the verdict of key if nothing changed since it was resolved.
+ */
+void meta_insert(const char* key, int type, const char* path, const struct stat* st, const char* etag, unsigned long generation)
+{
+    if(generation == 0)
+        return;
+
+    /* build the new values before taking the lock */
+    char* new_key = strdup(key);
+    char* new_path = (path != NULL) ? strdup(path) : NULL;
+    if(new_key == NULL || (path != NULL && new_path == NULL))
+    {
+        free(new_key);
+        free(new_path);
+        return;
+    }
+
+    unsigned int hash = hash_key(key);
+    meta_shard_t* shard = &shards[hash % META_SHARDS];
+    meta_entry_t** bucket = &shard->buckets[(hash / META_SHARDS) % META_BUCKETS];
+
+    pthread_rwlock_wrlock(&shard->lock);
+
+    /* the tree changed while the path was resolved, the verdict may already be wrong */
+    if(generation != meta_generation())
+    {
+        pthread_rwlock_unlock(&shard->lock);
+        free(new_key);
+        free(new_path);
+        return;
+    }
+
+    /* a path that was resolved in an older generation is updated in place */
+    meta_entry_t* entry = *bucket;
+    while(entry != NULL && strcmp(entry->key, key) != 0)
+        entry = entry->hnext;
+
+    if(entry != NULL)
+    {
+        free(new_key);
+        free(entry->path);
+    }
+    else
+    {
+        entry = (meta_entry_t*)malloc(sizeof(meta_entry_t));
+        if(entry == NULL)
+        {
+            pthread_rwlock_unlock(&shard->lock);
+            free(new_key);
+            free(new_path);
+            return;
+        }
+        bzero(entry, sizeof(meta_entry_t));
+        entry->key = new_key;
+
+        /* a full shard evicts the entry under the clock hand, the referenced ones it passes go to the end with the flag cleared */
+        while(shard->entries >= shard_max && shard->oldest != NULL && shard->oldest->referenced && shard->oldest != shard->newest)
+        {
+            meta_entry_t* second = shard->oldest;
+            second->referenced = FALSE;
+            shard->oldest = second->newer;
+            second->newer = NULL;
+            shard->newest->newer = second;
+            shard->newest = second;
+        }
+        if(shard->entries >= shard_max && shard->oldest != NULL)
+        {
+            meta_entry_t* oldest = shard->oldest;
+            unsigned int old_hash = hash_key(oldest->key);
+            meta_entry_t** link = &shard->buckets[(old_hash / META_SHARDS) % META_BUCKETS];
+            while(*link != oldest)
+                link = &(*link)->hnext;
+            *link = oldest->hnext;
+
+            shard->oldest = oldest->newer;
+            if(shard->oldest == NULL)
+                shard->newest = NULL;
+            shard->entries--;
+            free_meta_entry(oldest);
+            __atomic_add_fetch(&evictions, 1, __ATOMIC_RELAXED);
+        }
+
+        entry->hnext = *bucket;
+        *bucket = entry;
+        if(shard->newest)
+            shard->newest->newer = entry;
+        else
+            shard->oldest = entry;
+        shard->newest = entry;
+        shard->entries++;
+    }
+
+    entry->type = type;
+    entry->path = new_path;
+    entry->st = *st;
+    snprintf(entry->etag, ETAG_SIZE, "%s", etag);
+    entry->generation = generation;
+    pthread_rwlock_unlock(&shard->lock);
+}
+
+
+/**
+ * meta_get_stats fills the counters of the cache.
+ */
+void meta_get_stats(meta_stats_t* stats)
+{
+    bzero(stats, sizeof(meta_stats_t));
+    stats->hits = __atomic_load_n(&hits, __ATOMIC_RELAXED);
+    stats->negative_hits = __atomic_load_n(&negative_hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&misses, __ATOMIC_RELAXED);
+    stats->evictions = __atomic_load_n(&evictions, __ATOMIC_RELAXED);
+    stats->generation = meta_generation();
+
+    int i;
+    for(i = 0; i < META_SHARDS; i++)
+    {
+        pthread_rwlock_rdlock(&shards[i].lock);
+        stats->entries += shards[i].entries;
+        pthread_rwlock_unlock(&shards[i].lock);
+    }
+}
+
+
+/**
+ * meta_destroy stops watching the tree and frees the cache.
+ */
+void meta_destroy(void)
+{
+    if(thread_started)
+    {
+        /* wake the watch thread up (if it didn't stop by itself), it cleans up after itself */
+        uint64_t one = 1;
+        if(write(stop_fd, &one, sizeof(one)) == sizeof(one))
+            pthread_join(watch_thread, NULL);
+        thread_started = FALSE;
+    }
+    if(stop_fd >= 0)
+        close(stop_fd);
+    stop_fd = -1;
+
+    int i;
+    for(i = 0; i < META_SHARDS; i++)
+    {
+        meta_entry_t* entry = shards[i].oldest;
+        while(entry != NULL)
+        {
+            meta_entry_t* next = entry->newer;
+            free_meta_entry(entry);
+            entry = next;
+        }
+        pthread_rwlock_destroy(&shards[i].lock);
+        bzero(&shards[i], sizeof(meta_shard_t));
+    }
+}
+
+
+/* the watch thread, reads the changes under the document root until it is stopped or the tree can't be trusted anymore */
+static void* watch_tree_changes(void* arg)
+{
+    char events[EVENTS_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2];
+    fds[0].fd = inotify_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = stop_fd;
+    fds[1].events = POLLIN;
+
+    while(1)
+    {
+        if(poll(fds, 2, -1) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+
+        if(fds[1].revents & POLLIN)
+            break;
+
+        int changed = FALSE;
+        int trusted = TRUE;
+        int lost = FALSE;
+        ssize_t nbytes;
+        while(trusted && (nbytes = read(inotify_fd, events, sizeof(events))) > 0)
+        {
+            char* ptr = events;
+            while(ptr < events + nbytes)
+            {
+                struct inotify_event* event = (struct inotify_event*)ptr;
+                if(event->mask & IN_Q_OVERFLOW)
+                    lost = TRUE;
+                else if(handle_event(event) == FAILED)
+                {
+                    trusted = FALSE;
+                    break;
+                }
+                changed = TRUE;
+                ptr += sizeof(struct inotify_event) + event->len;
+            }
+        }
+
+        /* events were lost (a burst bigger than the queue), the watches of the whole tree are added again, the ones that are
+           there keep their descriptors and get their current path. the new generation drops everything resolved before */
+        if(trusted && lost)
+        {
+            free(moved_path);
+            moved_path = NULL;
+            if(watch_tree(root_path) == FAILED)
+                trusted = FALSE;
+        }
+
+        if(!trusted)
+        {
+            printf("document root is no longer watched, path cache is off\r\n");
+            break;
+        }
+
+        /* new directories are already watched, so everything resolved from now on sees their changes */
+        if(changed)
+            __atomic_add_fetch(&tree_generation, 1, __ATOMIC_RELEASE);
+    }
+
+    stop_watching();
+    return NULL;
+}
+
+
+/* updates the watches after one change, returns FAILED if the tree can't be trusted anymore */
+static int handle_event(struct inotify_event* event)
+{
+    if(event->wd < 0 || event->wd >= watch_paths_len || watch_paths[event->wd] == NULL)
+        return SUCCESS;
+
+    /* the directory is gone, so is its' watch */
+    if(event->mask & IN_IGNORED)
+    {
+        /* the document root itself */
+        if(event->wd == root_wd)
+            return FAILED;
+
+        free(watch_paths[event->wd]);
+        watch_paths[event->wd] = NULL;
+        return SUCCESS;
+    }
+
+    if(event->len == 0)
+        return SUCCESS;
+
+    char* path = join_path(watch_paths[event->wd], event->name);
+    if(path == NULL)
+        return FAILED;
+
+    int check = SUCCESS;
+    if(event->mask & IN_ISDIR)
+    {
+        /* a directory was renamed inside the tree, its' watches (and the ones below it) keep going under the new name */
+        if(event->mask & IN_MOVED_FROM)
+        {
+            free(moved_path);
+            moved_path = path;
+            moved_cookie = event->cookie;
+            return SUCCESS;
+        }
+
+        if((event->mask & IN_MOVED_TO) && moved_path != NULL && event->cookie == moved_cookie)
+            rename_watches(moved_path, path);
+
+        /* a new directory (or one that came from outside the tree) is watched with everything in it */
+        else if(event->mask & (IN_CREATE | IN_MOVED_TO))
+            check = watch_tree(path);
+    }
+
+    /* a symbolic link points to something that isn't watched */
+    else if(event->mask & (IN_CREATE | IN_MOVED_TO))
+    {
+        struct stat st;
+        if(lstat(path, &st) == 0 && S_ISLNK(st.st_mode))
+            check = FAILED;
+    }
+
+    free(path);
+    return check;
+}
+
+
+/* watches dir and every directory under it, returns FAILED if some part of it can't be watched */
+static int watch_tree(const char* dir)
+{
+    /* the watch is added before the directory is read, so nothing that is created while reading is missed */
+    if(add_watch(dir) == FAILED)
+        return FAILED;
+
+    DIR* dp = opendir(dir);
+    if(dp == NULL)
+        return (errno == ENOENT) ? SUCCESS : FAILED;
+
+    int check = SUCCESS;
+    struct dirent* dent;
+    while(check == SUCCESS && (dent = readdir(dp)) != NULL)
+    {
+        if(strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
+            continue;
+
+        unsigned char type = dent->d_type;
+        char* path = join_path(dir, dent->d_name);
+        if(path == NULL)
+        {
+            check = FAILED;
+            break;
+        }
+
+        if(type == DT_UNKNOWN)
+        {
+            struct stat st;
+            if(lstat(path, &st) == 0)
+                type = S_ISDIR(st.st_mode) ? DT_DIR : (S_ISLNK(st.st_mode) ? DT_LNK : DT_REG);
+        }
+
+        if(type == DT_DIR)
+            check = watch_tree(path);
+        else if(type == DT_LNK)
+            check = FAILED;
+        free(path);
+    }
+    closedir(dp);
+    return check;
+}
+
+
+/* adds a watch on one directory and remembers its' path */
+static int add_watch(const char* dir)
+{
+    int wd = inotify_add_watch(inotify_fd, dir, WATCH_MASK);
+    if(wd < 0)
+    {
+        /* the directory was removed before it could be watched, its' parent reports that */
+        if(errno == ENOENT || errno == ENOTDIR)
+            return SUCCESS;
+
+        /* out of watches (fs.inotify.max_user_watches) */
+        return FAILED;
+    }
+
+    if(wd >= watch_paths_len)
+    {
+        int len = (wd + 1) * 2;
+        char** paths = (char**)realloc(watch_paths, sizeof(char*)*len);
+        if(paths == NULL)
+            return FAILED;
+        bzero(paths + watch_paths_len, sizeof(char*)*(len - watch_paths_len));
+        watch_paths = paths;
+        watch_paths_len = len;
+    }
+
+    /* a watch on a directory that is already watched returns the same descriptor */
+    free(watch_paths[wd]);
+    watch_paths[wd] = strdup(dir);
+    return (watch_paths[wd] != NULL) ? SUCCESS : FAILED;
+}
+
+
+/* moves every watched path under from to the same place under to */
+static void rename_watches(const char* from, const char* to)
+{
+    size_t from_len = strlen(from);
+    int i;
+    for(i = 0; i < watch_paths_len; i++)
+    {
+        char* old = watch_paths[i];
+        if(old == NULL || strncmp(old, from, from_len) != 0 || (old[from_len] != '\0' && old[from_len] != '/'))
+            continue;
+
+        char* path = (char*)malloc(sizeof(char)*(strlen(to) + strlen(old + from_len) + 1));
+        if(path == NULL)
+            continue;
+        sprintf(path, "%s%s", to, old + from_len);
+        free(old);
+        watch_paths[i] = path;
+    }
+
+    free(moved_path);
+    moved_path = NULL;
+}
+
+
+/* nothing can be trusted anymore, every lookup misses from now on */
+static void stop_watching(void)
+{
+    __atomic_store_n(&watching, FALSE, __ATOMIC_RELEASE);
+
+    if(inotify_fd >= 0)
+        close(inotify_fd);
+    inotify_fd = -1;
+
+    int i;
+    for(i = 0; i < watch_paths_len; i++)
+        free(watch_paths[i]);
+    free(watch_paths);
+    watch_paths = NULL;
+    watch_paths_len = 0;
+
+    free(moved_path);
+    moved_path = NULL;
+
+    free(root_path);
+    root_path = NULL;
+}
+
+
+/* returns a new string "dir/name" */
+static char* join_path(const char* dir, const char* name)
+{
+    char* path = (char*)malloc(sizeof(char)*(strlen(dir) + strlen(name) + 2));
+    if(path == NULL)
+        return NULL;
+    sprintf(path, "%s/%s", dir, name);
+    return path;
+}
+
+
+/* FNV-1a hash of the key */
+static unsigned int hash_key(const char* key)
+{
+    unsigned int hash = 2166136261u;
+    while(*key)
+    {
+        hash ^= (unsigned char)*key++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+/* free all the memory of an entry */
+static void free_meta_entry(meta_entry_t* entry)
+{
+    free(entry->key);
+    free(entry->path);
+    free(entry);
+}
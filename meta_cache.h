@@ -0,0 +1,128 @@
+#ifndef _META_CACHE_H_
+#define _META_CACHE_H_
+
+#include "server.h"
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+/**
+ * meta_cache.h
+ *
+ * This file declares the cache of resolved request paths. it maps the
+ * path the client asked for to the verdict of check_input (file, directory,
+ * redirect, forbidden or not found) together with the resolved path and its'
+ * stat, so a request for a known path doesn't make any stat call.
+ * the document root is watched with inotify, every change under it moves
+ * the cache to a new generation and entries of older generations are
+ * ignored. when events were lost the whole tree is watched again and
+ * the generation moves on. if the tree can't be watched reliably (no
+ * inotify, out of watches, symbolic links) the cache turns itself off.
+ * a full shard evicts with a clock: an entry that was looked up since
+ * the hand passed it gets a second chance.
+ */
+
+// number of shards, each one with its' own lock, and hash buckets per shard
+#define META_SHARDS 16
+#define META_BUCKETS 1024
+
+
+/**
+ * one resolved path, negative entries (not found, forbidden) have no path
+ */
+typedef struct meta_entry_st{
+    char* key;                  //path as the client asked for it
+    int type;                   //FILE_CONTENT, DIR_CONTENT, FOUND, FORBIDDEN or NOT_FOUND
+    char* path;                 //resolved path (index.html of a directory, location of a redirect), can be NULL
+    struct stat st;             //metadata of the resolved path
+    char etag[ETAG_SIZE];       //ETag built from st
+    unsigned long generation;   //generation of the tree the entry was resolved in
+    int referenced;             //set by a lookup (atomically, under the read lock), cleared when the clock hand passes it
+    struct meta_entry_st* hnext;        //next in the hash bucket
+    struct meta_entry_st* newer;        //next in the clock order of the shard
+} meta_entry_t;
+
+
+/**
+ * part of the cache that is guarded by one lock
+ */
+typedef struct meta_shard_st{
+    meta_entry_t* buckets[META_BUCKETS];
+    meta_entry_t* oldest;       //hand of the clock, the next entry that is evicted unless it was referenced
+    meta_entry_t* newest;       //where new entries and second chances go
+    size_t entries;
+    pthread_rwlock_t lock;
+} meta_shard_t;
+
+
+/**
+ * what a lookup returns, path belongs to the caller
+ */
+typedef struct meta_result_st{
+    int type;
+    char* path;         //copy of the resolved path in the arena of the request, can be NULL
+    struct stat st;
+    char etag[ETAG_SIZE];
+} meta_result_t;
+
+
+/**
+ * counters of the cache
+ */
+typedef struct meta_stats_st{
+    unsigned long hits;
+    unsigned long negative_hits;    //hits on not found and forbidden entries
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long entries;
+    unsigned long generation;       //number of changes seen under the document root, 0 if not watching
+} meta_stats_t;
+
+
+/**
+ * meta_init starts watching the tree under root and enables the cache
+ * with room for max_entries paths.
+ * returns SUCCESS, or FAILED if the tree can't be watched (the cache
+ * stays off and every lookup misses).
+ */
+int meta_init(const char* root, size_t max_entries);
+
+
+/**
+ * meta_generation returns the current generation of the document root,
+ * it changes after every change under it. 0 means the tree isn't watched
+ * and nothing may be trusted without looking at the file system.
+ */
+unsigned long meta_generation(void);
+
+
+/**
+ * meta_lookup fills result with the verdict of key if it was resolved
+ * in the current generation, the copy of the path is taken from arena.
+ * returns SUCCESS on a hit, FAILED on a miss.
+ */
+int meta_lookup(const char* key, meta_result_t* result, arena_t* arena);
+
+
+/**
+ * meta_insert keeps the verdict of key with the metadata and ETag of
+ * its' path. generation is the value of meta_generation() from before
+ * the path was resolved, an entry that is already out of date isn't kept.
+ */
+void meta_insert(const char* key, int type, const char* path, const struct stat* st, const char* etag, unsigned long generation);
+
+
+/**
+ * meta_get_stats fills the counters of the cache.
+ */
+void meta_get_stats(meta_stats_t* stats);
+
+
+/**
+ * meta_destroy stops watching the tree and frees the cache.
+ */
+void meta_destroy(void);
+
+
+#endif
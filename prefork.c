@@ -0,0 +1,168 @@
+/* NAME: Ofir Cohen
+ * ID: 312255847
+ * DATE:
+ *
+ * prefork mode of the HTTP Server.
+ * the supervisor forks the worker processes and waits for them. every
+ * worker binds its' own SO_REUSEPORT socket on the port and runs a whole
+ * server (threadpool, caches, front end), so the kernel spreads the
+ * connections between the cores and a crash takes down only the
+ * connections of one worker. a worker that crashed is started again.
+ */
+
+/* INCLUDES */
+#include "server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+
+/* GLOBALS */
+// the signal that asked the supervisor to stop, 0 while it runs
+static volatile sig_atomic_t stop_signal = 0;
+
+
+/* FUNCTIONS */
+static void on_stop(int sig);
+static pid_t start_worker(int port, int num_of_threads, int max_requests);
+static void stop_workers(pid_t* pids, int workers);
+
+
+/* the supervisor, returns when every worker was done (or after SIGINT/SIGTERM) */
+int run_prefork(int workers, int port, int num_of_threads, int max_requests)
+{
+    pid_t* pids = (pid_t*)calloc(workers, sizeof(pid_t));
+    time_t* started = (time_t*)calloc(workers, sizeof(time_t));
+    if(pids == NULL || started == NULL)
+    {
+        printf("error on allocating memory\r\n");
+        free(pids);
+        free(started);
+        return FAILED;
+    }
+
+    /* no SA_RESTART, a stop request interrupts waitpid */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    int result = SUCCESS;
+    int running = 0;
+    int i;
+    for(i = 0; i < workers; i++)
+    {
+        pids[i] = start_worker(port, num_of_threads, max_requests);
+        if(pids[i] < 0)
+        {
+            result = FAILED;
+            stop_workers(pids, i);
+            break;
+        }
+        started[i] = time(NULL);
+        running++;
+    }
+
+    int stopping = (result == FAILED);
+    while(running > 0)
+    {
+        /* pass a stop request on to the workers once */
+        if(stop_signal != 0 && !stopping)
+        {
+            stopping = TRUE;
+            stop_workers(pids, workers);
+        }
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if(pid < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            perror("waitpid");
+            result = FAILED;
+            break;
+        }
+
+        for(i = 0; i < workers && pids[i] != pid; i++)
+            ;
+        if(i == workers)
+            continue;
+
+        /* a worker that was killed by a signal crashed, the others are started again (slowly if it died right away) */
+        if(WIFSIGNALED(status) && !stopping)
+        {
+            fprintf(stderr, "worker %d was killed by signal %d, starting it again\n", (int)pid, WTERMSIG(status));
+            if(time(NULL) - started[i] < RESTART_DELAY)
+                sleep(RESTART_DELAY);
+
+            if(stop_signal == 0)
+            {
+                pids[i] = start_worker(port, num_of_threads, max_requests);
+                started[i] = time(NULL);
+                if(pids[i] > 0)
+                    continue;
+            }
+        }
+        else if(!stopping && (!WIFEXITED(status) || WEXITSTATUS(status) != SUCCESS))
+            result = FAILED;
+
+        pids[i] = 0;
+        running--;
+    }
+
+    free(pids);
+    free(started);
+    return result;
+}
+
+
+/* remembers that the supervisor was asked to stop */
+static void on_stop(int sig)
+{
+    stop_signal = sig;
+}
+
+
+/* forks a worker that runs a whole server, returns its' pid or -1 */
+static pid_t start_worker(int port, int num_of_threads, int max_requests)
+{
+    // anything that waits in the buffer of stdout would be printed twice
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if(pid < 0)
+    {
+        perror("fork");
+        return -1;
+    }
+
+    if(pid == 0)
+    {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        exit(run_server(port, num_of_threads, max_requests));
+    }
+
+    return pid;
+}
+
+
+/* asks every running worker to stop */
+static void stop_workers(pid_t* pids, int workers)
+{
+    int i;
+    for(i = 0; i < workers; i++)
+    {
+        if(pids[i] > 0)
+            kill(pids[i], SIGTERM);
+    }
+}
@@ -0,0 +1,279 @@
+/* NAME: Ofir Cohen
+ * ID: 312255847
+ * DATE:
+ *
+ * builder of responses: the pieces of a response are appended in order,
+ * by reference when they are someone else's, and sent with one gather write.
+ */
+
+/* INCLUDES */
+#include "server.h"
+#include "response.h"
+#include "bufpool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+
+/* FUNCTIONS */
+static int text_reserve(text_t* text, size_t extra);
+static int text_vprintf(text_t* text, const char* format, va_list args);
+static int add_piece(response_t* response, const char* data, off_t off, size_t len, int file_fd);
+
+
+/* makes room for extra more bytes and the nul, the text doubles so appending is linear. it moves to a buffer of the pool of the thread and uses all of it */
+static int text_reserve(text_t* text, size_t extra)
+{
+    if(text->failed)
+        return FAILED;
+    if(text->len + extra + 1 <= text->size)
+        return SUCCESS;
+
+    size_t size = (text->size > 0) ? text->size * 2 : RESPONSE_TEXT;
+    while(size < text->len + extra + 1)
+        size *= 2;
+
+    char* buff;
+    if(text->heap)
+        buff = (char*)bufpool_grow(text->buff, text->len + 1, size);
+    else
+    {
+        buff = (char*)bufpool_get(size);
+        if(buff != NULL && text->len > 0)
+            memcpy(buff, text->buff, text->len + 1);
+    }
+    if(buff == NULL)
+    {
+        text->failed = TRUE;
+        return FAILED;
+    }
+    text->buff = buff;
+    text->size = bufpool_capacity(buff);
+    text->heap = TRUE;
+    return SUCCESS;
+}
+
+
+/* formats at the end of text, again after it grew if it didn't fit */
+static int text_vprintf(text_t* text, const char* format, va_list args)
+{
+    if(text->failed)
+        return FAILED;
+
+    va_list again;
+    va_copy(again, args);
+    size_t room = text->size - text->len;
+    int len = vsnprintf((text->buff != NULL) ? text->buff + text->len : NULL, room, format, args);
+    if(len >= 0 && (size_t)len >= room)
+    {
+        if(text_reserve(text, len) == SUCCESS)
+            vsnprintf(text->buff + text->len, text->size - text->len, format, again);
+    }
+    va_end(again);
+
+    if(len < 0)
+        text->failed = TRUE;
+    if(text->failed)
+        return FAILED;
+    text->len += len;
+    return SUCCESS;
+}
+
+
+/* adds a piece, a piece of text that continues the last one makes it longer instead */
+static int add_piece(response_t* response, const char* data, off_t off, size_t len, int file_fd)
+{
+    if(response->failed)
+        return FAILED;
+    if(len == 0)
+        return SUCCESS;
+
+    if(data == NULL && file_fd < 0 && response->count > 0)
+    {
+        piece_t* last = &response->pieces[response->count - 1];
+        if(last->data == NULL && last->file_fd < 0 && last->off + (off_t)last->len == off)
+        {
+            last->len += len;
+            response->length += len;
+            return SUCCESS;
+        }
+    }
+
+    if(response->count == response->size)
+    {
+        int size = response->size * 2;
+        piece_t* pieces;
+        if(response->pieces == response->inline_pieces)
+        {
+            pieces = (piece_t*)malloc(sizeof(piece_t) * size);
+            if(pieces != NULL)
+                memcpy(pieces, response->pieces, sizeof(piece_t) * response->count);
+        }
+        else
+            pieces = (piece_t*)realloc(response->pieces, sizeof(piece_t) * size);
+        if(pieces == NULL)
+        {
+            response->failed = TRUE;
+            return FAILED;
+        }
+        response->pieces = pieces;
+        response->size = size;
+    }
+
+    piece_t* piece = &response->pieces[response->count++];
+    piece->data = data;
+    piece->off = off;
+    piece->len = len;
+    piece->file_fd = file_fd;
+    response->length += len;
+    return SUCCESS;
+}
+
+
+void text_init(text_t* text, char* storage, size_t size)
+{
+    text->buff = storage;
+    text->len = 0;
+    text->size = size;
+    text->heap = FALSE;
+    text->failed = FALSE;
+    if(storage != NULL && size > 0)
+        storage[0] = '\0';
+}
+
+
+int text_append(text_t* text, const char* data, size_t len)
+{
+    if(text_reserve(text, len) == FAILED)
+        return FAILED;
+    memcpy(text->buff + text->len, data, len);
+    text->len += len;
+    text->buff[text->len] = '\0';
+    return SUCCESS;
+}
+
+
+int text_printf(text_t* text, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int check = text_vprintf(text, format, args);
+    va_end(args);
+    return check;
+}
+
+
+void text_free(text_t* text)
+{
+    if(text->heap)
+        bufpool_put(text->buff);
+    text->buff = NULL;
+    text->len = 0;
+    text->size = 0;
+    text->heap = FALSE;
+}
+
+
+void response_init(response_t* response)
+{
+    response->pieces = response->inline_pieces;
+    response->count = 0;
+    response->size = RESPONSE_PIECES;
+    response->length = 0;
+    response->failed = FALSE;
+    text_init(&response->text, response->inline_text, sizeof(response->inline_text));
+}
+
+
+int response_add(response_t* response, const char* data, size_t len)
+{
+    return add_piece(response, data, 0, len, -1);
+}
+
+
+int response_printf(response_t* response, const char* format, ...)
+{
+    if(response->failed)
+        return FAILED;
+
+    /* the piece is kept as an offset, the text may move when it grows */
+    size_t off = response->text.len;
+    va_list args;
+    va_start(args, format);
+    int check = text_vprintf(&response->text, format, args);
+    va_end(args);
+    if(check == FAILED)
+    {
+        response->failed = TRUE;
+        return FAILED;
+    }
+    return add_piece(response, NULL, off, response->text.len - off, -1);
+}
+
+
+int response_add_file(response_t* response, int file_fd, off_t offset, size_t len)
+{
+    return add_piece(response, NULL, offset, len, file_fd);
+}
+
+
+int response_send(response_t* response, int fd)
+{
+    if(response->failed)
+        return FAILED;
+
+    int has_file = FALSE;
+    int i;
+    for(i = 0; i < response->count; i++)
+    {
+        if(response->pieces[i].file_fd >= 0)
+            has_file = TRUE;
+    }
+
+    /* cork the socket so the header and the first bytes of the file leave in the same packet */
+    if(has_file)
+        set_cork(fd, TRUE);
+
+    int check = SUCCESS;
+    struct iovec iov[RESPONSE_IOV];
+    i = 0;
+    while(i < response->count && check == SUCCESS)
+    {
+        piece_t* piece = &response->pieces[i];
+        if(piece->file_fd >= 0)
+        {
+            /* the body goes from the page cache to the socket without passing through user space */
+            check = send_file_body(fd, piece->file_fd, piece->off, piece->len);
+            i++;
+            continue;
+        }
+
+        /* the pieces in memory up to the next file region, MSG_MORE tells the kernel more follows */
+        int iovcnt = 0;
+        while(i < response->count && iovcnt < RESPONSE_IOV && response->pieces[i].file_fd < 0)
+        {
+            piece = &response->pieces[i++];
+            iov[iovcnt].iov_base = (piece->data != NULL) ? (void*)piece->data : (void*)(response->text.buff + piece->off);
+            iov[iovcnt++].iov_len = piece->len;
+        }
+        check = send_iov(fd, iov, iovcnt, (i < response->count) ? MSG_MORE : 0);
+    }
+
+    if(has_file)
+        set_cork(fd, FALSE);
+    return check;
+}
+
+
+void response_free(response_t* response)
+{
+    if(response->pieces != response->inline_pieces)
+        free(response->pieces);
+    response->pieces = response->inline_pieces;
+    response->count = 0;
+    response->size = RESPONSE_PIECES;
+    text_free(&response->text);
+}
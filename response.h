@@ -0,0 +1,147 @@
+#ifndef _RESPONSE_H_
+#define _RESPONSE_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+
+/**
+ * response.h
+ *
+ * This file declares the builder of responses. a handler appends the
+ * pieces of its' response in order (status line, header lines, body)
+ * and they are sent together with one gather write when it is done.
+ * static strings, cached header lines and cached bodies are added by
+ * reference and never copied, only the few lines that are made for the
+ * request (status, date, Content-Range...) are formatted into the text
+ * of the response, and a region of an open file is sent from the page
+ * cache (sendfile) right after the pieces before it.
+ * the text is a growable string that a body can also be rendered into
+ * (a directory listing), every append goes where the last one ended so
+ * rendering is linear in the size of the body and nothing is measured
+ * in advance.
+ */
+
+// pieces and bytes of text a response holds before it allocates
+#define RESPONSE_PIECES 16
+#define RESPONSE_TEXT 512
+
+// most buffers that are given to one sendmsg call
+#define RESPONSE_IOV 64
+
+
+/**
+ * growable string, the bytes are kept nul terminated
+ */
+typedef struct text_st{
+    char* buff;
+    size_t len;             //bytes in buff, without the nul
+    size_t size;            //bytes buff can hold
+    int heap;               //TRUE if buff was taken from the buffer pool here, FALSE while it is the caller's storage
+    int failed;             //TRUE if an append ran out of memory, everything after it was dropped
+} text_t;
+
+
+/**
+ * one piece of a response: bytes that belong to someone else (data),
+ * bytes of the text of the response (off), or a region of an open file
+ */
+typedef struct piece_st{
+    const char* data;       //NULL if the bytes are in the text or in the file
+    off_t off;              //offset in the text, or in the file
+    size_t len;
+    int file_fd;            //-1 unless the bytes are sent from the file
+} piece_t;
+
+
+/**
+ * a response that is being built, the pieces and the text start in the
+ * struct itself and move to the heap only for a big response
+ */
+typedef struct response_st{
+    piece_t* pieces;
+    int count;
+    int size;               //pieces the array can hold
+    size_t length;          //bytes of all the pieces
+    text_t text;            //bytes that were formatted for this response
+    int failed;             //TRUE if a piece couldn't be added, the response isn't sent
+    piece_t inline_pieces[RESPONSE_PIECES];
+    char inline_text[RESPONSE_TEXT];
+} response_t;
+
+
+/**
+ * text_init makes text empty, it starts in storage (size bytes, may be
+ * NULL and 0) and moves to a buffer of the pool (bufpool.h) when it
+ * needs more.
+ */
+void text_init(text_t* text, char* storage, size_t size);
+
+
+/**
+ * text_append adds len bytes of data at the end of text.
+ * returns SUCCESS, or FAILED if there is no memory (text->failed).
+ */
+int text_append(text_t* text, const char* data, size_t len);
+
+
+/**
+ * text_printf formats at the end of text.
+ * returns SUCCESS, or FAILED if there is no memory (text->failed).
+ */
+int text_printf(text_t* text, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+
+/**
+ * text_free frees what text allocated.
+ */
+void text_free(text_t* text);
+
+
+/**
+ * response_init makes response empty.
+ */
+void response_init(response_t* response);
+
+
+/**
+ * response_add adds len bytes of data by reference, data must stay
+ * valid until the response is sent.
+ * returns SUCCESS, or FAILED if there is no memory.
+ */
+int response_add(response_t* response, const char* data, size_t len);
+
+
+/**
+ * response_printf formats a piece into the text of the response.
+ * returns SUCCESS, or FAILED if there is no memory.
+ */
+int response_printf(response_t* response, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+
+/**
+ * response_add_file adds len bytes of the open file file_fd from
+ * offset, the file must stay open until the response is sent.
+ * returns SUCCESS, or FAILED if there is no memory.
+ */
+int response_add_file(response_t* response, int file_fd, off_t offset, size_t len);
+
+
+/**
+ * response_send sends the pieces in order, the pieces in memory
+ * between two file regions with one sendmsg (RESPONSE_IOV at a time)
+ * and the file regions with send_file_body. the socket is corked while
+ * a response with a file region is sent so its' header and the first
+ * bytes of the file leave in the same packet.
+ * returns SUCCESS, or FAILED if a piece couldn't be added or sent.
+ */
+int response_send(response_t* response, int fd);
+
+
+/**
+ * response_free frees what response allocated.
+ */
+void response_free(response_t* response);
+
+
+#endif
@@ -1,7 +1,7 @@
 #!/bin/bash
 mkdir a
 chmod 111 a
-gcc -Wall *.c -o t -lpthread
+gcc -Wall *.c -o t -lpthread -lz
 
 echo "---Validation test---"
 
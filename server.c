@@ -7,7 +7,11 @@
  */
 
 /* INCLUDES */
-#include "threadpool.h"
+#define _GNU_SOURCE
+#include "server.h"
+#include "meta_cache.h"
+#include "response.h"
+#include "bufpool.h"
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -24,81 +28,276 @@
 #include <errno.h>
 #include <dirent.h>
 #include <signal.h>
+#include <getopt.h>
+#include <poll.h>
+#include <zlib.h>
+#include <sys/sendfile.h>
+#include <netinet/tcp.h>
+#include <sys/uio.h>
+#include <ctype.h>
+#include <limits.h>
 
 
 /* DEFINES */
-#define SUCCESS 0
-#define FAILED 1
-#define BUFFER_SIZE 4000
-#define QUEUE_SIZE 5
-#define TIME_NOW 2
-#define TIME_MOD 3
-#define MIN_PORT 0
-#define MAX_PORT 65535
-
-#define RFC1123FMT "%a, %d %b %Y %H:%M:%S GMT"
-#define USAGE_ERR "Usage: server <port> <pool-size> <max-number-of-request>\n"
-
-#define FOUND 302
-#define BAD_REQUEST 400
-#define FORBIDDEN 403
-#define NOT_FOUND 404
-#define INTERNAL_ERROR 500
-#define NOT_SUPPORTED 501
-#define OK 200
-#define DIR_CONTENT 100
-#define FILE_CONTENT 101
-
-
-/* STRUCTS */
-typedef struct request_st{
-    char* path;
-    char* mime;
-    char* read_buff;
-    char* write_buff;
-    char* time_now;
-    char* time_mod;
-} request_t;
-
-
-/* FUNCTIONS */
-int create_server(int port);
-int create_response(void* arg);
-int check_input(char* input, request_t* request, int fd);
-int error_response(request_t* request, int err_type, int fd);
-int dir_content(request_t* request, int fd);
-int file_content(request_t* request, int fd);
-char* get_mime_type(char* name);
-int server_error(int fd, request_t* request);
-int check_permissions(char *path, request_t* request, int fd);
-int get_timebuff(request_t* request, int flag, int fd);
-int response_size(request_t* request, int flag, int fd);
-int count_digits(int num);
-int is_number(char* num);
-void free_struct(request_t* request);
+// bodies of the error responses
+#define FOUND_BODY "<HTML><HEAD><TITLE>302 Found</TITLE></HEAD>\r\n<BODY><H4>302 Found</H4>\r\nDirectories must end with a slash.\r\n</BODY></HTML>"
+#define BAD_REQUEST_BODY "<HTML><HEAD><TITLE>400 Bad Request</TITLE></HEAD>\r\n<BODY><H4>400 Bad Request</H4>\r\nBad Request.\r\n</BODY></HTML>"
+#define FORBIDDEN_BODY "<HTML><HEAD><TITLE>403 Forbidden</TITLE></HEAD>\r\n<BODY><H4>403 Forbidden</H4>\r\nAccess denied.\r\n</BODY></HTML>"
+#define NOT_FOUND_BODY "<HTML><HEAD><TITLE>404 Not Found</TITLE></HEAD>\r\n<BODY><H4>404 Not Found</H4>\r\nFile not found.\r\n</BODY></HTML>"
+#define URI_TOO_LONG_BODY "<HTML><HEAD><TITLE>414 URI Too Long</TITLE></HEAD>\r\n<BODY><H4>414 URI Too Long</H4>\r\nThe path is too long.\r\n</BODY></HTML>"
+#define RANGE_NOT_SATISFIABLE_BODY "<HTML><HEAD><TITLE>416 Range Not Satisfiable</TITLE></HEAD>\r\n<BODY><H4>416 Range Not Satisfiable</H4>\r\nThe range is not in the file.\r\n</BODY></HTML>"
+#define HEADERS_TOO_LARGE_BODY "<HTML><HEAD><TITLE>431 Request Header Fields Too Large</TITLE></HEAD>\r\n<BODY><H4>431 Request Header Fields Too Large</H4>\r\nThe headers are too large.\r\n</BODY></HTML>"
+#define NOT_SUPPORTED_BODY "<HTML><HEAD><TITLE>501 Not supported</TITLE></HEAD>\r\n<BODY><H4>501 Not supported</H4>\r\nMethod is not supported.\r\n</BODY></HTML>"
+#define SERVICE_UNAVAILABLE_BODY "<HTML><HEAD><TITLE>503 Service Unavailable</TITLE></HEAD>\r\n<BODY><H4>503 Service Unavailable</H4>\r\nThe server is overloaded, try again later.\r\n</BODY></HTML>"
+#define INTERNAL_ERROR_BODY "<HTML><HEAD><TITLE>500 Internal Server Error</TITLE></HEAD>\r\n<BODY><H4>500 Internal Server Error</H4>\r\nSome server side error.\r\n</BODY></HTML>"
+
+
+/* GLOBALS */
+// pre-rendered responses of the error statuses
+static status_response_t status_responses[NUM_STATUSES];
+
+// current date shared by all threads, date_seq is odd while it is being updated
+static char date_string[DATE_SIZE];
+static time_t date_second = 0;
+static unsigned int date_seq = 0;
+
+server_config_t server_config = { MODE_BLOCKING, KEEPALIVE_TIMEOUT, KEEPALIVE_MAX, "", CACHE_SIZE, DIR_CACHE_SIZE, FD_CACHE_FILES, CACHE_REVALIDATE, QUEUE_LIST, 0, 0, 0, SHED_INTERVAL, 0, 0, 0, 0, FALSE, GZIP_LEVEL, GZIP_MIN };
+
+// responses this thread gathers for a connection with pipelined requests, NULL when every response is sent right away
+static __thread out_batch_t* out_batch = NULL;
+
+// hot small files, NULL when caching is disabled
+cache_t* file_cache = NULL;
+cache_t* dir_cache = NULL;
+
+// open descriptors of the hot files that are too big for the file cache, NULL when it is disabled
+fd_cache_t* fd_cache = NULL;
 
 
 /* MAIN FUNCTION */
 int main(int argc, char* argv[])
 {
+    /* read options, the front end mode is blocking unless asked otherwise */
+    int opt;
+    while((opt = getopt(argc, argv, "m:t:r:c:d:o:v:z:Z:q:e:l:s:i:w:b:A:F:N")) != -1)
+    {
+        switch(opt)
+        {
+            case 'm':
+                if(strcmp(optarg, "blocking") == 0)
+                    server_config.mode = MODE_BLOCKING;
+                else if(strcmp(optarg, "epoll") == 0)
+                    server_config.mode = MODE_EPOLL;
+                else if(strcmp(optarg, "uring") == 0)
+                    server_config.mode = MODE_URING;
+                else
+                {
+                    printf(USAGE_ERR);
+                    exit(FAILED);
+                }
+                break;
+
+            /* job queue of the threadpool */
+            case 'q':
+                if(strcmp(optarg, "list") == 0)
+                    server_config.queue = QUEUE_LIST;
+                else if(strcmp(optarg, "ring") == 0)
+                    server_config.queue = QUEUE_RING;
+                else if(strcmp(optarg, "steal") == 0)
+                    server_config.queue = QUEUE_STEAL;
+                else
+                {
+                    printf(USAGE_ERR);
+                    exit(FAILED);
+                }
+                break;
+
+            /* the pool grows up to this many threads with load, pool-size is its' minimum */
+            case 'e':
+                if(is_number(optarg) == FAILED || atoi(optarg) <= 0)
+                {
+                    printf(USAGE_ERR);
+                    exit(FAILED);
+                }
+                server_config.max_threads = atoi(optarg);
+                break;
+
+            /* admission control, new connections get a 503 while too many wait or they wait for too long */
+            case 'l':
+            case 's':
+            case 'i':
+                if(is_number(optarg) == FAILED || (opt == 'i' && atoi(optarg) <= 0))
+                {
+                    printf(USAGE_ERR);
+                    exit(FAILED);
+                }
+                if(opt == 'l')
+                    server_config.max_queue = atoi(optarg);
+                else if(opt == 's')
+                    server_config.shed_target = atoi(optarg);
+                else
+                    server_config.shed_interval = atoi(optarg);
+                break;
+
+            /* number of worker processes, "auto" is one for every core */
+            case 'w':
+                if(strcmp(optarg, "auto") == 0)
+                {
+                    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+                    server_config.workers = (cores <= 0) ? 1 : (cores > MAX_WORKERS ? MAX_WORKERS : (int)cores);
+                }
+                else if(is_number(optarg) == FAILED || atoi(optarg) <= 0 || atoi(optarg) > MAX_WORKERS)
+                {
+                    printf(USAGE_ERR);
+                    exit(FAILED);
+                }
+                else
+                    server_config.workers = atoi(optarg);
+                break;
+
+            /* listen backlog, default somaxconn */
+            case 'b':
+                if(is_number(optarg) == FAILED || atoi(optarg) <= 0)
+                {
+                    printf(USAGE_ERR);
+                    exit(FAILED);
+                }
+                server_config.backlog = atoi(optarg);
+                break;
+
+            /* TCP_DEFER_ACCEPT seconds and TCP_FASTOPEN queue length of the listening socket */
+            case 'A':
+            case 'F':
+                if(is_number(optarg) == FAILED)
+                {
+                    printf(USAGE_ERR);
+                    exit(FAILED);
+                }
+                if(opt == 'A')
+                    server_config.defer_accept = atoi(optarg);
+                else
+                    server_config.fastopen = atoi(optarg);
+                break;
+
+            /* TCP_NODELAY on every client socket */
+            case 'N':
+                server_config.nodelay = TRUE;
+                break;
+
+            /* idle timeout of persistent connections in seconds */
+            case 't':
+                if(is_number(optarg) == FAILED || atoi(optarg) <= 0)
+                {
+                    printf(USAGE_ERR);
+                    exit(FAILED);
+                }
+                server_config.keepalive_timeout = atoi(optarg);
+                break;
+
+            /* max requests on one connection, 1 means every response closes the connection */
+            case 'r':
+                if(is_number(optarg) == FAILED || atoi(optarg) <= 0)
+                {
+                    printf(USAGE_ERR);
+                    exit(FAILED);
+                }
+                server_config.keepalive_max = atoi(optarg);
+                break;
+
+            /* bytes of the file cache, 0 disables it */
+            case 'c':
+                if(is_number(optarg) == FAILED)
+                {
+                    printf(USAGE_ERR);
+                    exit(FAILED);
+                }
+                server_config.cache_size = strtoull(optarg, NULL, 10);
+                break;
+
+            /* bytes of the directory listings cache, 0 disables it */
+            case 'd':
+                if(is_number(optarg) == FAILED)
+                {
+                    printf(USAGE_ERR);
+                    exit(FAILED);
+                }
+                server_config.dir_cache_size = strtoull(optarg, NULL, 10);
+                break;
+
+            /* open files the fd cache keeps, 0 disables it */
+            case 'o':
+                if(is_number(optarg) == FAILED)
+                {
+                    printf(USAGE_ERR);
+                    exit(FAILED);
+                }
+                server_config.fd_cache_files = atoi(optarg);
+                break;
+
+            /* how long the caches trust a file without looking at it, when the document root can't be watched */
+            case 'v':
+                if(is_number(optarg) == FAILED)
+                {
+                    printf(USAGE_ERR);
+                    exit(FAILED);
+                }
+                server_config.revalidate_ms = atoi(optarg);
+                break;
+
+            /* zlib level of what is compressed here, 0 disables it */
+            case 'z':
+                if(is_number(optarg) == FAILED || atoi(optarg) > Z_BEST_COMPRESSION)
+                {
+                    printf(USAGE_ERR);
+                    exit(FAILED);
+                }
+                server_config.gzip_level = atoi(optarg);
+                break;
+
+            /* smallest file that is compressed here */
+            case 'Z':
+                if(is_number(optarg) == FAILED)
+                {
+                    printf(USAGE_ERR);
+                    exit(FAILED);
+                }
+                server_config.gzip_min = strtoull(optarg, NULL, 10);
+                break;
+
+            default:
+                printf(USAGE_ERR);
+                exit(FAILED);
+        }
+    }
+    snprintf(server_config.keepalive_header, sizeof(server_config.keepalive_header), "Connection: keep-alive\r\nKeep-Alive: timeout=%d\r\n", server_config.keepalive_timeout);
+    if(init_status_responses() == FAILED)
+    {
+        printf("error on rendering responses\r\n");
+        exit(FAILED);
+    }
+
+    /* the best kernel the CPU has for scanning requests */
+    http_parser_setup(HTTP_SCAN_BEST);
+
     /* check number of arguments */
-    if(argc != 4)
+    if(argc - optind != 3)
     {
         printf(USAGE_ERR);
         exit(FAILED);
     }
+    char** args = argv + optind;
 
     /* check if each input is a number */
-    if(is_number(argv[1]) == FAILED || is_number(argv[2]) == FAILED || is_number(argv[3]) == FAILED)
+    if(is_number(args[0]) == FAILED || is_number(args[1]) == FAILED || is_number(args[2]) == FAILED)
     {
         printf(USAGE_ERR);
         exit(FAILED);
     }
 
     /* all the inputs are definitly numbers */
-    int port = atoi(argv[1]);
-    int num_of_threads = atoi(argv[2]);
-    int max_requests = atoi(argv[3]);
+    int port = atoi(args[0]);
+    int num_of_threads = atoi(args[1]);
+    int max_requests = atoi(args[2]);
 
     /* check if port is between it's bounderies and max request is a positive number */
     if(port <= MIN_PORT || port > MAX_PORT || max_requests <= 0)
@@ -107,8 +306,30 @@ int main(int argc, char* argv[])
         exit(FAILED);
     }
 
+    /* prefork mode, a supervisor keeps the worker processes running and each one listens on its' own socket */
+    if(server_config.workers > 0)
+        return run_prefork(server_config.workers, port, num_of_threads, max_requests);
+
+    return run_server(port, num_of_threads, max_requests);
+}
+
+
+/* one server: the listening socket, the threadpool, the caches and the front end, returns after max_requests connections */
+int run_server(int port, int num_of_threads, int max_requests)
+{
     int sockfd = create_server(port);
-    threadpool* tp = create_threadpool(num_of_threads);
+    threadpool_config_t pool_config;
+    pool_config.num_threads = num_of_threads;
+    pool_config.queue = server_config.queue;
+    pool_config.ring_size = RING_SIZE;
+    pool_config.max_threads = server_config.max_threads;
+    pool_config.grow_wait = GROW_WAIT;
+    pool_config.grow_qsize = 0;
+    pool_config.idle_timeout = IDLE_TIMEOUT;
+    pool_config.max_queue = server_config.max_queue;
+    pool_config.shed_target = server_config.shed_target;
+    pool_config.shed_interval = server_config.shed_interval;
+    threadpool* tp = create_threadpool_ex(&pool_config);
     if(tp == NULL)
     {
         printf(USAGE_ERR);
@@ -116,6 +337,41 @@ int main(int argc, char* argv[])
         exit(FAILED);
     }
 
+    /* a client that hangs up in the middle of a response must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* the epoll and io_uring front ends hold every connection open, the limit is raised before the fd cache takes its' part of it */
+    if(server_config.mode == MODE_EPOLL || server_config.mode == MODE_URING)
+        raise_fd_limit();
+
+    file_cache = create_cache(server_config.cache_size, CACHE_MAX_FILE, server_config.revalidate_ms);
+    dir_cache = create_cache(server_config.dir_cache_size, DIR_CACHE_MAX_LISTING, server_config.revalidate_ms);
+    cache_set_stat(dir_cache, listing_stat);
+    fd_cache = create_fd_cache(server_config.fd_cache_files, server_config.revalidate_ms);
+
+    /* the document root is watched, so known paths and cached responses are trusted until something changes */
+    if(meta_init(".", META_MAX_ENTRIES) == SUCCESS)
+    {
+        cache_set_generation(file_cache, meta_generation);
+        cache_set_generation(dir_cache, meta_generation);
+        fd_cache_set_generation(fd_cache, meta_generation);
+    }
+
+    /* epoll and io_uring front ends, the event loop owns all the sockets */
+    if(server_config.mode == MODE_EPOLL || server_config.mode == MODE_URING)
+    {
+        int check = (server_config.mode == MODE_URING) ? run_uring_loop(sockfd, tp, max_requests) : run_event_loop(sockfd, tp, max_requests);
+        print_pool_stats(tp);
+        destroy_threadpool(tp);
+        close(sockfd);
+        print_stats();
+        meta_destroy();
+        destroy_cache(file_cache);
+        destroy_cache(dir_cache);
+        destroy_fd_cache(fd_cache);
+        return check;
+    }
+
     int* fds = (int*)malloc(sizeof(int)*max_requests);
     if(fds == NULL)
     {
@@ -127,31 +383,89 @@ int main(int argc, char* argv[])
     int i;
     for(i = 0; i < max_requests; i++)
     {
-        fds[i] = accept(sockfd, NULL, NULL);
+        fds[i] = accept_client(sockfd);
         if(fds[i] < 0)
         {
-            perror("accept");
             destroy_threadpool(tp);
             close(sockfd);
             exit(FAILED);
         }
-        dispatch(tp, create_response, (void*)&fds[i]);
+
+        /* the pool is overloaded, the client is told to come back later instead of waiting in the queue */
+        if(try_dispatch(tp, create_response, (void*)&fds[i]) == FAILED)
+        {
+            shed_response(fds[i]);
+            close(fds[i]);
+        }
     }
 
+    print_pool_stats(tp);
     destroy_threadpool(tp);
     close(sockfd);
     free(fds);
+    print_stats();
+    meta_destroy();
+    destroy_cache(file_cache);
+    destroy_cache(dir_cache);
+    destroy_fd_cache(fd_cache);
     return SUCCESS;
 }
 
 
+/* print the counters of the caches when the server is done */
+void print_stats(void)
+{
+    cache_t* caches[2] = { file_cache, dir_cache };
+    const char* names[2] = { "file", "directory" };
+    int i;
+    for(i = 0; i < 2; i++)
+    {
+        if(caches[i] == NULL)
+            continue;
+
+        cache_stats_t stats;
+        cache_get_stats(caches[i], &stats);
+        printf("%s cache: %lu hits, %lu misses, %lu evictions, %lu invalidations, %lu entries, %lu bytes\n",
+               names[i], stats.hits, stats.misses, stats.evictions, stats.invalidations, stats.entries, (unsigned long)stats.bytes);
+    }
+
+    if(fd_cache != NULL)
+    {
+        fd_cache_stats_t fds;
+        fd_cache_get_stats(fd_cache, &fds);
+        printf("fd cache: %lu hits, %lu misses, %lu evictions, %lu invalidations, %d open of %d\n",
+               fds.hits, fds.misses, fds.evictions, fds.invalidations, fds.entries, fds.max_fds);
+    }
+
+    meta_stats_t meta;
+    meta_get_stats(&meta);
+    printf("path cache: %lu hits (%lu negative), %lu misses, %lu evictions, %lu entries, generation %lu\n",
+           meta.hits, meta.negative_hits, meta.misses, meta.evictions, meta.entries, meta.generation);
+}
+
+
+/* print the threads of the pool and how long the jobs waited, before the pool is destroyed */
+void print_pool_stats(threadpool* tp)
+{
+    threadpool_stats_t stats;
+    threadpool_get_stats(tp, &stats);
+    printf("threadpool: %d threads (%d-%d, peak %d), %lu grown, %lu retired, %lu shed",
+           stats.threads, stats.min_threads, stats.max_threads, stats.peak_threads, stats.grown, stats.retired, stats.shed);
+    if(stats.jobs > 0)
+        printf(", %lu jobs waited %.3f ms on average, %.3f ms at most", stats.jobs,
+               (double)stats.wait_ns / stats.jobs / 1000000, (double)stats.max_wait_ns / 1000000);
+    printf("\n");
+}
+
+
 /* create socket descriptor where the server is listening to requests */
 int create_server(int port)
 {
     int sockfd;
     struct sockaddr_in srv;
 
-    if((sockfd = socket(PF_INET, SOCK_STREAM, 0)) < 0)
+    /* the listening socket is non-blocking, the front ends accept until there is nothing pending */
+    if((sockfd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
     {
         perror("socket");
         exit(FAILED);
@@ -162,6 +476,14 @@ int create_server(int port)
     srv.sin_port = htons(port);        
     srv.sin_addr.s_addr = htonl(INADDR_ANY);
 
+    /* every worker process binds its' own socket on the port, the kernel spreads the connections between them */
+    int on = 1;
+    if(server_config.workers > 0 && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+    {
+        perror("setsockopt");
+        exit(FAILED);
+    }
+
     /* bind socket to the server */
     if((bind(sockfd, (struct sockaddr*)&srv, sizeof(srv))) < 0)
     {
@@ -169,196 +491,394 @@ int create_server(int port)
         exit(FAILED);
     }
 
-    /* socket queue is 5 */
-    if(listen(sockfd, QUEUE_SIZE) < 0)
+    /* a burst of connects bigger than the backlog would lose SYNs and stall the clients for a retransmit timeout */
+    int backlog = (server_config.backlog > 0) ? server_config.backlog : default_backlog();
+    if(listen(sockfd, backlog) < 0)
     {
         perror("listen");
         exit(FAILED);
     }
 
+    /* wake the front end up only when the request arrived, the connection is accepted anyway after defer_accept seconds */
+    if(server_config.defer_accept > 0 &&
+       setsockopt(sockfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &server_config.defer_accept, sizeof(server_config.defer_accept)) < 0)
+        perror("setsockopt TCP_DEFER_ACCEPT");
+
+    /* clients that have a cookie send the request with the SYN */
+    if(server_config.fastopen > 0 &&
+       setsockopt(sockfd, IPPROTO_TCP, TCP_FASTOPEN, &server_config.fastopen, sizeof(server_config.fastopen)) < 0)
+        perror("setsockopt TCP_FASTOPEN");
+
     return sockfd;
 }
 
 
-/* this is the function where we are been sent from dispatch, it creates the response for the client */
+/* the biggest backlog the kernel allows (net.core.somaxconn), SOMAXCONN if it can't be read */
+int default_backlog(void)
+{
+    int backlog = SOMAXCONN;
+    FILE* file = fopen(SOMAXCONN_PATH, "r");
+    if(file == NULL)
+        return backlog;
+
+    if(fscanf(file, "%d", &backlog) != 1 || backlog <= 0)
+        backlog = SOMAXCONN;
+    fclose(file);
+    return backlog;
+}
+
+
+/* accepts the next client of the blocking front end, waits (poll) only when nothing is pending. returns the fd or -1 */
+int accept_client(int sockfd)
+{
+    while(TRUE)
+    {
+        /* the client socket is blocking, the worker that serves it waits on it */
+        int fd = accept4(sockfd, NULL, NULL, SOCK_CLOEXEC);
+        if(fd >= 0)
+        {
+            tune_client(fd);
+            return fd;
+        }
+
+        /* the client went away before it was accepted */
+        if(errno == EINTR || errno == ECONNABORTED || errno == EPROTO)
+            continue;
+
+        /* out of descriptors, the files nobody sends right now are closed to make room */
+        if((errno == EMFILE || errno == ENFILE) && fd_cache_trim(fd_cache) > 0)
+            continue;
+
+        if(errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            perror("accept4");
+            return -1;
+        }
+
+        struct pollfd pfd;
+        pfd.fd = sockfd;
+        pfd.events = POLLIN;
+        if(poll(&pfd, 1, -1) < 0 && errno != EINTR)
+        {
+            perror("poll");
+            return -1;
+        }
+    }
+}
+
+
+/* socket options of a client socket that was just accepted */
+void tune_client(int fd)
+{
+    int on = 1;
+    if(server_config.nodelay)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+
+/* this is the function where we are been sent from dispatch, it creates the responses for the client until the connection is closed */
 int create_response(void* arg)
 {
     /* getting the socket where the client is talking with us */
     int* fd_pointer = (int*)arg;
     int fd = *fd_pointer;
 
-    /* creating request struct to keep variables that are necessery for response like path */
-    request_t* request = (request_t*)malloc(sizeof(request_t));
-    if(request == NULL)
+    /* one read buffer for the whole connection from the pool of the thread, bytes of the next request that were read together with the current one stay in it */
+    int size = BUFFER_SIZE;
+    int len = 0;
+    char* buff = (char*)bufpool_get(size);
+    if(buff == NULL)
     {
-        server_error(fd, request);
+        close(fd);
         return FAILED;
     }
-    bzero(request, sizeof(request_t));
+    http_request_t parsed;
+    http_request_t* http = &parsed;
+    int served = 0;
+    int result = SUCCESS;
 
-    /* create buffer for reading request from client into buffer and read the request */
-    request->read_buff = (char*)malloc(sizeof(char)*BUFFER_SIZE);
-    if(request->read_buff == NULL)
-    {
-        server_error(fd, request);
-        exit(FAILED);
-    }
-    bzero(request->read_buff, BUFFER_SIZE);
+    /* responses to pipelined requests are gathered and sent together */
+    out_batch_t batch;
+    batch_start(&batch, fd);
 
-    int nbytes = 0;
-    nbytes = read(fd, request->read_buff, BUFFER_SIZE);
-    if(nbytes < 0)
+    while(TRUE)
     {
-        perror("read");
-        server_error(fd, request);
-        exit(FAILED);
-    }
+        /* the gathered responses go out once no complete request is left in the buffer, before waiting for the client */
+        http_parser_init(http);
+        if(http_parse(http, buff, len) != PARSE_COMPLETE && batch_flush() == FAILED)
+        {
+            result = FAILED;
+            break;
+        }
 
-    /* check the type of response we need to send back */
-    int type = check_input(request->read_buff, request, fd);
-    
-    if(type == FAILED)
-        server_error(fd, request);
+        /* read the request, the connection is closed if the client is idle for too long */
+        int nbytes = read_request(fd, &buff, &size, &len, http);
+        if(nbytes <= 0)
+        {
+            result = (nbytes < 0) ? FAILED : SUCCESS;
+            break;
+        }
 
-    else
-    {
-        /* write response to write buffer in request struct and send back to client */
-        int check;
-        switch(type)
+        /* creating request struct to keep variables that are necessery for response like path, it borrows the buffer and the parsed request of the connection */
+        request_t* request = new_request(buff, http, (++served < server_config.keepalive_max) ? TRUE : FALSE);
+        if(request == NULL)
         {
-            case BAD_REQUEST:
-                check = error_response(request, BAD_REQUEST, fd);
-                break;
-            
-            case NOT_SUPPORTED:
-                check = error_response(request, NOT_SUPPORTED, fd);
-                break;
+            result = FAILED;
+            break;
+        }
+        batch_gather((len > http->head_len) ? TRUE : FALSE);
+        process_request(request, fd);
 
-            case NOT_FOUND:
-                check = error_response(request, NOT_FOUND, fd);
-                break;    
+        int keep_alive = request->keep_alive;
+        free_struct(request);
+        if(!keep_alive)
+            break;
 
-            case FOUND:
-                check = error_response(request, FOUND, fd);
-                break;
+        /* keep whatever the client sent after this request for the next round */
+        len -= http->head_len;
+        memmove(buff, buff + http->head_len, len);
+    }
 
-            case FORBIDDEN:
-                check = error_response(request, FORBIDDEN, fd);
-                break;
-            
-            case DIR_CONTENT:
-                check = dir_content(request, fd);
-                break;
+    if(batch_stop() == FAILED)
+        result = FAILED;
 
-            case FILE_CONTENT:
-                check = file_content(request, fd);
-                break;
-        }
+    /* the socket is closed after the last request, the client may still be sending a request that was too large */
+    if(http->result != PARSE_COMPLETE && http->result != PARSE_PARTIAL)
+        drain_client(fd);
+    bufpool_put(buff);
+    close(fd);
+    return result;
+}
+
+
+/* parses what is already in the buffer and reads from the client until the head of the request is complete (or can't be), returns its' length in the buffer, 0 if the client closed or went idle, -1 on error */
+int read_request(int fd, char** buff, int* size, int* len, http_request_t* http)
+{
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
 
+    while(http_parse(http, *buff, *len) == PARSE_PARTIAL)
+    {
+        /* the parser stops the request before the buffer reaches READ_BUFFER_MAX */
+        if(*len == *size && grow_read_buffer(buff, size) == FAILED)
+            return -1;
+
+        /* wait for the client, but not for longer than the idle timeout */
+        int ready = poll(&pfd, 1, server_config.keepalive_timeout * 1000);
+        if(ready < 0 && errno == EINTR)
+            continue;
+        if(ready <= 0)
+            return 0;
 
-        /* error types and directory content are being sent here to client, file content */
-        if(type != FILE_CONTENT && check != FAILED)
+        int nbytes = read(fd, *buff + *len, *size - *len);
+        if(nbytes < 0)
         {
-            nbytes = write(fd, request->write_buff, strlen(request->write_buff));
-            if(nbytes < 0)
-            {
-                perror("write");
-                server_error(fd, request);
-                exit(FAILED);
-            }
+            if(errno == EINTR)
+                continue;
+            perror("read");
+            return -1;
+        }
+
+        /* client closed the connection, answer what was sent so far (if anything) */
+        if(nbytes == 0)
+        {
+            if(*len == 0)
+                return 0;
+            http_parse_end(http);
+            break;
         }
+
+        *len += nbytes;
     }
+    return *len;
+}
 
-    /* each struct is for one request so we need to free it and close socket */
-    free_struct(request);
-    close(fd);
+
+/* doubles the read buffer (a bigger one of the pool), up to READ_BUFFER_MAX bytes. the parsed request is kept as offsets so it stays valid */
+int grow_read_buffer(char** buff, int* size)
+{
+    if(*size >= READ_BUFFER_MAX)
+        return FAILED;
+
+    int new_size = (*size * 2 < READ_BUFFER_MAX) ? *size * 2 : READ_BUFFER_MAX;
+    char* new_buff = (char*)bufpool_grow(*buff, *size, new_size);
+    if(new_buff == NULL)
+        return FAILED;
+
+    *buff = new_buff;
+    *size = new_size;
     return SUCCESS;
 }
 
 
-/* the function return what type of response we need to answer to the client, it keeps essentials variables in request struct */
-int check_input(char* input, request_t* request, int fd)
+/* takes a request struct from the arena of the thread, the request borrows the read buffer and the parsed request of the connection */
+request_t* new_request(char* read_buff, http_request_t* http, int keep_alive)
 {
-    if(input == NULL)
-        return BAD_REQUEST;
-
-    
-    char* local_input = (char*)malloc(sizeof(char)*(strlen(input)+1));
-    strcpy(local_input, input);
+    arena_t* arena = arena_thread();
+    if(arena == NULL)
+        return NULL;
 
-    char* method;
-    char* path;
-    char* version;
-    
-    /* CHECK FOR INPUT */
-    /* get from input METHOD PATH VERSION */ 
-    method = strtok(local_input, " ");
-    if(!method)
+    request_t* request = (request_t*)arena_alloc(arena, sizeof(request_t));
+    if(request == NULL)
     {
-        free(local_input);
-        return BAD_REQUEST;
+        arena_reset(arena);
+        return NULL;
     }
+    bzero(request, sizeof(request_t));
+    request->arena = arena;
+    request->read_buff = read_buff;
+    request->http = http;
+    request->keep_alive = keep_alive;
+    return request;
+}
 
-    /* get the path from the request and the type of file and insert into the struct */
-    path = strtok(NULL, " ");
-    if(!path)
-    {
-        free(local_input);
-        return BAD_REQUEST; 
-    }
 
-    /* get the version of the http request and insert into the struct */
-    version = strtok(NULL, "\r");
-    if(!version)
+/* answers the request that is already inside read buffer of the request struct, both front ends end up here */
+int process_request(request_t* request, int fd)
+{
+    /* check the type of response we need to send back */
+    int type = check_input(request->read_buff, request, fd);
+    
+    if(type == FAILED)
     {
-        free(local_input);
-        return BAD_REQUEST;
+        server_error(fd, request);
+        return FAILED;
     }
 
-    if(strcmp(version, "HTTP/1.0") != 0 && strcmp(version, "HTTP/1.1") != 0)
+    /* write response to write buffer in request struct and send back to client */
+    int check = FAILED;
+    switch(type)
     {
-        free(local_input);
-        return BAD_REQUEST;
-    }
+        case BAD_REQUEST:
+            check = error_response(request, BAD_REQUEST, fd);
+            break;
+        
+        case NOT_SUPPORTED:
+            check = error_response(request, NOT_SUPPORTED, fd);
+            break;
 
-    /* SUPPORT ONLY GET METHOD */
-    /* check if the method is get */
-    if(strcmp(method, "GET") != 0)
-    {
-        free(local_input);
-        return NOT_SUPPORTED;
-    }
+        case NOT_FOUND:
+            check = error_response(request, NOT_FOUND, fd);
+            break;    
 
-    /* check if the client is asking for the main directory of the server */
-    if(strlen(path) == 1 && strcmp(path, "/") == 0)
-    {
-        path = "/./";
-    }
+        case URI_TOO_LONG:
+            check = error_response(request, URI_TOO_LONG, fd);
+            break;
 
-    /* we don't need the first '/' for response */
+        case HEADERS_TOO_LARGE:
+            check = error_response(request, HEADERS_TOO_LARGE, fd);
+            break;
+
+        case FOUND:
+            check = error_response(request, FOUND, fd);
+            break;
+
+        case FORBIDDEN:
+            check = error_response(request, FORBIDDEN, fd);
+            break;
+        
+        case DIR_CONTENT:
+            check = dir_content(request, fd);
+            break;
+
+        case FILE_CONTENT:
+            check = file_content(request, fd);
+            break;
+    }
+
+    return check;
+}
+
+
+/* the function return what type of response we need to answer to the client, it keeps essentials variables in request struct */
+int check_input(char* input, request_t* request, int fd)
+{
+    /* the front end tells us if the connection may stay open, from here on it depends on the request */
+    int may_keep_alive = request->keep_alive;
+    request->keep_alive = FALSE;
+
+    http_request_t* http = request->http;
+    if(input == NULL || http == NULL)
+        return BAD_REQUEST;
+
+    /* CHECK FOR INPUT */
+    /* the parser already split the request into METHOD PATH VERSION and headers */
+    if(http->result == PARSE_URI_TOO_LONG)
+        return URI_TOO_LONG;
+    if(http->result == PARSE_TOO_LARGE)
+        return HEADERS_TOO_LARGE;
+    if(http->result != PARSE_COMPLETE)
+        return BAD_REQUEST;
+
+    if(http->major != 1 || http->minor > 1)
+        return BAD_REQUEST;
+
+    /* SUPPORT ONLY GET METHOD */
+    /* check if the method is get */
+    if(!http_span_is(input, http->method, "GET"))
+        return NOT_SUPPORTED;
+
+    if(may_keep_alive)
+        request->keep_alive = keep_alive_requested(http);
+
+    /* the path ends with the space before the version, it becomes a string in place */
+    char* path = input + http->path.off;
+    path[http->path.len] = '\0';
+
+    /* check if the client is asking for the main directory of the server */
+    if(strlen(path) == 1 && strcmp(path, "/") == 0)
+    {
+        path = "/./";
+    }
+
+    /* we don't need the first '/' for response */
     if(strlen(path) > 1)
         path++;
 
 
+    /* the verdict of this path is known and nothing changed under the document root since, no stat is needed */
+    meta_result_t meta;
+    if(meta_lookup(path, &meta, request->arena) == SUCCESS)
+    {
+        request->path = meta.path;
+        request->st = meta.st;
+        memcpy(request->etag, meta.etag, ETAG_SIZE);
+        return meta.type;
+    }
+
+    /* resolve the path and keep the verdict with its' ETag, the generation is taken before the file system is looked at */
+    unsigned long generation = meta_generation();
+    int type = resolve_path(path, request, fd);
+    if(type != FAILED)
+    {
+        make_etag(request->etag, &request->st);
+        meta_insert(path, type, request->path, &request->st, request->etag, generation);
+    }
+
+    return type;
+}
+
+
+/* the function return what type of response the path needs, it keeps the resolved path and its' metadata in request struct */
+int resolve_path(char* path, request_t* request, int fd)
+{
     /* CHECK IF THE PATH EXISTS */
     /* there is no such path, then NOT FOUND */
     struct stat fileStat;
     if(stat(path, &fileStat) < 0)
     {
         if(errno == ENOENT || (errno == ENOTDIR && path[strlen(path)-1] == '/'))
-        {
-            free(local_input);
             return NOT_FOUND;
-        }
         else
-        {
-            server_error(fd, request);
             return FAILED;
-        }
     }
     
     else
     {
+        /* the metadata of the path, it is replaced by the one of index.html if that is what is sent */
+        request->st = fileStat;
+
         /* check if each folder in path has execute permissions */
         int check = check_permissions(path, request, fd);
 
@@ -369,65 +889,43 @@ int check_input(char* input, request_t* request, int fd)
             if(path[strlen(path)-1] != '/')
             {
                 // keep path in struct for further uses
-                request->path = (char*)malloc(sizeof(char)*(strlen(path)+2));
-                bzero(request->path, (strlen(path)+1));
-                sprintf(request->path, "/%s", path);
-                
-                free(local_input);
+                if((request->path = arena_printf(request->arena, "/%s", path)) == NULL)
+                    return FAILED;
                 return FOUND;
             }
 
             /* one of the folders doesn't have execute permissions */
             if(check == FAILED)
-            {
-                free(local_input);
                 return FORBIDDEN;
-            }
 
             /* path is bad */
             else if(check == NOT_FOUND)
-            {
-                free(local_input);
                 return NOT_FOUND;
-            }
 
             /* it is a path of directory and it ends with '/' then: */
             if(path[strlen(path)-1] == '/')
             {
                 /* 1. look up for index.html file */
-                char* index = (char*)malloc(sizeof(char)*(strlen(path) + strlen("index.html") + 1));
+                char* index = arena_printf(request->arena, "%sindex.html", path);
                 if(index == NULL)
-                {
-                    server_error(fd, request);
                     return FAILED;
-                }
-                bzero(index, sizeof(char)*(strlen(path) + strlen("index.html") + 1));
-                sprintf(index, "%sindex.html", path);
 
                 
                 /* if there is such file and other has read permissions then call file_content */
                 if((stat(index, &fileStat) >= 0) && (fileStat.st_mode & S_IROTH) && (check == SUCCESS))
                 {
                     /* keep path in struct for further uses */
-                    request->path = (char*)malloc(sizeof(char)*(strlen(index)+1));
-                    bzero(request->path, (strlen(index)+1));
-                    strcpy(request->path, index);
-
-                    free(index);
-                    free(local_input);
+                    request->path = index;
+                    request->st = fileStat;
                     return FILE_CONTENT;
                 }
 
                 /* 2. else return dir_content */        
                 else
                 {
-                    /* keep path in struct for further uses */
-                    request->path = (char*)malloc(sizeof(char)*(strlen(path)+1));
-                    bzero(request->path, (strlen(path)+1));
-                    strcpy(request->path, path);
-
-                    free(index);
-                    free(local_input);
+                    /* keep path in struct for further uses, the ETag and Last-Modified of the listing are made when it is rendered */
+                    if((request->path = arena_strdup(request->arena, path)) == NULL)
+                        return FAILED;
                     return DIR_CONTENT;
                 }
             }
@@ -435,413 +933,1356 @@ int check_input(char* input, request_t* request, int fd)
 
         /* if it isn't a regular file then return FORBIDDEN */
         if(!S_ISREG(fileStat.st_mode))
-        {
-            free(local_input);
             return FORBIDDEN;
-        }
 
         /* the caller doesn't have read permissions then return FORBIDDEN */
-        else if((stat(path, &fileStat) >= 0) && !(fileStat.st_mode & S_IROTH) && (check == SUCCESS))
-        {
-            free(local_input);
+        else if(!(fileStat.st_mode & S_IROTH) && (check == SUCCESS))
             return FORBIDDEN;
-        }
 
         /* if the path is a file */
         if(S_ISREG(fileStat.st_mode) && (S_IROTH) && (check == SUCCESS))
         {
             /* keep path in struct for further uses */
-            request->path = (char*)malloc(sizeof(char)*(strlen(path)+1));
-            bzero(request->path, (strlen(path)+1));
-            strcpy(request->path, path);
-
-            free(local_input);
+            if((request->path = arena_strdup(request->arena, path)) == NULL)
+                return FAILED;
             return FILE_CONTENT;
         }   
     }
     
-    free(local_input);
     return FAILED;
 }
 
 
-/* if there is a problem in the request of the client then return this error */
+/* if there is a problem in the request of the client then return this error, the response is pre-rendered and only the date (and location) is added */
 int error_response(request_t* request, int err_type, int fd)
 {
-    /* get current date and insert into request struct */
-    int check;
-    check = get_timebuff(request, TIME_NOW, fd);
+    status_response_t* status = get_status_response(err_type);
+    if(status == NULL)
+        return FAILED;
+
+    char date[DATE_SIZE];
+    current_date(date);
+
+    /* the rendered response ends with either a close or a keep-alive connection header */
+    int keep_alive = request->keep_alive;
+    response_t response;
+    response_init(&response);
+    response_add(&response, status->head, status->head_len);
+    response_add(&response, date, strlen(date));
+
+    /* directories must end with a slash, tell the client where */
+    if(err_type == FOUND)
+    {
+        response_add(&response, "\r\nLocation: ", strlen("\r\nLocation: "));
+        response_add(&response, request->path, strlen(request->path));
+        response_add(&response, "/", 1);
+    }
+
+    /* none of the ranges is in the file, tell the client how big it is */
+    if(err_type == RANGE_NOT_SATISFIABLE)
+        response_printf(&response, "\r\nContent-Range: bytes */%lld", (long long)request->st.st_size);
+
+    if(keep_alive)
+        response_add(&response, status->tail_keep_alive, status->tail_keep_alive_len);
+    else
+        response_add(&response, status->tail_close, status->tail_close_len);
+
+    int check = response_send(&response, fd);
+    response_free(&response);
     if(check == FAILED)
+    {
+        request->keep_alive = FALSE;
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+
+/* turns a new client away while the pool is overloaded, the pre-rendered 503 is sent without waiting for the socket (nothing else is queued on it) */
+int shed_response(int fd)
+{
+    status_response_t* status = get_status_response(SERVICE_UNAVAILABLE);
+    if(status == NULL)
+        return FAILED;
+
+    char date[DATE_SIZE];
+    current_date(date);
+
+    struct iovec iov[3];
+    iov[0].iov_base = status->head;
+    iov[0].iov_len = status->head_len;
+    iov[1].iov_base = date;
+    iov[1].iov_len = strlen(date);
+    iov[2].iov_base = status->tail_close;
+    iov[2].iov_len = status->tail_close_len;
+
+    struct msghdr msg;
+    bzero(&msg, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 3;
+    if(sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
         return FAILED;
+    return SUCCESS;
+}
+
+
+/* render the responses of every status once, when the server starts */
+int init_status_responses(void)
+{
+    int statuses[] = { FOUND, BAD_REQUEST, FORBIDDEN, NOT_FOUND, URI_TOO_LONG, RANGE_NOT_SATISFIABLE, HEADERS_TOO_LARGE, INTERNAL_ERROR, NOT_SUPPORTED, SERVICE_UNAVAILABLE };
+    char* phrases[] = { "302 Found", "400 Bad Request", "403 Forbidden", "404 Not Found", "414 URI Too Long", "416 Range Not Satisfiable",
+                        "431 Request Header Fields Too Large", "500 Internal Server Error", "501 Not supported", "503 Service Unavailable" };
+    char* bodies[] = { FOUND_BODY, BAD_REQUEST_BODY, FORBIDDEN_BODY, NOT_FOUND_BODY, URI_TOO_LONG_BODY, RANGE_NOT_SATISFIABLE_BODY,
+                       HEADERS_TOO_LARGE_BODY, INTERNAL_ERROR_BODY, NOT_SUPPORTED_BODY, SERVICE_UNAVAILABLE_BODY };
+
+    // a client that was turned away is told when to try again
+    char retry_after[HEADER_SIZE];
+    snprintf(retry_after, sizeof(retry_after), "Retry-After: %d\r\n", RETRY_AFTER);
 
-    /* get size of error response and insert response into write buff in request so we will send it after */
-    int size = 0;
-    switch(err_type)
+    int i;
+    for(i = 0; i < NUM_STATUSES; i++)
     {
-        case FOUND:
-            size = response_size(request, FOUND, fd);
-            request->write_buff = (char*)malloc(sizeof(char)*(size));
-            if(request->write_buff == NULL)
-            {
-                server_error(fd, request);
-                return FAILED;
-            }
-            bzero(request->write_buff, size);
-            sprintf(request->write_buff, "HTTP/1.0 302 Found\r\nServer: webserver/1.0\r\nDate: %s\r\nLocation: %s/\r\nContent-Type: text/html\r\nContent-Length: 123\r\nConnection: close\r\n\r\n", request->time_now, request->path);
-            sprintf(request->write_buff + strlen(request->write_buff), "<HTML><HEAD><TITLE>302 Found</TITLE></HEAD>\r\n<BODY><H4>302 Found</H4>\r\nDirectories must end with a slash.\r\n</BODY></HTML>");
-            break;
+        status_response_t* status = &status_responses[i];
+        status->status = statuses[i];
 
+        /* everything before the date */
+        status->head_len = snprintf(status->head, sizeof(status->head), "HTTP/1.0 %s\r\nServer: webserver/1.0\r\nDate: ", phrases[i]);
 
-        case BAD_REQUEST:
-            size = response_size(request, BAD_REQUEST, fd);
-            request->write_buff = (char*)malloc(sizeof(char)*(size));
-            if(request->write_buff == NULL)
-            {
-                server_error(fd, request);
-                return FAILED;
-            }
-            bzero(request->write_buff, size);
-            sprintf(request->write_buff, "HTTP/1.0 400 Bad Request\r\nServer: webserver/1.0\r\nDate: %s\r\nContent-Type: text/html\r\nContent-Length: 113\r\nConnection: close\r\n\r\n", request->time_now);
-            sprintf(request->write_buff + strlen(request->write_buff), "<HTML><HEAD><TITLE>400 Bad Request</TITLE></HEAD>\r\n<BODY><H4>400 Bad Request</H4>\r\nBad Request.\r\n</BODY></HTML>");
-            break;
+        /* everything after the date, one for each Connection header */
+        char* extra = (statuses[i] == SERVICE_UNAVAILABLE) ? retry_after : "";
+        status->tail_close_len = snprintf(status->tail_close, sizeof(status->tail_close), "\r\nContent-Type: text/html\r\nContent-Length: %d\r\n%s%s\r\n%s",
+                                          (int)strlen(bodies[i]), extra, "Connection: close\r\n", bodies[i]);
+        status->tail_keep_alive_len = snprintf(status->tail_keep_alive, sizeof(status->tail_keep_alive), "\r\nContent-Type: text/html\r\nContent-Length: %d\r\n%s%s\r\n%s",
+                                               (int)strlen(bodies[i]), extra, server_config.keepalive_header, bodies[i]);
 
-        case FORBIDDEN:
-            size = response_size(request, FORBIDDEN, fd);
-            request->write_buff = (char*)malloc(sizeof(char)*(size));
-            if(request->write_buff == NULL)
-            {
-                server_error(fd, request);
-                return FAILED;
-            }
-            bzero(request->write_buff, size);
-            sprintf(request->write_buff, "HTTP/1.0 403 Forbidden\r\nServer: webserver/1.0\r\nDate: %s\r\nContent-Type: text/html\r\nContent-Length: 111\r\nConnection: close\r\n\r\n", request->time_now);
-            sprintf(request->write_buff + strlen(request->write_buff), "<HTML><HEAD><TITLE>403 Forbidden</TITLE></HEAD>\r\n<BODY><H4>403 Forbidden</H4>\r\nAccess denied.\r\n</BODY></HTML>");
-            break;
+        if(status->head_len >= (int)sizeof(status->head) || status->tail_close_len >= (int)sizeof(status->tail_close) ||
+           status->tail_keep_alive_len >= (int)sizeof(status->tail_keep_alive))
+            return FAILED;
+    }
+    return SUCCESS;
+}
 
-        case NOT_FOUND:
-            size = response_size(request, NOT_FOUND, fd);
-            request->write_buff = (char*)malloc(sizeof(char)*(size));
-            if(request->write_buff == NULL)
-            {
-                server_error(fd, request);
-                return FAILED;
-            }
-            bzero(request->write_buff, size);
-            sprintf(request->write_buff, "HTTP/1.0 404 Not Found\r\nServer: webserver/1.0\r\nDate: %s\r\nContent-Type: text/html\r\nContent-Length: 112\r\nConnection: close\r\n\r\n", request->time_now);            
-            sprintf(request->write_buff + strlen(request->write_buff), "<HTML><HEAD><TITLE>404 Not Found</TITLE></HEAD>\r\n<BODY><H4>404 Not Found</H4>\r\nFile not found.\r\n</BODY></HTML>");
-            break;
 
-        case NOT_SUPPORTED:
-            size = response_size(request, NOT_SUPPORTED, fd);
-            request->write_buff = (char*)malloc(sizeof(char)*(size));
-            if(request->write_buff == NULL)
-            {
-                server_error(fd, request);
-                return FAILED;
-            }
-            bzero(request->write_buff, size);
-            sprintf(request->write_buff, "HTTP/1.0 501 Not supported\r\nServer: webserver/1.0\r\nDate: %s\r\nContent-Type: text/html\r\nContent-Length: 129\r\nConnection: close\r\n\r\n", request->time_now);
-            sprintf(request->write_buff + strlen(request->write_buff), "<HTML><HEAD><TITLE>501 Not supported</TITLE></HEAD>\r\n<BODY><H4>501 Not supported</H4>\r\nMethod is not supported.\r\n</BODY></HTML>");
+/* returns the pre-rendered response of a status, NULL if there isn't one */
+status_response_t* get_status_response(int status)
+{
+    int i;
+    for(i = 0; i < NUM_STATUSES; i++)
+    {
+        if(status_responses[i].status == status)
+            return &status_responses[i];
+    }
+    return NULL;
+}
+
+
+/* copies the current date (RFC1123) into buff, the string is formatted at most once a second and shared by all threads without locks */
+void current_date(char* buff)
+{
+    time_t now = time(NULL);
+    if(now != __atomic_load_n(&date_second, __ATOMIC_ACQUIRE))
+        refresh_date(now);
+
+    /* seqlock, copy again if the writer was in the middle of an update */
+    unsigned int seq;
+    while(TRUE)
+    {
+        seq = __atomic_load_n(&date_seq, __ATOMIC_ACQUIRE);
+        if(seq & 1)
+            continue;
+
+        memcpy(buff, date_string, DATE_SIZE);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(seq == __atomic_load_n(&date_seq, __ATOMIC_RELAXED))
             break;
     }
+    buff[DATE_SIZE - 1] = '\0';
+}
 
-    return SUCCESS;
+
+/* formats the date of second now into the shared date string, only one thread does it and the others keep reading the old one */
+void refresh_date(time_t now)
+{
+    unsigned int seq = __atomic_load_n(&date_seq, __ATOMIC_RELAXED);
+    if((seq & 1) || !__atomic_compare_exchange_n(&date_seq, &seq, seq + 1, FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+
+    struct tm tm_now;
+    gmtime_r(&now, &tm_now);
+    strftime(date_string, DATE_SIZE, RFC1123FMT, &tm_now);
+    __atomic_store_n(&date_second, now, __ATOMIC_RELEASE);
+    __atomic_store_n(&date_seq, seq + 2, __ATOMIC_RELEASE);
 }
 
 
 /* return the cotent of the directory */
 int dir_content(request_t* request, int fd)
 {
-    /* get the size of response */
-    int size_b_title = 0;
-    int size_b_body = 0;
-    int size_b = 0;
-    int size_h = 0;
+    if(get_timebuff(request, TIME_NOW, fd) == FAILED)
+        return FAILED;
 
-    size_b_title += strlen("<HTML><HEAD><TITLE>Index of ") + strlen(request->path) + strlen("</TITLE></HEAD>") + strlen("\r\n");
-    size_b_title += strlen("<BODY><H4>Index of ") + strlen(request->path) + strlen("</H4>") + strlen("\r\n");
-    size_b_body += strlen("<table CELLSPACING=8>") + strlen("\r\n");
-    size_b_body += strlen("<tr><th>Name</th><th>Last Modified</th><th>Size</th></tr>");
-    size_b_body += strlen("</table>") + strlen("\r\n");
-    size_b_body += strlen("<HR>") + strlen("\r\n");
-    size_b_body += strlen("<ADDRESS>webserver/1.0</ADDRESS>") + strlen("\r\n");
-    size_b_body += strlen("</BODY></HTML>");
+    /* a client that takes gzip gets the listing compressed, it is compressed once and kept in the directory cache */
+    if(server_config.gzip_level > 0 && (accepted_encodings(request) & ENCODING_GZIP))
+        request->encoding = ENCODING_GZIP;
 
-    char* body_response;
+    /* the listing is rendered again only when the directory or one of its' entries changed, the entry keeps the metadata its'
+       ETag and Last-Modified are made of so the client's copy is checked without looking at the directory */
+    char key[KEY_SIZE];
+    variant_key(request, key, sizeof(key));
+    cache_entry_t* entry = cache_lookup(dir_cache, key);
+    if(entry != NULL)
+    {
+        request->st.st_ino = entry->ino;
+        request->st.st_size = entry->size;
+        request->st.st_mtim = entry->mtime;
+        listing_etag(request);
 
+        int check;
+        if(not_modified(request))
+            check = not_modified_response(request, fd);
+        else
+            check = send_cached(request, fd, entry);
+        cache_release(dir_cache, entry);
+        return check;
+    }
+
+    /* the generation is taken and the directory stat'ed before it is read, what the rows show is folded in while they are
+       rendered like listing_stat does */
+    unsigned long generation = cache_generation(dir_cache);
     struct stat dirStat;
     if(stat(request->path, &dirStat) < 0)
     {
         server_error(fd, request);
         return FAILED;
     }
+    struct stat ownStat = dirStat;
+    dirStat.st_size = 0;
+    listing_fold(&dirStat, &ownStat);
+
+    /* get the items inside the directory */
+    char** names;
+    int num = list_dir(request, &names);
+    if(num == -1)
+    {
+        server_error(fd, request);
+        return FAILED;
+    }
 
-    struct dirent **namelist;
-    int num, i = 0;
+    /* the listing is rendered in one pass, every row goes where the one before it ended. it starts in the arena and
+       moves to the heap only if it is bigger */
+    text_t body;
+    char* storage = (char*)arena_alloc(request->arena, LISTING_TEXT);
+    text_init(&body, storage, (storage != NULL) ? LISTING_TEXT : 0);
+    text_printf(&body, "<HTML><HEAD><TITLE>Index of %s</TITLE></HEAD>\r\n<BODY><H4>Index of %s</H4>\r\n", request->path, request->path);
+    text_printf(&body, "<table CELLSPACING=8>\r\n<tr><th>Name</th><th>Last Modified</th><th>Size</th></tr>\r\n");
+
+    size_t path_len = strlen(request->path);
+    char file[HTTP_MAX_URI + NAME_MAX + 2];
+    int check = SUCCESS;
+    int i;
+    for(i = 0; i < num && check == SUCCESS; i++)
+    {
+        struct stat fileStat;
+        if(path_len + strlen(names[i]) >= sizeof(file))
+            check = FAILED;
+        else if(snprintf(file, sizeof(file), "%s%s", request->path, names[i]) < 0 || stat(file, &fileStat) < 0)
+            check = FAILED;
+        else
+        {
+            listing_fold(&dirStat, &fileStat);
 
-    /* get the number of items inside the directory */
-    num = scandir(request->path, &namelist, NULL, alphasort);
-    if (num == -1) 
+            /* get last modified time */
+            char file_last_modified[DATE_SIZE];
+            struct tm tm_mod;
+            strftime(file_last_modified, sizeof(file_last_modified), RFC1123FMT, gmtime_r(&fileStat.st_mtime, &tm_mod));
+
+            if(S_ISDIR(fileStat.st_mode))
+                text_printf(&body, "<tr>\r\n<td><A HREF=\"%s/\">%s</A></td><td>%s</td>\r\n<td></td>\r\n</tr>\r\n", names[i], names[i], file_last_modified);
+            else
+                text_printf(&body, "<tr>\r\n<td><A HREF=\"%s\">%s</A></td><td>%s</td>\r\n<td>%lld</td>\r\n</tr>\r\n", names[i], names[i], file_last_modified, (long long)fileStat.st_size);
+        }
+    }
+    text_printf(&body, "</table>\r\n<HR>\r\n<ADDRESS>webserver/1.0</ADDRESS>\r\n</BODY></HTML>");
+
+    if(check == FAILED || body.failed)
     {
+        text_free(&body);
         server_error(fd, request);
         return FAILED;
     }
 
-    /* add more details to size response */
-    while (i < num) 
+    /* a listing smaller than gzip_min is kept as it is under the gzip key, its' ETag is still the one the 304 was checked against */
+    const char* body_response = body.buff;
+    size_t body_len = body.len;
+    char* gzip = NULL;
+    int encoding = ENCODING_IDENTITY;
+    if(request->encoding == ENCODING_GZIP && body_len >= server_config.gzip_min)
     {
-        char* file = (char*)malloc(sizeof(char)*(strlen(request->path) + strlen(namelist[i]->d_name) + 1));
-        if(file == NULL)
+        size_t gzip_len;
+        gzip = gzip_body(body.buff, body.len, &gzip_len);
+        if(gzip == NULL)
         {
+            text_free(&body);
             server_error(fd, request);
             return FAILED;
         }
-        bzero(file, sizeof(char)*(strlen(request->path) + strlen(namelist[i]->d_name) + 1));
-        sprintf(file, "%s%s", request->path, namelist[i]->d_name);
+        body_response = gzip;
+        body_len = gzip_len;
+        encoding = ENCODING_GZIP;
+    }
 
-        struct stat fileStat;
-        if(stat(file, &fileStat) < 0)
+    /* the header lines of the listing, the directory was stat'ed before it was read so a change while rendering invalidates the entry */
+    request->st = dirStat;
+    listing_etag(request);
+
+    char header[HEADER_SIZE];
+    int header_len = variant_header(header, sizeof(header), "text/html", encoding, body_len, request->etag, dirStat.st_mtime);
+
+    /* the client's copy of the listing is still good, the listing is kept for the next request and only the headers are sent */
+    if(not_modified(request))
+    {
+        cache_release(dir_cache, cache_insert(dir_cache, key, header, header_len, body_response, body_len, &dirStat, generation));
+        check = not_modified_response(request, fd);
+    }
+    else
+        check = cache_and_send(request, fd, dir_cache, key, header, header_len, body_response, body_len, &dirStat, generation);
+    bufpool_put(gzip);
+    text_free(&body);
+    return check;
+}
+
+
+/* the ETag of the listing of the request from the stat of the listing in request->st, with "-gzip" when it is sent compressed */
+void listing_etag(request_t* request)
+{
+    make_etag(request->etag, &request->st);
+    if(request->encoding != ENCODING_IDENTITY)
+        variant_etag(request->etag, encoding_name(request->encoding));
+}
+
+
+/* reads the names of the directory of the request into the arena, sorted like scandir with alphasort, returns their number or -1 */
+int list_dir(request_t* request, char*** names)
+{
+    DIR* dir = opendir(request->path);
+    if(dir == NULL)
+        return -1;
+
+    int count = 0;
+    int size = DIR_NAMES;
+    char** list = (char**)arena_alloc(request->arena, sizeof(char*) * size);
+    struct dirent* entry;
+    while(list != NULL && (entry = readdir(dir)) != NULL)
+    {
+        /* a full array is replaced by one twice as big, the old one stays in the arena until the request is done */
+        if(count == size)
         {
-            server_error(fd, request);
-            free(file);
+            char** bigger = (char**)arena_alloc(request->arena, sizeof(char*) * size * 2);
+            if(bigger != NULL)
+                memcpy(bigger, list, sizeof(char*) * count);
+            list = bigger;
+            size *= 2;
+            if(list == NULL)
+                break;
+        }
+
+        if((list[count] = arena_strdup(request->arena, entry->d_name)) == NULL)
+            list = NULL;
+        else
+            count++;
+    }
+    closedir(dir);
+
+    if(list == NULL)
+        return -1;
+    qsort(list, count, sizeof(char*), compare_names);
+    *names = list;
+    return count;
+}
+
+
+/* stat of a directory with what its' listing shows folded in: the newest ctime of the directory and of its' entries and the sum
+   of their sizes. the mtime is the newest mtime or ctime, every change of a row (even a date set back) moves it, so the ETag and
+   Last-Modified built from it change with the listing. the path ends with '/'. returns 0, -1 on failure */
+int listing_stat(const char* path, struct stat* st)
+{
+    struct stat dirStat;
+    if(stat(path, &dirStat) < 0)
+        return -1;
+    *st = dirStat;
+    st->st_size = 0;
+    listing_fold(st, &dirStat);
+
+    DIR* dir = opendir(path);
+    if(dir == NULL)
+        return -1;
+
+    size_t path_len = strlen(path);
+    char file[HTTP_MAX_URI + NAME_MAX + 2];
+    struct dirent* entry;
+    while((entry = readdir(dir)) != NULL)
+    {
+        struct stat entryStat;
+        if(path_len + strlen(entry->d_name) >= sizeof(file))
+            continue;
+        snprintf(file, sizeof(file), "%s%s", path, entry->d_name);
+        if(stat(file, &entryStat) == 0)
+            listing_fold(st, &entryStat);
+    }
+    closedir(dir);
+    return 0;
+}
+
+
+/* folds the stat of a row of a listing (or of the directory itself) into the stat of the listing: the newest mtime and ctime,
+   the newest of them as mtime and the sum of the sizes */
+void listing_fold(struct stat* st, const struct stat* entry)
+{
+    if(entry->st_mtim.tv_sec > st->st_mtim.tv_sec || (entry->st_mtim.tv_sec == st->st_mtim.tv_sec && entry->st_mtim.tv_nsec > st->st_mtim.tv_nsec))
+        st->st_mtim = entry->st_mtim;
+    if(entry->st_ctim.tv_sec > st->st_ctim.tv_sec || (entry->st_ctim.tv_sec == st->st_ctim.tv_sec && entry->st_ctim.tv_nsec > st->st_ctim.tv_nsec))
+        st->st_ctim = entry->st_ctim;
+    if(st->st_ctim.tv_sec > st->st_mtim.tv_sec || (st->st_ctim.tv_sec == st->st_mtim.tv_sec && st->st_ctim.tv_nsec > st->st_mtim.tv_nsec))
+        st->st_mtim = st->st_ctim;
+    st->st_size += entry->st_size;
+}
+
+
+/* the order of alphasort, for qsort of an array of names */
+int compare_names(const void* a, const void* b)
+{
+    return strcoll(*(char* const*)a, *(char* const*)b);
+}
+
+
+/* return the file content */
+int file_content(request_t* request, int fd)
+{
+    /* get current time */    
+    if(get_timebuff(request, TIME_NOW, fd) == FAILED)
+        return FAILED;
+
+    /* a precompressed sibling the client accepts takes the place of the file, a small text file may be compressed here */
+    int compress = negotiate_encoding(request);
+
+    /* the client's copy is still good, the metadata is from when the path was resolved so the file isn't opened */
+    if(not_modified(request))
+        return not_modified_response(request, fd);
+
+    if(compress)
+        return gzip_file_content(request, fd);
+
+    /* small hot files are answered from memory without touching the file system, a Range request gets only the parts it asked for */
+    byte_range_t ranges[MAX_RANGES];
+    int count;
+    char key[KEY_SIZE];
+    variant_key(request, key, sizeof(key));
+    cache_entry_t* entry = cache_lookup(file_cache, key);
+    if(entry != NULL)
+    {
+        struct stat cached;
+        bzero(&cached, sizeof(cached));
+        cached.st_size = entry->size;
+        cached.st_mtim = entry->mtime;
+        cached.st_ino = entry->ino;
+
+        int check;
+        if((count = parse_range(request, &cached, ranges)) != 0)
+            check = range_content(request, fd, -1, entry->body, &cached, ranges, count);
+        else
+            check = send_cached(request, fd, entry);
+        cache_release(file_cache, entry);
+        return check;
+    }
+
+    /* open file to get data, its' size is taken from the open file so it can't change under us. a file the file cache takes is
+       read once, a bigger one keeps its' descriptor open in the fd cache and the next request sends it without opening it */
+    fd_cache_t* fds = (file_cache != NULL && (size_t)request->st.st_size <= file_cache->max_entry) ? NULL : fd_cache;
+    unsigned long generation = cache_generation(file_cache);
+    fd_entry_t uncached;
+    fd_entry_t* file = fd_cache_open(fds, request->path, &uncached);
+    if(file == NULL)
+    {
+        server_error(fd, request);
+        return FAILED;
+    }
+    int file_fd = file->fd;
+    struct stat fileStat = file->st;
+
+    /* the header lines that only depend on the file (type, length, modified time) */
+    char header[HEADER_SIZE];
+    int header_len = file_header(header, sizeof(header), request, &fileStat);
+
+    /* file is small enough to be cached, read it once and answer from the cache */
+    if(file_cache != NULL && (size_t)fileStat.st_size <= file_cache->max_entry)
+    {
+        char* body = read_file(file_fd, fileStat.st_size);
+        if(body != NULL)
+        {
+            entry = cache_insert(file_cache, key, header, header_len, body, fileStat.st_size, &fileStat, generation);
+            bufpool_put(body);
+            if(entry != NULL)
+            {
+                fd_cache_release(fds, file);
+                int check;
+                if((count = parse_range(request, &fileStat, ranges)) != 0)
+                    check = range_content(request, fd, -1, entry->body, &fileStat, ranges, count);
+                else
+                    check = send_cached(request, fd, entry);
+                cache_release(file_cache, entry);
+                return check;
+            }
+        }
+    }
+
+    /* the parts of the file go through the same zero copy path as the whole file */
+    if((count = parse_range(request, &fileStat, ranges)) != 0)
+    {
+        int check = range_content(request, fd, file_fd, NULL, &fileStat, ranges, count);
+        fd_cache_release(fds, file);
+        return check;
+    }
+
+    const char* connection = connection_header(request);
+
+    /* the header and the file, the body goes from the page cache to the socket without passing through user space */
+    response_t response;
+    response_init(&response);
+    response_printf(&response, "HTTP/1.0 200 OK\r\nServer: webserver/1.0\r\nDate: %s\r\n", request->time_now);
+    response_add(&response, header, header_len);
+    response_add(&response, connection, strlen(connection));
+    response_add(&response, "\r\n", 2);
+    response_add_file(&response, file_fd, 0, fileStat.st_size);
+
+    int check_send = response_send(&response, fd);
+    response_free(&response);
+    fd_cache_release(fds, file);
+
+    /* the header was already sent so a 500 response can't follow, the connection must be closed */
+    if(check_send == FAILED)
+    {
+        request->keep_alive = FALSE;
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+
+/* reads the Range header (and If-Range) of the request, returns the number of ranges to send, 0 to send the whole file, -1 if none of them is in the file */
+int parse_range(request_t* request, struct stat* fileStat, byte_range_t* ranges)
+{
+    http_request_t* http = request->http;
+    http_span_t value;
+    if(http == NULL || http_find_header(http, request->read_buff, "Range", &value) == FAILED)
+        return 0;
+
+    /* with If-Range the ranges are only sent if the client has this version of the file (its' strong ETag or its' date), else it gets all of it */
+    http_span_t if_range;
+    if(http_find_header(http, request->read_buff, "If-Range", &if_range) == SUCCESS)
+    {
+        char validator[ETAG_SIZE];
+        const char* given = request->read_buff + if_range.off;
+        if(if_range.len >= 2 && (given[0] == '"' || (given[0] == 'W' && given[1] == '/')))
+        {
+            make_etag(validator, fileStat);
+            if(!etag_matches(given, if_range.len, validator, FALSE))
+                return 0;
+        }
+        else
+        {
+            struct tm tm_mod;
+            strftime(validator, sizeof(validator), RFC1123FMT, gmtime_r(&fileStat->st_mtime, &tm_mod));
+            if(!http_span_is(request->read_buff, if_range, validator))
+                return 0;
+        }
+    }
+
+    /* "bytes=" and a list of "first-last", "first-" or "-suffix", a header we don't understand is ignored */
+    const char* p = request->read_buff + value.off;
+    const char* end = p + value.len;
+    if(value.len < 6 || strncasecmp(p, "bytes=", 6) != 0)
+        return 0;
+    p += 6;
+
+    long long size = fileStat->st_size;
+    int specs = 0;
+    int count = 0;
+    while(p < end)
+    {
+        while(p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++;
+        if(p == end)
+            break;
+
+        /* so many ranges aren't a media player seeking, the whole file is cheaper */
+        if(++specs > MAX_RANGES)
+            return 0;
+
+        long long first = -1;
+        long long last = -1;
+        if(*p != '-' && read_number(&p, end, &first) == FAILED)
+            return 0;
+        if(p == end || *p != '-')
+            return 0;
+        p++;
+        if(p < end && *p >= '0' && *p <= '9' && read_number(&p, end, &last) == FAILED)
+            return 0;
+        while(p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        if(p < end && *p != ',')
+            return 0;
+
+        /* "-suffix" is the last suffix bytes */
+        if(first < 0)
+        {
+            if(last < 0)
+                return 0;
+            if(last == 0 || size == 0)
+                continue;
+            first = (last < size) ? size - last : 0;
+            last = size - 1;
+        }
+        else
+        {
+            if(last >= 0 && last < first)
+                return 0;
+            if(first >= size)
+                continue;
+            if(last < 0 || last >= size)
+                last = size - 1;
+        }
+
+        ranges[count].first = first;
+        ranges[count].last = last;
+        count++;
+    }
+
+    if(specs == 0)
+        return 0;
+    return (count > 0) ? count : -1;
+}
+
+
+/* reads a number of up to 18 digits at *p and moves *p after it */
+int read_number(const char** p, const char* end, long long* num)
+{
+    const char* start = *p;
+    *num = 0;
+    while(*p < end && **p >= '0' && **p <= '9')
+    {
+        if(*p - start == 18)
             return FAILED;
+        *num = *num * 10 + (**p - '0');
+        (*p)++;
+    }
+    return (*p > start) ? SUCCESS : FAILED;
+}
+
+
+/* sends the ranges of the file with 206, one range as it is and more as multipart/byteranges, from body (cached) or from file_fd. -1 ranges is 416 */
+int range_content(request_t* request, int fd, int file_fd, const char* body, struct stat* fileStat, byte_range_t* ranges, int count)
+{
+    if(count < 0)
+    {
+        request->st = *fileStat;
+        return error_response(request, RANGE_NOT_SATISFIABLE, fd);
+    }
+
+    char last_modified[DATE_SIZE];
+    struct tm tm_mod;
+    strftime(last_modified, sizeof(last_modified), RFC1123FMT, gmtime_r(&fileStat->st_mtime, &tm_mod));
+    char etag[ETAG_SIZE];
+    make_etag(etag, fileStat);
+    char* mime = content_type(request);
+    long long size = fileStat->st_size;
+
+    /* the type and length of the response, with more than one range the body is the parts with their own headers */
+    char content[HEADER_SIZE];
+    char boundary[BOUNDARY_SIZE];
+    char part[HEADER_SIZE];
+    long long length = 0;
+    int i;
+    if(count == 1)
+    {
+        length = ranges[0].last - ranges[0].first + 1;
+        snprintf(content, sizeof(content), "%s%s%sContent-Range: bytes %lld-%lld/%lld\r\n", mime ? "Content-Type: " : "", mime ? mime : "", mime ? "\r\n" : "",
+                 (long long)ranges[0].first, (long long)ranges[0].last, size);
+    }
+    else
+    {
+        /* the boundary only has to be absent from the parts, the file's inode and modified time make it unlikely enough */
+        snprintf(boundary, sizeof(boundary), "%llx%llx", (unsigned long long)fileStat->st_ino, (unsigned long long)fileStat->st_mtime);
+        for(i = 0; i < count; i++)
+            length += part_header(part, sizeof(part), boundary, mime, &ranges[i], size) + ranges[i].last - ranges[i].first + 1;
+        length += strlen("\r\n--") + strlen(boundary) + strlen("--\r\n");
+        snprintf(content, sizeof(content), "Content-Type: multipart/byteranges; boundary=%s\r\n", boundary);
+    }
+
+    /* the ranges of a precompressed sibling are ranges of its' compressed bytes */
+    char encoding[HEADER_SIZE] = "";
+    if(request->encoding != ENCODING_IDENTITY)
+        snprintf(encoding, sizeof(encoding), "Content-Encoding: %s\r\n", encoding_name(request->encoding));
+
+    response_t response;
+    response_init(&response);
+    response_printf(&response, "HTTP/1.0 206 Partial Content\r\nServer: webserver/1.0\r\nDate: %s\r\n%s%sContent-Length: %lld\r\nETag: %s\r\nLast-Modified: %s\r\nAccept-Ranges: bytes\r\nVary: Accept-Encoding\r\n%s\r\n",
+                    request->time_now, content, encoding, length, etag, last_modified, connection_header(request));
+
+    /* the parts of a cached file are sent from the cache with the headers in one write, the parts of a file on disk with sendfile */
+    for(i = 0; i < count; i++)
+    {
+        if(count > 1)
+        {
+            part_header(part, sizeof(part), boundary, mime, &ranges[i], size);
+            response_printf(&response, "%s", part);
         }
 
-        /* get last modified time */
-        char file_last_modified[128];
-        strftime(file_last_modified, sizeof(file_last_modified), RFC1123FMT, gmtime(&fileStat.st_mtime));
+        off_t range_len = ranges[i].last - ranges[i].first + 1;
+        if(body != NULL)
+            response_add(&response, body + ranges[i].first, range_len);
+        else
+            response_add_file(&response, file_fd, ranges[i].first, range_len);
+    }
+    if(count > 1)
+        response_printf(&response, "\r\n--%s--\r\n", boundary);
+
+    int check = response_send(&response, fd);
+    response_free(&response);
+
+    /* the header was already sent so a 500 response can't follow, the connection must be closed */
+    if(check == FAILED)
+    {
+        request->keep_alive = FALSE;
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+
+/* writes the boundary and headers of one part of a multipart/byteranges body, returns their length */
+int part_header(char* buff, size_t size, const char* boundary, const char* mime, byte_range_t* range, off_t total)
+{
+    return snprintf(buff, size, "\r\n--%s\r\n%s%s%sContent-Range: bytes %lld-%lld/%lld\r\n\r\n", boundary,
+                    mime ? "Content-Type: " : "", mime ? mime : "", mime ? "\r\n" : "",
+                    (long long)range->first, (long long)range->last, (long long)total);
+}
+
+
+/* checks If-None-Match, or If-Modified-Since without it, against the metadata of the resolved path, returns TRUE if the client's copy is current */
+int not_modified(request_t* request)
+{
+    http_request_t* http = request->http;
+    http_span_t value;
+    if(http == NULL)
+        return FALSE;
+
+    /* the ETag sees a change within the same second, so when the client sent one the date isn't looked at (RFC 7232 3.3) */
+    if(http_find_header(http, request->read_buff, "If-None-Match", &value) == SUCCESS)
+        return etag_matches(request->read_buff + value.off, value.len, request->etag, TRUE);
+
+    if(http_find_header(http, request->read_buff, "If-Modified-Since", &value) == FAILED)
+        return FALSE;
+
+    /* a date we can't read, or one in the future, is ignored (RFC 7232 3.3) */
+    time_t since;
+    if(parse_http_date(request->read_buff + value.off, value.len, &since) == FAILED || since > time(NULL))
+        return FALSE;
+
+    return (request->st.st_mtime <= since) ? TRUE : FALSE;
+}
+
+
+/* writes the strong ETag of a file or directory to etag (ETAG_SIZE bytes): its' inode, size and modified time in ns, so no content is read, returns its' length */
+int make_etag(char* etag, const struct stat* st)
+{
+    unsigned long long mtime = (unsigned long long)st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec;
+    return snprintf(etag, ETAG_SIZE, "\"%llx-%llx-%llx\"", (unsigned long long)st->st_ino, (unsigned long long)st->st_size, mtime);
+}
+
+
+/* looks for etag in a list of entity tags ("*" matches any), weak tags (W/"...") only match if weak is TRUE, returns TRUE if it is there */
+int etag_matches(const char* value, int len, const char* etag, int weak)
+{
+    const char* p = value;
+    const char* end = value + len;
+    size_t etag_len = strlen(etag);
+    while(p < end)
+    {
+        while(p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++;
+        if(p == end)
+            break;
+        if(*p == '*')
+            return TRUE;
+
+        int is_weak = FALSE;
+        if(end - p >= 2 && p[0] == 'W' && p[1] == '/')
+        {
+            is_weak = TRUE;
+            p += 2;
+        }
+
+        /* not a list of entity tags, nothing in it matches */
+        if(p == end || *p != '"')
+            return FALSE;
+        const char* tag = p;
+        p = memchr(p + 1, '"', end - p - 1);
+        if(p == NULL)
+            return FALSE;
+        p++;
+
+        if((weak || !is_weak) && (size_t)(p - tag) == etag_len && memcmp(tag, etag, etag_len) == 0)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+
+/* reads a date in any of the formats of RFC 7231 7.1.1.1 (RFC 1123, RFC 850 and asctime), returns FAILED if it isn't one */
+int parse_http_date(const char* value, int len, time_t* date)
+{
+    const char* formats[] = { RFC1123FMT, "%A, %d-%b-%y %H:%M:%S GMT", "%a %b %e %H:%M:%S %Y" };
+    char copy[DATE_SIZE * 2];
+    if(len <= 0 || len >= (int)sizeof(copy))
+        return FAILED;
+    memcpy(copy, value, len);
+    copy[len] = '\0';
+
+    int i;
+    for(i = 0; i < (int)(sizeof(formats) / sizeof(formats[0])); i++)
+    {
+        struct tm tm;
+        bzero(&tm, sizeof(tm));
+        char* end = strptime(copy, formats[i], &tm);
+        if(end != NULL && *end == '\0')
+        {
+            *date = timegm(&tm);
+            return SUCCESS;
+        }
+    }
+    return FAILED;
+}
+
+
+/* 304 Not Modified: the headers the full response would have had that matter to a cache, and no body */
+int not_modified_response(request_t* request, int fd)
+{
+    char last_modified[DATE_SIZE];
+    struct tm tm_mod;
+    strftime(last_modified, sizeof(last_modified), RFC1123FMT, gmtime_r(&request->st.st_mtime, &tm_mod));
+
+    char header[HEADER_SIZE];
+    int header_len = snprintf(header, sizeof(header), "HTTP/1.0 304 Not Modified\r\nServer: webserver/1.0\r\nDate: %s\r\nETag: %s\r\nLast-Modified: %s\r\nVary: Accept-Encoding\r\n%s\r\n",
+                              request->time_now, request->etag, last_modified, connection_header(request));
+
+    if(write_all(fd, header, header_len) == FAILED)
+    {
+        request->keep_alive = FALSE;
+        return FAILED;
+    }
+    return SUCCESS;
+}
+
+
+/* reads Accept-Encoding, returns the bits of the codings we have that the client takes */
+int accepted_encodings(request_t* request)
+{
+    http_request_t* http = request->http;
+    http_span_t value;
+    if(http == NULL || http_find_header(http, request->read_buff, "Accept-Encoding", &value) == FAILED)
+        return ENCODING_IDENTITY;
+
+    /* "gzip, deflate, br;q=0.9, *;q=0", "*" stands for the codings that aren't named and q=0 refuses a coding */
+    const char* p = request->read_buff + value.off;
+    const char* end = p + value.len;
+    int accepted = 0;
+    int refused = 0;
+    int named = 0;
+    int star = 0;
+    while(p < end)
+    {
+        while(p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++;
+        const char* coding = p;
+        while(p < end && *p != ',' && *p != ';' && *p != ' ' && *p != '\t')
+            p++;
+        size_t len = p - coding;
+
+        int zero = FALSE;
+        while(p < end && *p != ',')
+        {
+            if(*p++ != ';')
+                continue;
+            while(p < end && (*p == ' ' || *p == '\t'))
+                p++;
+            if(end - p >= 2 && (*p == 'q' || *p == 'Q') && p[1] == '=')
+            {
+                p += 2;
+                zero = (p < end && *p == '0');
+                while(p < end && (*p == '0' || *p == '.'))
+                    p++;
+                if(p < end && *p >= '1' && *p <= '9')
+                    zero = FALSE;
+            }
+        }
+
+        int bit = 0;
+        if((len == 4 && strncasecmp(coding, "gzip", 4) == 0) || (len == 6 && strncasecmp(coding, "x-gzip", 6) == 0))
+            bit = ENCODING_GZIP;
+        else if(len == 2 && strncasecmp(coding, "br", 2) == 0)
+            bit = ENCODING_BR;
+        else if(len == 1 && *coding == '*')
+        {
+            star = zero ? 0 : (ENCODING_GZIP | ENCODING_BR);
+            continue;
+        }
+
+        named |= bit;
+        if(zero)
+            refused |= bit;
+        else
+            accepted |= bit;
+    }
+    return (accepted & ~refused) | (star & ~named);
+}
+
+
+/* picks the representation of a file: a precompressed sibling (br, then gzip) if the client takes it, returns TRUE if the file should be gzipped here instead */
+int negotiate_encoding(request_t* request)
+{
+    /* images and media are compressed already, no sibling is looked for */
+    int accepted = accepted_encodings(request);
+    if(accepted == ENCODING_IDENTITY || !compressible(request->path))
+        return FALSE;
+
+    if((accepted & ENCODING_BR) && use_sibling(request, ".br", ENCODING_BR) == SUCCESS)
+        return FALSE;
+    if((accepted & ENCODING_GZIP) && use_sibling(request, ".gz", ENCODING_GZIP) == SUCCESS)
+        return FALSE;
+
+    /* compressed once and then sent from the file cache, a file the cache can't hold is sent as it is (zero copy) */
+    if(!(accepted & ENCODING_GZIP) || server_config.gzip_level == 0 || file_cache == NULL)
+        return FALSE;
+    if((size_t)request->st.st_size < server_config.gzip_min || (size_t)request->st.st_size > file_cache->max_entry)
+        return FALSE;
+
+    request->encoding = ENCODING_GZIP;
+    variant_etag(request->etag, encoding_name(ENCODING_GZIP));
+    return TRUE;
+}
+
+
+/* looks for the file with ext (".gz", ".br") after its' name that is at least as new as the file and makes it the file that is sent, returns FAILED if there is none */
+int use_sibling(request_t* request, const char* ext, int encoding)
+{
+    char* sibling = arena_printf(request->arena, "%s%s", request->path, ext);
+    if(sibling == NULL)
+        return FAILED;
+
+    /* the verdict is kept in the path cache under a key no request path can have (the parser doesn't take a '\t' in a path) */
+    char key[KEY_SIZE];
+    snprintf(key, sizeof(key), "%s\t%s", request->path, ext);
+
+    int type;
+    struct stat st;
+    char etag[ETAG_SIZE];
+    meta_result_t meta;
+    if(meta_lookup(key, &meta, request->arena) == SUCCESS)
+    {
+        type = meta.type;
+        st = meta.st;
+        memcpy(etag, meta.etag, ETAG_SIZE);
+    }
+    else
+    {
+        unsigned long generation = meta_generation();
+        bzero(&st, sizeof(st));
+        type = (stat(sibling, &st) == 0 && S_ISREG(st.st_mode) && (st.st_mode & S_IROTH)) ? FILE_CONTENT : NOT_FOUND;
+        make_etag(etag, &st);
+        meta_insert(key, type, NULL, &st, etag, generation);
+    }
+
+    /* a sibling that is older than the file was left behind by an older version of it */
+    if(type != FILE_CONTENT || st.st_mtim.tv_sec < request->st.st_mtim.tv_sec ||
+       (st.st_mtim.tv_sec == request->st.st_mtim.tv_sec && st.st_mtim.tv_nsec < request->st.st_mtim.tv_nsec))
+        return FAILED;
+
+    /* the response has the type of the file and the coding of the sibling */
+    request->mime = get_mime_type(request->path);
+    request->path = sibling;
+    request->st = st;
+    memcpy(request->etag, etag, ETAG_SIZE);
+    request->encoding = encoding;
+    return SUCCESS;
+}
+
+
+/* returns TRUE if the file is text that is worth compressing */
+int compressible(const char* path)
+{
+    const char* types[] = { ".html", ".htm", ".css", ".js", ".json", ".xml", ".svg", ".txt", ".md", ".csv" };
+    const char* ext = strrchr(path, '.');
+    if(ext == NULL)
+        return FALSE;
+
+    int i;
+    for(i = 0; i < (int)(sizeof(types) / sizeof(types[0])); i++)
+    {
+        if(strcmp(ext, types[i]) == 0)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+
+/* name of a content coding as it is in Content-Encoding */
+const char* encoding_name(int encoding)
+{
+    if(encoding == ENCODING_GZIP)
+        return "gzip";
+    if(encoding == ENCODING_BR)
+        return "br";
+    return "identity";
+}
+
+
+/* cache key of the representation that is sent, the path itself, or the path, a '\t' and the name of the coding */
+const char* variant_key(request_t* request, char* key, size_t size)
+{
+    if(request->encoding == ENCODING_IDENTITY)
+        snprintf(key, size, "%s", request->path);
+    else
+        snprintf(key, size, "%s\t%s", request->path, encoding_name(request->encoding));
+    return key;
+}
+
+
+/* adds "-name" to the end of an ETag, the representation compressed here has its' own ETag */
+void variant_etag(char* etag, const char* name)
+{
+    size_t len = strlen(etag);
+    if(len < 2)
+        return;
+    snprintf(etag + len - 1, ETAG_SIZE - (len - 1), "-%s\"", name);
+}
+
+
+/* type of the response, the one of the file when a compressed sibling is sent */
+char* content_type(request_t* request)
+{
+    if(request->mime != NULL)
+        return request->mime;
+    return get_mime_type(request->path);
+}
+
+
+/* compresses len bytes with gzip at the configured level, returns the compressed bytes (a buffer of the pool the caller puts back) and their length in gzip_len, NULL on failure */
+char* gzip_body(const char* body, size_t len, size_t* gzip_len)
+{
+    /* 16 more window bits ask for the gzip header and trailer around the deflate stream */
+    z_stream stream;
+    bzero(&stream, sizeof(stream));
+    if(deflateInit2(&stream, server_config.gzip_level, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return NULL;
+
+    size_t bound = deflateBound(&stream, len);
+    char* gzip = (char*)bufpool_get(bound);
+    if(gzip == NULL)
+    {
+        deflateEnd(&stream);
+        return NULL;
+    }
+
+    stream.next_in = (Bytef*)body;
+    stream.avail_in = len;
+    stream.next_out = (Bytef*)gzip;
+    stream.avail_out = bound;
+    int check = deflate(&stream, Z_FINISH);
+    *gzip_len = stream.total_out;
+    deflateEnd(&stream);
+
+    if(check != Z_STREAM_END)
+    {
+        bufpool_put(gzip);
+        return NULL;
+    }
+    return gzip;
+}
+
+
+/* writes the header lines of one representation (type, coding, length, ETag, modified time and Vary), returns their length */
+int variant_header(char* header, size_t size, const char* mime, int encoding, size_t length, const char* etag, time_t mtime)
+{
+    char last_modified[DATE_SIZE];
+    struct tm tm_mod;
+    strftime(last_modified, sizeof(last_modified), RFC1123FMT, gmtime_r(&mtime, &tm_mod));
+
+    int header_len = 0;
+    if(mime != NULL)
+        header_len += snprintf(header + header_len, size - header_len, "Content-Type: %s\r\n", mime);
+    if(encoding != ENCODING_IDENTITY)
+        header_len += snprintf(header + header_len, size - header_len, "Content-Encoding: %s\r\n", encoding_name(encoding));
+    header_len += snprintf(header + header_len, size - header_len, "Content-Length: %lld\r\nETag: %s\r\nLast-Modified: %s\r\nVary: Accept-Encoding\r\n",
+                           (long long)length, etag, last_modified);
+    return header_len;
+}
 
-        size_b_body += strlen("<tr>") + strlen("\r\n");
-        size_b_body += strlen("<td><A HREF=\"") + strlen(file) + strlen("\">") + strlen("</A>") + strlen(namelist[i]->d_name) + strlen("</td>");
-        size_b_body += strlen("<td>") + strlen(file_last_modified) + strlen("</td>");
-        size_b_body += strlen("<td>") + count_digits(fileStat.st_size) + strlen("</td>");
-        size_b_body += strlen("</tr>") + strlen("\r\n") + 10;
 
-        free(file);
-        i++;
+/* sends a text file gzipped, it is compressed once and its' compressed bytes are answered from the file cache until it changes (no ranges of it) */
+int gzip_file_content(request_t* request, int fd)
+{
+    char key[KEY_SIZE];
+    variant_key(request, key, sizeof(key));
+    cache_entry_t* entry = cache_lookup(file_cache, key);
+    if(entry != NULL)
+    {
+        int check = send_cached(request, fd, entry);
+        cache_release(file_cache, entry);
+        return check;
     }
-    char* title = (char*)malloc(sizeof(char)*(strlen(request->path) + strlen("Index of ") + 1));
-    if(title == NULL)
+
+    unsigned long generation = cache_generation(file_cache);
+    int file_fd;
+    if((file_fd = open(request->path, O_RDONLY)) < 0)
     {
         server_error(fd, request);
         return FAILED;
     }
-    bzero(title, sizeof(char)*(strlen(request->path) + strlen("Index of ") + 1));
-    sprintf(title, "Index of %s", request->path);
 
-    char* body = (char*)malloc(sizeof(char)*(size_b_body + 1));
+    struct stat fileStat;
+    char* body = NULL;
+    if(fstat(file_fd, &fileStat) == 0)
+        body = read_file(file_fd, fileStat.st_size);
+    close(file_fd);
     if(body == NULL)
     {
         server_error(fd, request);
-        free(title);
         return FAILED;
     }
-    bzero(body, sizeof(char)*(size_b_body + 1));
-    sprintf(body, "<table CELLSPACING=8>\r\n<tr><th>Name</th><th>Last Modified</th><th>Size</th></tr>\r\n");
 
-    i = 0;
-    while(i < num)
+    size_t gzip_len;
+    char* gzip = gzip_body(body, fileStat.st_size, &gzip_len);
+    bufpool_put(body);
+    if(gzip == NULL)
     {
-        char* file = (char*)malloc(sizeof(char)*(strlen(request->path) + strlen(namelist[i]->d_name) + 1));
-        if(file == NULL)
-        {
-            server_error(fd, request);
-            free(body);
-            free(title);
-            return FAILED;
-        }
-        bzero(file, sizeof(char)*(strlen(request->path) + strlen(namelist[i]->d_name) + 1));
-        sprintf(file, "%s%s", request->path, namelist[i]->d_name);
+        server_error(fd, request);
+        return FAILED;
+    }
 
-        struct stat fileStat;
-        if(stat(file, &fileStat) < 0)
-        {
-            server_error(fd, request);
-            free(file);
-            free(body);
-            free(title);
-            while(namelist[i])
-                free(namelist[i++]);
-            free(namelist);
-            return FAILED;
-        }
+    /* the ETag is of what was read, the file may have changed since the path was resolved */
+    char etag[ETAG_SIZE];
+    make_etag(etag, &fileStat);
+    variant_etag(etag, encoding_name(ENCODING_GZIP));
 
-        /* get last modified time */
-        char file_last_modified[128];
-        strftime(file_last_modified, sizeof(file_last_modified), RFC1123FMT, gmtime(&fileStat.st_mtime));
+    char header[HEADER_SIZE];
+    int header_len = variant_header(header, sizeof(header), content_type(request), ENCODING_GZIP, gzip_len, etag, fileStat.st_mtime);
 
-        if(S_ISDIR(fileStat.st_mode))
-            sprintf(body + strlen(body), "<tr>\r\n<td><A HREF=\"%s/\">%s</A></td><td>%s</td>\r\n<td></td>\r\n</tr>\r\n", namelist[i]->d_name, namelist[i]->d_name, file_last_modified);
-        
-        else
-            sprintf(body + strlen(body), "<tr>\r\n<td><A HREF=\"%s\">%s</A></td><td>%s</td>\r\n<td>%d</td>\r\n</tr>\r\n", namelist[i]->d_name, namelist[i]->d_name, file_last_modified, (int)fileStat.st_size);
+    int check = cache_and_send(request, fd, file_cache, key, header, header_len, gzip, gzip_len, &fileStat, generation);
+    bufpool_put(gzip);
+    return check;
+}
 
-        free(namelist[i]);
-        free(file);
-        i++;
-    }
-    sprintf(body + strlen(body), "</table>\r\n<HR>\r\n<ADDRESS>webserver/1.0</ADDRESS>");
-    free(namelist);
 
-    size_b += size_b_body + size_b_title;
-    body_response = (char*)malloc(sizeof(char)*(size_b + 1));
-    if(body_response == NULL)
+/* keeps a rendered response in the cache and sends it from there, or from here if it can't be cached (the body stays the caller's) */
+int cache_and_send(request_t* request, int fd, cache_t* cache, const char* key, const char* header, int header_len, const char* body, size_t body_len, const struct stat* st, unsigned long generation)
+{
+    cache_entry_t* entry = cache_insert(cache, key, header, header_len, body, body_len, st, generation);
+    if(entry != NULL)
     {
-        server_error(fd, request);
-        free(body);
-        free(title);
-        return FAILED;
+        int check = send_cached(request, fd, entry);
+        cache_release(cache, entry);
+        return check;
     }
-    bzero(body_response, sizeof(char)*(size_b + 1));
 
+    /* the cache is disabled or the response is too big for it */
+    cache_entry_t response;
+    bzero(&response, sizeof(response));
+    response.header = (char*)header;
+    response.header_len = header_len;
+    response.body = (char*)body;
+    response.body_len = body_len;
+    return send_cached(request, fd, &response);
+}
 
-    sprintf(body_response, "<HTML><HEAD><TITLE>%s</TITLE></HEAD>\r\n<BODY><H4>%s</H4>\r\n%s\r\n</BODY></HTML>", title, title, body);
 
-    int check;
-    check = get_timebuff(request, TIME_NOW, fd);
-    if(check == FAILED)
-        return FAILED;
+/* writes the header lines of a file response that don't change between requests, returns their length */
+int file_header(char* header, size_t size, request_t* request, struct stat* fileStat)
+{
+    char etag[ETAG_SIZE];
+    make_etag(etag, fileStat);
 
-    check = get_timebuff(request, TIME_MOD, fd);
-    if(check == FAILED)
-        return FAILED;
+    int header_len = variant_header(header, size, content_type(request), request->encoding, fileStat->st_size, etag, fileStat->st_mtime);
+    return header_len + snprintf(header + header_len, size - header_len, "Accept-Ranges: bytes\r\n");
+}
 
-    char* header;
-    size_h += strlen("HTTP/1.0 200 OK") + strlen("\r\n");
-    size_h += strlen("Server: webserver/1.0") + strlen("\r\n");
-    size_h += strlen("Date: ") + strlen(request->time_now) + strlen("\r\n");
-    size_h += strlen("Content-Type: ") + strlen("text/html") + strlen("\r\n");
-    size_h += strlen("Content-Length: ") + strlen(body) + strlen("\r\n");
-    size_h += strlen("Last-Modified: ") + strlen(request->time_mod) + strlen("\r\n");
-    size_h += strlen("Connection: close") + strlen("\r\n\r\n");
 
-    header = (char*)malloc(sizeof(char)*(size_h + 1));
-    if(header == NULL)
+/* sends a cached response, only the status line, date and connection headers are made for this request */
+int send_cached(request_t* request, int fd, cache_entry_t* entry)
+{
+    const char* connection = connection_header(request);
+
+    response_t response;
+    response_init(&response);
+    response_printf(&response, "HTTP/1.0 200 OK\r\nServer: webserver/1.0\r\nDate: %s\r\n", request->time_now);
+    response_add(&response, entry->header, entry->header_len);
+    response_add(&response, connection, strlen(connection));
+    response_add(&response, "\r\n", 2);
+    response_add(&response, entry->body, entry->body_len);
+
+    int check = response_send(&response, fd);
+    response_free(&response);
+    if(check == FAILED)
     {
-        server_error(fd, request);
-        free(body);
-        free(title);
-        free(body_response);
+        request->keep_alive = FALSE;
         return FAILED;
     }
+    return SUCCESS;
+}
 
-    sprintf(header, "HTTP/1.0 200 OK\r\nServer: webserver/1.0\r\nDate: %s\r\nContent-Type: text/html\r\nContent-Length: %d\r\nLast-Modified: %s\r\nConnection: close\r\n\r\n", request->time_now, (int)strlen(body_response), request->time_mod);
 
-    request->write_buff = (char*)malloc(sizeof(char)*(strlen(header) + strlen(body_response) + 1));
-    if(request->write_buff == NULL)
-    {
-        server_error(fd, request);
-        free(body);
-        free(title);
-        free(body_response);
-        return FAILED;
-    }
-    bzero(request->write_buff, sizeof(char)*(strlen(header) + strlen(body_response) + 1));
-    sprintf(request->write_buff, "%s%s", header, body_response);
+/* reads size bytes of an open file into a buffer of the pool (the caller puts it back), returns NULL on failure */
+char* read_file(int file_fd, off_t size)
+{
+    char* body = (char*)bufpool_get(size + 1);
+    if(body == NULL)
+        return NULL;
 
-    free(title);
-    free(body);
-    free(body_response);
-    free(header);
+    off_t done = 0;
+    while(done < size)
+    {
+        ssize_t nbytes = pread(file_fd, body + done, size - done, done);
+        if(nbytes < 0 && errno == EINTR)
+            continue;
 
-    return SUCCESS;
+        /* error, or the file got shorter than its' stat */
+        if(nbytes <= 0)
+        {
+            bufpool_put(body);
+            return NULL;
+        }
+        done += nbytes;
+    }
+    body[size] = '\0';
+    return body;
 }
 
 
-/* return the file content */
-int file_content(request_t* request, int fd)
+/* sends count bytes of the file starting at offset using sendfile, falls back to splice and then to read/write */
+int send_file_body(int fd, int file_fd, off_t offset, off_t count)
 {
-    /* get current time and modified time */    
-    int check;
-    check = get_timebuff(request, TIME_NOW, fd);
-    if(check == FAILED)
-        return FAILED;
+    off_t end = offset + count;
 
-    check = get_timebuff(request, TIME_MOD, fd);
-    if(check == FAILED)
+    /* the responses gathered before this one (and its' header) must be in the socket before the body */
+    if(batch_send() == FAILED)
         return FAILED;
 
-    /* get mime type */
-    char* mime = get_mime_type(request->path);
-    if(mime)
-    {
-        request->mime = (char*)malloc(sizeof(char)*(strlen(mime)+1));
-        bzero(request->mime, (strlen(mime)+1));
-        strcpy(request->mime, mime);
-    }
-
-    int size = response_size(request, OK, fd);
-    request->write_buff = (char*)malloc(sizeof(char)*(size));
-    if(request->write_buff == NULL)
-    {
-        server_error(fd, request);
-        return FAILED;
-    }
-    bzero(request->write_buff, size);
-    
-    /* stat struct for getting the size of the file */
-    struct stat fileStat;
-    if(stat(request->path, &fileStat) < 0)
+    /* 1. sendfile, the offset is ours so the file position isn't used (the fd may be shared) */
+    while(offset < end)
     {
-        server_error(fd, request);
-        return FAILED;
-    }
+        size_t chunk = (end - offset > SENDFILE_CHUNK) ? SENDFILE_CHUNK : (size_t)(end - offset);
+        ssize_t nbytes = sendfile(fd, file_fd, &offset, chunk);
+        if(nbytes > 0)
+            continue;
 
-    sprintf(request->write_buff, "HTTP/1.0 200 OK\r\nServer: webserver/1.0\r\nDate: %s\r\n", request->time_now);
+        /* file got shorter while we were sending it */
+        if(nbytes == 0)
+            return FAILED;
 
-    if(request->mime)
-        sprintf(request->write_buff + strlen(request->write_buff), "Content-Type: %s\r\nContent-Length: %d\r\nLast-Modified: %s\r\nConnection: close\r\n\r\n", request->mime, (int)fileStat.st_size, request->time_mod);
+        if(errno == EINTR)
+            continue;
+        if(errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            if(wait_writable(fd) == FAILED)
+                return FAILED;
+            continue;
+        }
 
-    else
-        sprintf(request->write_buff + strlen(request->write_buff), "Content-Length: %d\r\nLast-Modified: %s\r\nConnection: close\r\n\r\n", (int)fileStat.st_size, request->time_mod);        
+        /* this file system or socket can't do sendfile */
+        if(errno == EINVAL || errno == ENOSYS || errno == EOVERFLOW)
+            break;
 
-    
-    /* write header of response to client */
-    int bytes_write = 0;
-    bytes_write = write(fd, request->write_buff, strlen(request->write_buff));
-    if(bytes_write < 0)
-    {
-        server_error(fd, request);
         return FAILED;
     }
+    if(offset >= end)
+        return SUCCESS;
 
-    /* open file to get data and write it to the client */
-    int file_fd;
-    if((file_fd = open(request->path, O_RDONLY)) < 0)
+    /* 2. splice through a pipe, still zero copy */
+    int check = splice_file_body(fd, file_fd, &offset, end);
+    if(check != NOT_SUPPORTED)
+        return check;
+
+    /* 3. copy through user space */
+    char buffer[COPY_CHUNK];
+    while(offset < end)
     {
-        server_error(fd, request);
-        return FAILED;
+        size_t chunk = (end - offset > COPY_CHUNK) ? COPY_CHUNK : (size_t)(end - offset);
+        ssize_t nbytes = pread(file_fd, buffer, chunk, offset);
+        if(nbytes < 0 && errno == EINTR)
+            continue;
+        if(nbytes <= 0)
+            return FAILED;
+
+        if(write_all(fd, buffer, nbytes) == FAILED)
+            return FAILED;
+        offset += nbytes;
     }
+    return SUCCESS;
+}
+
+
+/* moves the file from *offset to end into the socket through a pipe, returns NOT_SUPPORTED if splice can't be used */
+int splice_file_body(int fd, int file_fd, off_t* offset, off_t end)
+{
+    int pipefd[2];
+    if(pipe(pipefd) < 0)
+        return NOT_SUPPORTED;
 
-    unsigned char buffer[512];
-    bzero(buffer, 512);
-    int bytes_read = 0;
-    bytes_write = 0;
-    while(1)
+    int check = SUCCESS;
+    int first = TRUE;
+    while(*offset < end)
     {
-        bytes_read = read(file_fd, buffer, 512 - 1);
-        /* reached EOF */
-        if(bytes_read == 0)
-            break;
-        if(bytes_read < 0)
+        size_t chunk = (end - *offset > SENDFILE_CHUNK) ? SENDFILE_CHUNK : (size_t)(end - *offset);
+        ssize_t in_pipe = splice(file_fd, offset, pipefd[1], NULL, chunk, SPLICE_F_MOVE);
+        if(in_pipe < 0 && errno == EINTR)
+            continue;
+        if(in_pipe <= 0)
         {
-            server_error(fd, request);
-            return FAILED;
+            check = (first && in_pipe < 0 && errno == EINVAL) ? NOT_SUPPORTED : FAILED;
+            break;
         }
-        else
+        first = FALSE;
+
+        /* drain the pipe into the socket */
+        while(in_pipe > 0)
         {
-            bytes_write = write(fd, buffer, bytes_read);
-            if(bytes_write < 0)
+            ssize_t out = splice(pipefd[0], NULL, fd, NULL, in_pipe, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if(out > 0)
             {
-                server_error(fd, request);
-                return FAILED;
+                in_pipe -= out;
+                continue;
             }
+            if(out < 0 && errno == EINTR)
+                continue;
+            if(out < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && wait_writable(fd) == SUCCESS)
+                continue;
 
+            check = FAILED;
+            break;
         }
-        bzero(buffer, 512);
+        if(check == FAILED)
+            break;
     }
-    close(file_fd);
-    return SUCCESS;
+
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return check;
+}
+
+
+/* TCP_CORK holds partial frames until it is removed, so a header and its' body are sent together */
+void set_cork(int fd, int on)
+{
+    setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
 }
 
 
@@ -868,36 +2309,15 @@ char* get_mime_type(char* name)
 /* if there is error on server side after we established a connection then return Internal Server Error */
 int server_error(int fd, request_t* request)
 {
-    /* get current time */
-    get_timebuff(request, TIME_NOW, fd);
-    
-    /* get size of interal error response, insert error content to write buff */
-    int size = response_size(request, INTERNAL_ERROR, fd);
-    request->write_buff = (char*)malloc(sizeof(char)*(size));
-    if(request->write_buff == NULL)
-    {
-        printf("error on allocating memory\r\n");
-        free_struct(request);
-        close(fd);
-        return FAILED;
-    }
-    bzero(request->write_buff, size);
-    sprintf(request->write_buff, "HTTP/1.0 %s\r\nServer: webserver/1.0\r\nDate: %s\r\nContent-Type: %s\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", "500 Internal Server Error", request->time_now, "text/html", 144);
-    sprintf(request->write_buff + strlen(request->write_buff), "<HTML><HEAD><TITLE>%s</TITLE></HEAD>\r\n<BODY><H4>%s</H4>\r\n%s\r\n</BODY></HTML>", "500 Internal Server Error", "500 Internal Server Error", "Some server side error.");
+    /* we can't trust the state of the connection anymore so it will be closed */
+    request->keep_alive = FALSE;
 
-    /* write error response to client */
-    int nbytes;
-    nbytes = write(fd, request->write_buff, strlen(request->write_buff));
-    if(nbytes < 0)
+    /* write error response to client, the caller frees the struct and closes the socket */
+    if(error_response(request, INTERNAL_ERROR, fd) == FAILED)
     {
         perror("write");
-        free_struct(request);
-        close(fd);
         return FAILED;
     }
-
-    free_struct(request);
-    close(fd);
     return SUCCESS;
 }
 
@@ -906,251 +2326,335 @@ int server_error(int fd, request_t* request)
 int check_permissions(char *path, request_t* request, int fd) 
 {
     struct stat fileStat;
-    char* local_path = (char*)malloc(sizeof(char)*(strlen(path) + 1));
+    char* local_path = arena_strdup(request->arena, path);
     if(local_path == NULL)
-    {
-        server_error(fd, request);
         return FAILED;
-    }
-    strcpy(local_path, path);
-    char* ptr = strtok(local_path, "/");
+    char* save;
+    char* ptr = strtok_r(local_path, "/", &save);
     if(!ptr)
-    {
-        free(local_path);
         return NOT_FOUND;
-    }
     char* curr;
     while (1) 
     {
         /* for checking permissions */
         if(stat(ptr, &fileStat) < 0)
-        {
-            server_error(fd, request);
-            free(ptr);
             return FAILED;
-        }
         
         /* check if it is a directory and has execute permissions */
         if (S_ISDIR(fileStat.st_mode) && !(fileStat.st_mode & S_IXOTH)) 
-        {
-            free(ptr);
             return FAILED;
-        }
-        curr = strtok(NULL, "/");
+        curr = strtok_r(NULL, "/", &save);
         if(!curr)
             break;
         
         sprintf(ptr + strlen(ptr), "/%s", curr);
     }
-    free(ptr);
     return SUCCESS;
 }
 
 
-/* get current time and modified time into request struct */
+/* get current time into request struct, the Last-Modified of a response is made from the metadata of the resolved path */
 int get_timebuff(request_t* request, int flag, int fd)
 {
-    /* get current time */
+    /* get current time, from the shared date string */
     if(flag == TIME_NOW)
-    {
-        time_t now;
-        char timebuf[128];
-        now = time(NULL);
-        strftime(timebuf, sizeof(timebuf), RFC1123FMT, gmtime(&now));
+        current_date(request->time_now);
+    return SUCCESS;
+}
 
-        request->time_now = (char*)malloc(sizeof(char)*(strlen(timebuf) + 1));
-        if(request->time_now == NULL)
-        {
-            server_error(fd, request);
+
+/* checks if a certain string is a number. if it is a number then return 0, else -1 */
+int is_number(char* num)
+{
+    int i;
+    for(i = 0; num[i] != '\0'; i++)
+    {
+        if(num[i] >= '0' && num[i] <= '9')
+            continue;
+        
+        else
             return FAILED;
-        }
-        bzero(request->time_now, sizeof(char)*(strlen(timebuf) + 1));
-        strcpy(request->time_now, timebuf);
     }
-    
-    /* get last modified time */
-    else if(flag == TIME_MOD)
+    return SUCCESS;
+}
+
+
+/* checks the Connection header of the request, HTTP/1.1 is persistent by default and HTTP/1.0 only if the client asks for it */
+int keep_alive_requested(http_request_t* http)
+{
+    /* we don't read request bodies so a request that has one can't be followed by another */
+    if(http->content_length > 0 || http->transfer_encoding)
+        return FALSE;
+
+    if(http->connection & HTTP_CONN_CLOSE)
+        return FALSE;
+    if(http->connection & HTTP_CONN_KEEP_ALIVE)
+        return TRUE;
+
+    return (http->minor == 1) ? TRUE : FALSE;
+}
+
+
+/* the Connection header of the response */
+const char* connection_header(request_t* request)
+{
+    if(request != NULL && request->keep_alive)
+        return server_config.keepalive_header;
+
+    return "Connection: close\r\n";
+}
+
+
+/* write the whole buffer to the client, if the socket is non-blocking wait until it can take more */
+int write_all(int fd, const char* buff, size_t len)
+{
+    return send_all(fd, buff, len, 0);
+}
+
+
+/* same as write_all with flags for send (MSG_MORE when a body follows) */
+int send_all(int fd, const char* buff, size_t len, int flags)
+{
+    /* a response to a pipelined request waits in the batch for the ones after it */
+    struct iovec iov;
+    iov.iov_base = (void*)buff;
+    iov.iov_len = len;
+    int gathered;
+    if(batch_append(fd, &iov, 1, &gathered) == FAILED)
+        return FAILED;
+    if(gathered)
+        return SUCCESS;
+
+    size_t sent = 0;
+    while(sent < len)
     {
-        struct stat fileStat;
-        if(stat(request->path, &fileStat) < 0)
+        ssize_t nbytes = send(fd, buff + sent, len - sent, flags);
+        if(nbytes < 0)
         {
-            server_error(fd, request);
-            return FAILED;
-        }
-        
-        char last_modified[128];
-        strftime(last_modified, sizeof(last_modified), RFC1123FMT, gmtime(&fileStat.st_mtime));
+            if(errno == EINTR)
+                continue;
 
-        request->time_mod = (char*)malloc(sizeof(char)*(strlen(last_modified) + 1));
-        if(request->time_mod == NULL)
-        {
-            server_error(fd, request);
+            /* the socket buffer is full, wait for the client to read (but not forever) */
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if(wait_writable(fd) == FAILED)
+                    return FAILED;
+                continue;
+            }
             return FAILED;
         }
-        bzero(request->time_mod, sizeof(char)*(strlen(last_modified) + 1));
-        strcpy(request->time_mod, last_modified);
+        sent += nbytes;
     }
     return SUCCESS;
 }
 
 
-/* get response size of each response type for client */
-int response_size(request_t* request, int flag, int fd)
+/* sends all the buffers of iov with one sendmsg call when possible, continues after partial writes */
+int send_iov(int fd, struct iovec* iov, int iovcnt, int flags)
 {
-    int check = -1;
-    if(!request->time_now)
-        check = get_timebuff(request, TIME_NOW, fd);
-    
-    if(check == FAILED)
+    int gathered;
+    if(batch_append(fd, iov, iovcnt, &gathered) == FAILED)
         return FAILED;
+    if(gathered)
+        return SUCCESS;
 
-    int size = 0;
-    size += strlen("HTTP/1.0 ") /* status phrase */ + strlen("\r\n");
-    size += strlen("Server: webserver/1.0") + strlen("\r\n");
-    size += strlen("Date: ") + /* current date */ strlen(request->time_now) + strlen("\r\n");
-    size += strlen("Content-Length: ") + /* length of response */ strlen("\r\n");
-    size += strlen("Connection: close") + strlen("\r\n") + strlen("\r\n");
+    struct msghdr msg;
+    bzero(&msg, sizeof(msg));
 
-    if(flag == OK)
+    while(iovcnt > 0)
     {
-        if(!request->time_mod)
-            check = get_timebuff(request, TIME_MOD, fd);
-        
-        if(check == FAILED)
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        ssize_t nbytes = sendmsg(fd, &msg, flags);
+        if(nbytes < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            if((errno == EAGAIN || errno == EWOULDBLOCK) && wait_writable(fd) == SUCCESS)
+                continue;
             return FAILED;
+        }
 
-        struct stat fileStat;
-        if(stat(request->path, &fileStat) < 0)
+        /* skip the buffers that were sent and the sent part of the next one */
+        while(iovcnt > 0 && (size_t)nbytes >= iov->iov_len)
         {
-            server_error(fd, request);
-            return FAILED;
+            nbytes -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0)
+        {
+            iov->iov_base = (char*)iov->iov_base + nbytes;
+            iov->iov_len -= nbytes;
         }
+    }
+    return SUCCESS;
+}
 
-        size += strlen("200 OK");
-        if(request->mime)
-            size += strlen("Content-Type: ") + strlen(request->mime) + strlen("\r\n");
 
-        size += (int)fileStat.st_size;
-        size += strlen("Last-Modified: ") + strlen(request->time_mod) + strlen("\r\n");
+/* from now on the responses this thread sends to fd may be gathered in batch, see batch_gather */
+void batch_start(out_batch_t* batch, int fd)
+{
+    batch->buff = NULL;
+    batch->fd = fd;
+    batch->len = 0;
+    batch->gather = FALSE;
+    batch->corked = FALSE;
+    out_batch = batch;
+}
 
-        return size + 150;
-    }
 
-    size += strlen("<HTML><HEAD><TITLE>") + /* title */ strlen("</TITLE></HEAD>") + strlen("\r\n");
-    size += strlen("<BODY><H4>") + /* title */ strlen("</H4>") + strlen("\r\n") + strlen("\r\n");
-    size += strlen("</BODY></HTML>");
+/* the response to the next request is gathered if another request follows it, a lone request is sent right away without the copy */
+void batch_gather(int gather)
+{
+    out_batch_t* batch = out_batch;
+    if(batch == NULL)
+        return;
+
+    /* without the buffer the responses are sent right away */
+    if(gather && batch->buff == NULL)
+        batch->buff = (char*)bufpool_get(BATCH_SIZE);
+    batch->gather = (gather && batch->buff != NULL) ? TRUE : FALSE;
+}
 
-    switch(flag)
-    {
-        case FOUND:
-            size += strlen("302 Found");
-            size += strlen("Content-Type: text/html") + strlen("\r\n");
-            size += strlen("123");
-            size += strlen("Location: ") + strlen(request->path) + strlen("/") + strlen("\r\n");
-            size += strlen("302 Found");
-            size += strlen("302 Found");
-            size += strlen("Directories must end with a slash.");
-            break;
 
-        case BAD_REQUEST:
-            size += strlen("400 Bad Request");
-            size += strlen("Content-Type: text/html") + strlen("\r\n");
-            size += strlen("113");
-            size += strlen("400 Bad Request");
-            size += strlen("400 Bad Request");
-            size += strlen("Bad Request.");
-            break;
+/* copies the buffers of a response to fd into the batch, gathered is FALSE if the caller has to send them (no batch, or too big for it), returns FAILED if the batch couldn't be sent first */
+int batch_append(int fd, struct iovec* iov, int iovcnt, int* gathered)
+{
+    *gathered = FALSE;
+    out_batch_t* batch = out_batch;
+    if(batch == NULL || batch->fd != fd || batch->buff == NULL)
+        return SUCCESS;
 
-        case FORBIDDEN:
-            size += strlen("403 Forbidden");
-            size += strlen("Content-Type: text/html") + strlen("\r\n");
-            size += strlen("111");
-            size += strlen("403 Forbidden");
-            size += strlen("403 Forbidden");
-            size += strlen("Access denied.");
-            break;
+    /* the response to the last request of a batch joins the ones before it, when nothing was gathered it is sent as is */
+    if(!batch->gather && batch->len == 0)
+        return SUCCESS;
 
-        case NOT_FOUND:
-            size += strlen("404 Not Found");
-            size += strlen("Content-Type: text/html") + strlen("\r\n");
-            size += strlen("112");
-            size += strlen("404 Not Found");
-            size += strlen("404 Not Found");
-            size += strlen("File not found.");
-            break;
+    size_t total = 0;
+    int i;
+    for(i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
 
-        case INTERNAL_ERROR:
-            size += strlen("500 Internal Server Error");
-            size += strlen("Content-Type: text/html") + strlen("\r\n");
-            size += strlen("144");
-            size += strlen("500 Internal Server Error");
-            size += strlen("500 Internal Server Error");
-            size += strlen("Some server side error.");
-            break;
+    /* what was gathered goes first, a response that doesn't fit in an empty batch follows it on its' own. the socket is corked
+       so the parts leave in full packets and Nagle doesn't hold the last one back until the client acknowledges the first ones */
+    if(batch->len + total > BATCH_SIZE)
+    {
+        if(!batch->corked)
+        {
+            set_cork(fd, TRUE);
+            batch->corked = TRUE;
+        }
+        if(batch_send() == FAILED)
+            return FAILED;
+    }
+    if(total > BATCH_SIZE)
+        return SUCCESS;
 
-        case NOT_SUPPORTED:
-            size += strlen("501 Not supported");
-            size += strlen("Content-Type: text/html") + strlen("\r\n");
-            size += strlen("129");
-            size += strlen("501 Not supported");
-            size += strlen("501 Not supported");
-            size += strlen("Method is not supported.");
-            break;
+    for(i = 0; i < iovcnt; i++)
+    {
+        memcpy(batch->buff + batch->len, iov[i].iov_base, iov[i].iov_len);
+        batch->len += iov[i].iov_len;
     }
+    *gathered = TRUE;
+    return SUCCESS;
+}
+
 
-    return size + 150;
+/* sends the responses that were gathered with one send (the sends don't gather while the batch is sent) */
+int batch_send(void)
+{
+    out_batch_t* batch = out_batch;
+    if(batch == NULL || batch->len == 0)
+        return SUCCESS;
+
+    out_batch = NULL;
+    int check = send_all(batch->fd, batch->buff, batch->len, 0);
+    batch->len = 0;
+    out_batch = batch;
+    return check;
 }
 
 
-/* count the number of digits */
-int count_digits(int num)
+/* the batch is over (no complete request is left), sends what is gathered and pushes it out */
+int batch_flush(void)
 {
-    int digits = 0;
-    while(num != 0)
+    int check = batch_send();
+    out_batch_t* batch = out_batch;
+    if(batch != NULL && batch->corked)
     {
-        num /= 10;
-        digits++;
+        set_cork(batch->fd, FALSE);
+        batch->corked = FALSE;
     }
-    return digits;
+    return check;
 }
 
 
-/* checks if a certain string is a number. if it is a number then return 0, else -1 */
-int is_number(char* num)
+/* sends what is left in the batch and stops gathering */
+int batch_stop(void)
 {
-    int i;
-    for(i = 0; num[i] != '\0'; i++)
+    int check = batch_flush();
+    if(out_batch != NULL)
     {
-        if(num[i] >= '0' && num[i] <= '9')
+        bufpool_put(out_batch->buff);
+        out_batch = NULL;
+    }
+    return check;
+}
+
+
+/* wait until the socket can take more data, up to WRITE_TIMEOUT */
+int wait_writable(int fd)
+{
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    while(TRUE)
+    {
+        int ready = poll(&pfd, 1, WRITE_TIMEOUT);
+        if(ready < 0 && errno == EINTR)
             continue;
-        
-        else
-            return FAILED;
+        return (ready > 0) ? SUCCESS : FAILED;
     }
-    return SUCCESS;
 }
 
 
-/* free response struct for client after sending the response */
-void free_struct(request_t* request)
+/* closing a socket that has unread bytes resets the connection and the client may lose the response, so the sending side is shut down and what the client still sends is read until it closes too (or LINGER_TIMEOUT). the event front ends drain in their loop instead */
+void drain_client(int fd)
 {
-    if(request->mime)
-        free(request->mime);
+    if(shutdown(fd, SHUT_WR) < 0)
+        return;
 
-    if(request->path)
-        free(request->path);
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
 
-    if(request->read_buff)
-        free(request->read_buff);
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    char discard[BUFFER_SIZE];
+    while(TRUE)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long elapsed = (now.tv_sec - start.tv_sec) * 1000LL + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if(elapsed >= LINGER_TIMEOUT)
+            return;
 
-    if(request->write_buff)
-        free(request->write_buff);
+        int ready = poll(&pfd, 1, LINGER_TIMEOUT - elapsed);
+        if(ready < 0 && errno == EINTR)
+            continue;
+        if(ready <= 0)
+            return;
 
-    if(request->time_now)
-        free(request->time_now);
+        int nbytes = read(fd, discard, sizeof(discard));
+        if(nbytes < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+            continue;
+        if(nbytes <= 0)
+            return;
+    }
+}
 
-    if(request->time_mod)    
-        free(request->time_mod);
 
-    free(request);
+/* free response struct for client after sending the response, everything the request took (the struct too) is given back to the arena at once */
+void free_struct(request_t* request)
+{
+    arena_reset(request->arena);
 }
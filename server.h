@@ -0,0 +1,334 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include "threadpool.h"
+#include "cache.h"
+#include "fd_cache.h"
+#include "http_parser.h"
+#include "arena.h"
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+
+
+/**
+ * server.h
+ *
+ * This file declares the functionality shared between the
+ * request handling code (server.c) and the front ends that
+ * feed it with requests (the blocking accept loop in main()
+ * and the epoll event loop in event_loop.c).
+ */
+
+/* DEFINES */
+#define SUCCESS 0
+#define FAILED 1
+#define TRUE 1
+#define FALSE 0
+#define BUFFER_SIZE 4000
+#define TIME_NOW 2
+#define MIN_PORT 0
+#define MAX_PORT 65535
+
+#define RFC1123FMT "%a, %d %b %Y %H:%M:%S GMT"
+#define USAGE_ERR "Usage: server [-m blocking|epoll|uring] [-q list|ring|steal] [-e max-pool-size] [-l max-queued-jobs] [-s shed-target-ms] [-i shed-interval-ms] [-w workers|auto] [-b backlog] [-A defer-accept-seconds] [-F fastopen-queue] [-N] [-t keep-alive-timeout] [-r max-requests-per-connection] [-c cache-bytes] [-d dir-cache-bytes] [-o open-files] [-v revalidate-ms] [-z gzip-level] [-Z gzip-min-bytes] <port> <pool-size> <max-number-of-request>\n"
+
+#define FOUND 302
+#define NOT_MODIFIED 304
+#define BAD_REQUEST 400
+#define FORBIDDEN 403
+#define NOT_FOUND 404
+#define URI_TOO_LONG 414
+#define RANGE_NOT_SATISFIABLE 416
+#define HEADERS_TOO_LARGE 431
+#define INTERNAL_ERROR 500
+#define NOT_SUPPORTED 501
+#define SERVICE_UNAVAILABLE 503
+#define OK 200
+#define DIR_CONTENT 100
+#define FILE_CONTENT 101
+
+// front end that owns the client sockets
+#define MODE_BLOCKING 0
+#define MODE_EPOLL 1
+#define MODE_URING 2
+
+// persistent connections defaults, idle timeout is in seconds
+#define KEEPALIVE_TIMEOUT 5
+#define KEEPALIVE_MAX 100
+
+// bytes moved by one sendfile/splice call, and by one read when the file has to be copied
+#define SENDFILE_CHUNK (1 << 20)
+#define COPY_CHUNK (64 * 1024)
+
+// file cache defaults, files up to CACHE_MAX_FILE bytes are cached and checked against the disk once a second (-v)
+#define CACHE_SIZE (32 * 1024 * 1024)
+#define CACHE_MAX_FILE (256 * 1024)
+#define CACHE_REVALIDATE 1000
+
+// open files the fd cache keeps by default (at most a quarter of RLIMIT_NOFILE), they are checked against the disk like the file cache
+#define FD_CACHE_FILES 1024
+
+// directory listings cache defaults, a listing is rendered again only after the directory's mtime/ctime changed
+#define DIR_CACHE_SIZE (4 * 1024 * 1024)
+#define DIR_CACHE_MAX_LISTING (512 * 1024)
+
+// content codings of a response, and bits of the codings a client accepts
+#define ENCODING_IDENTITY 0
+#define ENCODING_GZIP 1
+#define ENCODING_BR 2
+
+// gzip defaults, files are compressed here only from GZIP_MIN bytes (a smaller one fits in a packet anyway)
+#define GZIP_LEVEL 6
+#define GZIP_MIN 1024
+
+// size of a cache key: a resolved path, a '\t' and the name of its' variant
+#define KEY_SIZE (HTTP_MAX_URI + 64)
+
+// number of request paths whose verdict is remembered while the document root doesn't change
+#define META_MAX_ENTRIES 65536
+
+// most worker processes of the prefork mode, and how long (seconds) a worker that crashed right after it started waits before it is started again
+#define MAX_WORKERS 256
+#define RESTART_DELAY 1
+
+// where the biggest listen backlog the kernel allows is read from, it is the default backlog
+#define SOMAXCONN_PATH "/proc/sys/net/core/somaxconn"
+
+// a read buffer starts with BUFFER_SIZE bytes and doubles up to this, one byte more than the parser allows so it sees a head that is too large
+#define READ_BUFFER_MAX (HTTP_MAX_HEAD + 1)
+
+// size of buffers that hold header lines
+#define HEADER_SIZE 512
+
+// length of a RFC1123 date ("Sun, 06 Nov 1994 08:49:37 GMT") with its' '\0', rounded up
+#define DATE_SIZE 32
+
+// length of a strong ETag ("inode-size-mtime" in hex, mtime in ns) with its' quotes and '\0', rounded up
+#define ETAG_SIZE 64
+
+// a directory listing is rendered into this many bytes of the arena of the request (a bigger one moves to the buffer pool), names of its' entries
+#define LISTING_TEXT (8 * 1024)
+#define DIR_NAMES 64
+
+// number of statuses that have a pre-rendered response
+#define NUM_STATUSES 10
+
+// most ranges of one Range header (more get the whole file), and size of the boundary of a multipart/byteranges body
+#define MAX_RANGES 16
+#define BOUNDARY_SIZE 64
+
+// seconds a client that was turned away (503) is asked to wait before it tries again
+#define RETRY_AFTER 1
+
+// bytes of responses to pipelined requests that are gathered before they are sent, a bigger response is sent on its' own
+#define BATCH_SIZE (64 * 1024)
+
+// how long (ms) a worker waits for a slow client to drain its socket before giving up
+#define WRITE_TIMEOUT 30000
+
+// how long (ms) the rest of a request that was rejected before it was read whole is read and thrown away before the socket is closed
+#define LINGER_TIMEOUT 1000
+
+
+/* STRUCTS */
+typedef struct request_st{
+    arena_t* arena;     //the memory of the request (the struct too) comes from here, it is reset when the response was sent
+    char* path;
+    char* mime;         //type of the response when it isn't the type of path (a compressed sibling is sent), NULL otherwise
+    char* read_buff;
+    http_request_t* http;   //the parsed request, its' offsets are into read_buff
+    char time_now[DATE_SIZE];
+    struct stat st;     //metadata of the resolved path
+    char etag[ETAG_SIZE];   //strong validator of the resolved path, built from st
+    int encoding;       //ENCODING_GZIP or ENCODING_BR when a compressed representation is sent
+    int keep_alive;     //TRUE if the connection stays open after the response
+} request_t;
+
+
+/**
+ * responses to pipelined requests that wait in memory until no complete
+ * request is left in the read buffer, then are sent together
+ */
+typedef struct out_batch_st{
+    int fd;             //socket the responses are for
+    char* buff;         //BATCH_SIZE bytes, taken when the first response is gathered
+    size_t len;
+    int gather;         //TRUE while the request being answered has another one after it in the read buffer
+    int corked;         //TRUE after a batch that didn't fit was sent in parts, the last part is pushed by removing the cork
+} out_batch_t;
+
+
+/**
+ * one range of a Range request, both ends are in the file
+ */
+typedef struct byte_range_st{
+    off_t first;
+    off_t last;
+} byte_range_t;
+
+
+/**
+ * pre-rendered error response, only the date (and the location of
+ * a 302) is written between head and tail when it is sent
+ */
+typedef struct status_response_st{
+    int status;                     //FOUND, NOT_FOUND...
+    char head[128];                 //status line, server and "Date: "
+    int head_len;
+    char tail_close[512];           //rest of the headers and the body, with "Connection: close"
+    int tail_close_len;
+    char tail_keep_alive[512];      //same with the keep-alive connection header
+    int tail_keep_alive_len;
+} status_response_t;
+
+
+/**
+ * server configuration, filled from the command line in main()
+ */
+typedef struct server_config_st{
+    int mode;                   //MODE_BLOCKING, MODE_EPOLL or MODE_URING
+    int keepalive_timeout;      //seconds an idle persistent connection is kept open
+    int keepalive_max;          //max requests on one connection, 1 disables keep-alive
+    char keepalive_header[64];  //"Connection: keep-alive" header sent to the clients
+    size_t cache_size;          //bytes of the file cache, 0 disables it
+    size_t dir_cache_size;      //bytes of the directory listings cache, 0 disables it
+    int fd_cache_files;         //open files of the fd cache, 0 disables it
+    int revalidate_ms;          //ms the caches trust a file without looking at it, when the document root isn't watched
+    int queue;                  //job queue of the threadpool, QUEUE_LIST, QUEUE_RING or QUEUE_STEAL
+    int max_threads;            //the pool grows up to max_threads with load, 0 keeps it at pool-size
+    int max_queue;              //connections waiting for a thread before new ones get a 503, 0 means no limit
+    int shed_target;            //ms of queue delay before new connections get a 503 (CoDel), 0 disables it
+    int shed_interval;          //ms the queue delay may stay above shed_target
+    int workers;                //worker processes with their own SO_REUSEPORT socket, 0 runs a single process
+    int backlog;                //listen backlog, 0 means somaxconn
+    int defer_accept;           //TCP_DEFER_ACCEPT seconds of the listening socket, 0 leaves it off
+    int fastopen;               //TCP_FASTOPEN queue length of the listening socket, 0 leaves it off
+    int nodelay;                //TRUE sets TCP_NODELAY on the client sockets
+    int gzip_level;             //zlib level of the text files and listings compressed here, 0 disables it
+    size_t gzip_min;            //smaller files aren't compressed here
+} server_config_t;
+
+extern server_config_t server_config;
+extern cache_t* file_cache;
+extern cache_t* dir_cache;
+extern fd_cache_t* fd_cache;
+
+
+/* FUNCTIONS */
+int run_server(int port, int num_of_threads, int max_requests);
+int create_server(int port);
+int default_backlog(void);
+int accept_client(int sockfd);
+void tune_client(int fd);
+int create_response(void* arg);
+int read_request(int fd, char** buff, int* size, int* len, http_request_t* http);
+int grow_read_buffer(char** buff, int* size);
+request_t* new_request(char* read_buff, http_request_t* http, int keep_alive);
+int process_request(request_t* request, int fd);
+int check_input(char* input, request_t* request, int fd);
+int resolve_path(char* path, request_t* request, int fd);
+int error_response(request_t* request, int err_type, int fd);
+int shed_response(int fd);
+int init_status_responses(void);
+status_response_t* get_status_response(int status);
+void current_date(char* buff);
+void refresh_date(time_t now);
+int dir_content(request_t* request, int fd);
+int list_dir(request_t* request, char*** names);
+int listing_stat(const char* path, struct stat* st);
+void listing_fold(struct stat* st, const struct stat* entry);
+void listing_etag(request_t* request);
+int compare_names(const void* a, const void* b);
+int file_content(request_t* request, int fd);
+int file_header(char* header, size_t size, request_t* request, struct stat* fileStat);
+int not_modified(request_t* request);
+int make_etag(char* etag, const struct stat* st);
+int etag_matches(const char* value, int len, const char* etag, int weak);
+int parse_http_date(const char* value, int len, time_t* date);
+int not_modified_response(request_t* request, int fd);
+int accepted_encodings(request_t* request);
+int negotiate_encoding(request_t* request);
+int use_sibling(request_t* request, const char* ext, int encoding);
+int compressible(const char* path);
+const char* encoding_name(int encoding);
+const char* variant_key(request_t* request, char* key, size_t size);
+void variant_etag(char* etag, const char* name);
+char* content_type(request_t* request);
+char* gzip_body(const char* body, size_t len, size_t* gzip_len);
+int variant_header(char* header, size_t size, const char* mime, int encoding, size_t length, const char* etag, time_t mtime);
+int gzip_file_content(request_t* request, int fd);
+int cache_and_send(request_t* request, int fd, cache_t* cache, const char* key, const char* header, int header_len, const char* body, size_t body_len, const struct stat* st, unsigned long generation);
+int parse_range(request_t* request, struct stat* fileStat, byte_range_t* ranges);
+int read_number(const char** p, const char* end, long long* num);
+int range_content(request_t* request, int fd, int file_fd, const char* body, struct stat* fileStat, byte_range_t* ranges, int count);
+int part_header(char* buff, size_t size, const char* boundary, const char* mime, byte_range_t* range, off_t total);
+int send_cached(request_t* request, int fd, cache_entry_t* entry);
+char* read_file(int file_fd, off_t size);
+char* get_mime_type(char* name);
+int server_error(int fd, request_t* request);
+int check_permissions(char *path, request_t* request, int fd);
+int get_timebuff(request_t* request, int flag, int fd);
+int is_number(char* num);
+int keep_alive_requested(http_request_t* http);
+const char* connection_header(request_t* request);
+int write_all(int fd, const char* buff, size_t len);
+int send_all(int fd, const char* buff, size_t len, int flags);
+int wait_writable(int fd);
+void drain_client(int fd);
+int send_iov(int fd, struct iovec* iov, int iovcnt, int flags);
+void batch_start(out_batch_t* batch, int fd);
+void batch_gather(int gather);
+int batch_append(int fd, struct iovec* iov, int iovcnt, int* gathered);
+int batch_send(void);
+int batch_flush(void);
+int batch_stop(void);
+int send_file_body(int fd, int file_fd, off_t offset, off_t count);
+int splice_file_body(int fd, int file_fd, off_t* offset, off_t end);
+void set_cork(int fd, int on);
+void free_struct(request_t* request);
+void print_stats(void);
+void print_pool_stats(threadpool* tp);
+
+
+/**
+ * run_event_loop owns the listening socket and every client socket
+ * with a non-blocking, edge-triggered epoll set. it reads each request
+ * until it is complete and only then dispatches it to the threadpool,
+ * so idle or slow clients never pin a worker thread.
+ * returns after max_requests connections were accepted and served.
+ */
+int run_event_loop(int sockfd, threadpool* tp, int max_requests);
+
+
+/**
+ * run_uring_loop is run_event_loop with the sockets in an io_uring
+ * instead of an epoll set: one multishot accept, a recv per connection
+ * into a ring of provided buffers and one system call for each batch
+ * of them. when the kernel has no io_uring (or not the opcodes we use)
+ * it says so and runs run_event_loop.
+ * returns after max_requests connections were accepted and served.
+ */
+int run_uring_loop(int sockfd, threadpool* tp, int max_requests);
+
+
+/**
+ * raise_fd_limit raises the soft RLIMIT_NOFILE to the hard one.
+ */
+void raise_fd_limit(void);
+
+
+/**
+ * run_prefork starts workers processes, each one runs run_server with
+ * its' own SO_REUSEPORT listening socket, threadpool and caches, so the
+ * kernel spreads the connections between them. a worker that crashes
+ * (killed by a signal) is started again, SIGINT and SIGTERM stop them all.
+ * returns when every worker was done with its' max_requests connections,
+ * FAILED if one of them failed.
+ */
+int run_prefork(int workers, int port, int num_of_threads, int max_requests);
+
+
+#endif
@@ -0,0 +1,294 @@
+/* NAME: Ofir Cohen
+ * ID: 312255847
+ * DATE:
+ *
+ * hash table of the file cache and the fd cache.
+ * entries keyed by a path with a LRU list, a weight budget, reference
+ * counts and the revalidation of an entry against its' file.
+ */
+
+/* INCLUDES */
+#include "table.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+
+/* FUNCTIONS */
+static unsigned int hash_key(table_t* table, const char* key);
+static table_entry_t* find_entry(table_t* table, unsigned int bucket, const char* key);
+static void unlink_entry(table_t* table, table_entry_t* entry);
+
+
+/**
+ * table_init makes table an empty table that holds entries up to max_weight.
+ */
+int table_init(table_t* table, unsigned int num_buckets, size_t max_weight, int revalidate_ms, table_stale_t stale, table_free_t free_entry)
+{
+    bzero(table, sizeof(table_t));
+
+    table->buckets = (table_entry_t**)calloc(num_buckets, sizeof(table_entry_t*));
+    if(table->buckets == NULL)
+        return -1;
+
+    if(pthread_mutex_init(&table->lock, NULL) != 0)
+    {
+        free(table->buckets);
+        return -1;
+    }
+
+    table->num_buckets = num_buckets;
+    table->max_weight = max_weight;
+    table->revalidate_ms = revalidate_ms;
+    table->stale = stale;
+    table->free_entry = free_entry;
+    return 0;
+}
+
+
+/**
+ * table_lookup returns the entry of key with a reference for the caller, or NULL on a miss.
+ */
+table_entry_t* table_lookup(table_t* table, const char* key)
+{
+    unsigned int bucket = hash_key(table, key);
+    long long now = table_now();
+
+    /* taken before the file is looked at, so a change after it is never hidden */
+    unsigned long generation = table_generation(table);
+
+    pthread_mutex_lock(&table->lock);
+    table_entry_t* entry = find_entry(table, bucket, key);
+    if(entry == NULL)
+    {
+        pthread_mutex_unlock(&table->lock);
+        __atomic_add_fetch(&table->misses, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    /* move to the head of the lru list */
+    if(table->lru_head != entry)
+    {
+        entry->lru_prev->lru_next = entry->lru_next;
+        if(entry->lru_next)
+            entry->lru_next->lru_prev = entry->lru_prev;
+        else
+            table->lru_tail = entry->lru_prev;
+
+        entry->lru_prev = NULL;
+        entry->lru_next = table->lru_head;
+        table->lru_head->lru_prev = entry;
+        table->lru_head = entry;
+    }
+
+    entry->refs++;
+
+    /* when the file system is watched an entry is trusted until something changed, else for revalidate_ms */
+    int validate;
+    if(generation != 0)
+        validate = (entry->generation != generation);
+    else
+        validate = (now - entry->checked >= table->revalidate_ms);
+    if(validate)
+        entry->checked = now;
+    pthread_mutex_unlock(&table->lock);
+
+    /* the entry wasn't looked at for a while, compare it to the file (outside the lock) */
+    if(validate)
+    {
+        if(table->stale(table, entry, generation))
+        {
+            pthread_mutex_lock(&table->lock);
+            unlink_entry(table, entry);
+            pthread_mutex_unlock(&table->lock);
+            table_release(table, entry);
+
+            __atomic_add_fetch(&table->invalidations, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&table->misses, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+
+        pthread_mutex_lock(&table->lock);
+        entry->generation = generation;
+        pthread_mutex_unlock(&table->lock);
+    }
+
+    __atomic_add_fetch(&table->hits, 1, __ATOMIC_RELAXED);
+    return entry;
+}
+
+
+/**
+ * table_insert puts entry in the table and makes room for it.
+ */
+void table_insert(table_t* table, table_entry_t* entry)
+{
+    unsigned int bucket = hash_key(table, entry->key);
+
+    /* one reference for the table, one for the caller */
+    entry->refs = 2;
+
+    pthread_mutex_lock(&table->lock);
+
+    /* replace an older entry of the same key (another thread may have built it in the meantime) */
+    table_entry_t* old = find_entry(table, bucket, entry->key);
+    if(old != NULL)
+        unlink_entry(table, old);
+
+    /* evict least recently used entries until the new one fits */
+    while(table->lru_tail != NULL && table->weight + entry->weight > table->max_weight)
+    {
+        unlink_entry(table, table->lru_tail);
+        table->evictions++;
+    }
+
+    entry->hnext = table->buckets[bucket];
+    table->buckets[bucket] = entry;
+
+    entry->lru_prev = NULL;
+    entry->lru_next = table->lru_head;
+    if(table->lru_head)
+        table->lru_head->lru_prev = entry;
+    else
+        table->lru_tail = entry;
+    table->lru_head = entry;
+
+    table->weight += entry->weight;
+    table->entries++;
+    pthread_mutex_unlock(&table->lock);
+}
+
+
+/**
+ * table_generation returns the current generation of the file system, 0 if it isn't watched.
+ */
+unsigned long table_generation(table_t* table)
+{
+    return (table->generation != NULL) ? table->generation() : 0;
+}
+
+
+/**
+ * table_now returns the milliseconds of the monotonic clock.
+ */
+long long table_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/**
+ * table_release gives back a reference, the last one frees the entry.
+ */
+void table_release(table_t* table, table_entry_t* entry)
+{
+    pthread_mutex_lock(&table->lock);
+    int refs = --entry->refs;
+    pthread_mutex_unlock(&table->lock);
+
+    if(refs == 0)
+        table->free_entry(entry);
+}
+
+
+/**
+ * table_trim evicts every entry nobody but the table is using.
+ */
+int table_trim(table_t* table)
+{
+    int evicted = 0;
+    pthread_mutex_lock(&table->lock);
+    table_entry_t* entry = table->lru_tail;
+    while(entry != NULL)
+    {
+        table_entry_t* prev = entry->lru_prev;
+        if(entry->refs == 1)
+        {
+            unlink_entry(table, entry);
+            table->evictions++;
+            evicted++;
+        }
+        entry = prev;
+    }
+    pthread_mutex_unlock(&table->lock);
+    return evicted;
+}
+
+
+/**
+ * table_destroy frees every entry and the buckets.
+ */
+void table_destroy(table_t* table)
+{
+    table_entry_t* entry = table->lru_head;
+    while(entry != NULL)
+    {
+        table_entry_t* next = entry->lru_next;
+        table->free_entry(entry);
+        entry = next;
+    }
+
+    pthread_mutex_destroy(&table->lock);
+    free(table->buckets);
+}
+
+
+/* the entry of key in its' bucket, NULL if there is none, the lock is held */
+static table_entry_t* find_entry(table_t* table, unsigned int bucket, const char* key)
+{
+    table_entry_t* entry = table->buckets[bucket];
+    while(entry != NULL && strcmp(entry->key, key) != 0)
+        entry = entry->hnext;
+    return entry;
+}
+
+
+/* remove entry from its' bucket and from the lru list and drop the reference of the table, the lock is held */
+static void unlink_entry(table_t* table, table_entry_t* entry)
+{
+    unsigned int bucket = hash_key(table, entry->key);
+    table_entry_t** link = &table->buckets[bucket];
+    while(*link != NULL && *link != entry)
+        link = &(*link)->hnext;
+
+    /* someone else already removed it */
+    if(*link == NULL)
+        return;
+    *link = entry->hnext;
+
+    if(entry->lru_prev)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        table->lru_head = entry->lru_next;
+
+    if(entry->lru_next)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        table->lru_tail = entry->lru_prev;
+
+    entry->hnext = NULL;
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+    table->weight -= entry->weight;
+    table->entries--;
+
+    /* the entry is freed here only if nobody is using it right now */
+    if(--entry->refs == 0)
+        table->free_entry(entry);
+}
+
+
+/* FNV-1a hash of the key, reduced to a bucket number */
+static unsigned int hash_key(table_t* table, const char* key)
+{
+    unsigned int hash = 2166136261u;
+    while(*key)
+    {
+        hash ^= (unsigned char)*key++;
+        hash *= 16777619u;
+    }
+    return hash % table->num_buckets;
+}
@@ -0,0 +1,130 @@
+#ifndef _TABLE_H_
+#define _TABLE_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+
+
+/**
+ * table.h
+ *
+ * This file declares the hash table both the file cache and the fd
+ * cache keep their entries in: a table keyed by a path with a LRU list,
+ * a budget on the total weight of the entries, reference counted
+ * entries and the decision when an entry has to be compared to its'
+ * file again (once every revalidate_ms, or, when the file system is
+ * watched, only after it changed).
+ * a cache puts a table_entry_t first in its' entries and a table_t in
+ * itself, and tells the table how to compare an entry and how to free it.
+ */
+
+
+/**
+ * the part of an entry the table owns, the first member of the entry of a cache
+ */
+typedef struct table_entry_st{
+    char* key;                  //path (allocated by the cache, freed with the entry)
+    size_t weight;              //what the entry costs out of the budget of the table
+    long long checked;          //when the entry was last compared to its' file (ms)
+    unsigned long generation;   //generation of the file system the entry was last compared in, 0 if never
+    int refs;                   //one for being in the table and one for each user
+    struct table_entry_st* hnext;       //next in the hash bucket
+    struct table_entry_st* lru_prev;    //more recently used
+    struct table_entry_st* lru_next;    //less recently used
+} table_entry_t;
+
+
+typedef struct table_st table_t;
+
+// returns TRUE if entry doesn't match its' file anymore, generation is the current generation of the file system
+typedef int (*table_stale_t)(table_t* table, table_entry_t* entry, unsigned long generation);
+
+// frees everything of an entry, its' key included
+typedef void (*table_free_t)(table_entry_t* entry);
+
+
+/**
+ * the table itself, the first member of a cache
+ */
+struct table_st{
+    table_entry_t** buckets;
+    unsigned int num_buckets;
+    table_entry_t* lru_head;    //most recently used
+    table_entry_t* lru_tail;    //least recently used, the next to be evicted
+    size_t weight;              //weight of all the entries in the table
+    size_t max_weight;          //budget of the table
+    unsigned long entries;      //entries in the table
+    int revalidate_ms;          //how long a validated entry is trusted without looking at its' file
+    unsigned long (*generation)(void);  //changes whenever the file system changes, NULL (or 0) if it isn't watched
+    table_stale_t stale;
+    table_free_t free_entry;
+    pthread_mutex_t lock;       //lock on buckets, lru list, weight and entries
+    unsigned long hits;         //counters, updated atomically
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long invalidations;
+};
+
+
+/**
+ * table_init makes table an empty table of num_buckets buckets that
+ * holds entries up to max_weight.
+ * returns 0 on success, -1 on failure.
+ */
+int table_init(table_t* table, unsigned int num_buckets, size_t max_weight, int revalidate_ms, table_stale_t stale, table_free_t free_entry);
+
+
+/**
+ * table_lookup returns the entry of key with a reference the caller
+ * has to give back with table_release, or NULL on a miss.
+ * an entry that wasn't compared for revalidate_ms (or in the current
+ * generation) is compared with the stale function, outside the lock,
+ * and a stale one is dropped and counts as a miss.
+ */
+table_entry_t* table_lookup(table_t* table, const char* key);
+
+
+/**
+ * table_insert puts entry (key and weight set) in the table, replacing
+ * an older entry of the same key, and evicts least recently used
+ * entries until it fits. the entry gets a reference for the table and
+ * one for the caller.
+ */
+void table_insert(table_t* table, table_entry_t* entry);
+
+
+/**
+ * table_generation returns the current generation of the file system,
+ * 0 if it isn't watched.
+ */
+unsigned long table_generation(table_t* table);
+
+
+/**
+ * table_now returns the milliseconds of the monotonic clock entries are
+ * checked by.
+ */
+long long table_now(void);
+
+
+/**
+ * table_release gives back a reference that was returned by
+ * table_lookup or table_insert, the last one frees the entry.
+ */
+void table_release(table_t* table, table_entry_t* entry);
+
+
+/**
+ * table_trim evicts every entry nobody but the table is using.
+ * returns the number of entries that were evicted.
+ */
+int table_trim(table_t* table);
+
+
+/**
+ * table_destroy frees every entry and the buckets, no entry may be in use.
+ */
+void table_destroy(table_t* table);
+
+
+#endif
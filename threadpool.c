@@ -7,23 +7,71 @@
  */
 
 /* INCLUDES */
+#define _GNU_SOURCE
 #include "threadpool.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
 #include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
 
 /* DEFINES */
 #define TRUE 1
+#define FALSE 0
 #define ACCEPT 0
 #define DONT_ACCEPT 1
 #define SHUTDOWN 1
 #define NO_SHUTDOWN 0
+#define SUCCESS 0
+#define FAILED 1
+#define RETRY 2
+
+// state of a worker of a QUEUE_STEAL pool
+#define WORKER_RUNNING 0
+#define WORKER_PARKED 1
+
+// smallest inbox of a worker of a QUEUE_STEAL pool
+#define MIN_INBOX_SIZE 64
+
+
+/* GLOBALS */
+// the worker the calling thread is, if it is a worker of a QUEUE_STEAL pool
+static __thread worker_t* current_worker = NULL;
+
+// the pool the calling thread works for, if it is a worker of a QUEUE_RING pool
+static __thread threadpool* current_ring_pool = NULL;
 
 
 /* FUNCTIONS */
+static int ring_init(job_ring_t* ring, int size);
+static int ring_put(job_ring_t* ring, dispatch_fn routine, void* arg, long long enqueued);
+static int ring_take(job_ring_t* ring, work_t* work);
+static void* do_ring_work(threadpool* tp);
+static void wake_worker(threadpool* tp);
+static void steal_dispatch(threadpool* tp, dispatch_fn routine, void* arg);
+static void* do_steal_work(void* p);
+static int find_work(worker_t* self, work_t* work);
+static int deque_push(worker_t* self, dispatch_fn routine, void* arg);
+static int deque_pop(worker_t* self, work_t* work);
+static int deque_steal(worker_t* victim, work_t* work);
+static void wake_parked(threadpool* tp, int first);
+static void free_threadpool(threadpool* tp);
+static void join_threads(threadpool* tp);
+static void grow_pool(threadpool* tp);
+static int retire_thread(threadpool* tp);
+static void job_waited(threadpool* tp, long long enqueued);
+static int overloaded(threadpool* tp);
+static int ring_sleep(threadpool* tp);
+static long ring_count(job_ring_t* ring);
+static long long now_ns(void);
+static void deadline_after(struct timespec* deadline, int ms);
+
 
 /**
  * create_threadpool creates a fixed-sized thread
@@ -36,23 +84,93 @@
  * 4. create the threads, the thread init function is do_work and its argument is the initialized threadpool. 
  */
 threadpool* create_threadpool(int num_threads_in_pool)
+{
+    threadpool_config_t config;
+    config.num_threads = num_threads_in_pool;
+    config.queue = QUEUE_LIST;
+    config.ring_size = RING_SIZE;
+    config.max_threads = num_threads_in_pool;
+    config.grow_wait = GROW_WAIT;
+    config.grow_qsize = 0;
+    config.idle_timeout = IDLE_TIMEOUT;
+    config.max_queue = 0;
+    config.shed_target = 0;
+    config.shed_interval = SHED_INTERVAL;
+    return create_threadpool_ex(&config);
+}
+
+
+/**
+ * create_threadpool_ex creates a pool as described by config.
+ * with QUEUE_RING the jobs are kept in a fixed-size ring that
+ * dispatch and the workers use without taking a lock or allocating
+ * memory, dispatch waits when the ring is full (a worker of the
+ * pool runs the job itself instead, it would wait for itself).
+ * with QUEUE_STEAL every worker has its' own deque: jobs dispatched
+ * by a worker stay with it, jobs from outside the pool are spread
+ * round-robin, and an idle worker steals from the others before it
+ * sleeps on its' own futex.
+ * when max_threads is bigger than num_threads the pool is elastic
+ * (QUEUE_LIST and QUEUE_RING): it starts with num_threads threads,
+ * adds one when a job waited grow_wait ms in the queue (or more than
+ * grow_qsize jobs wait) and no thread is idle, and a thread above
+ * num_threads leaves after idle_timeout ms without a job. a QUEUE_STEAL
+ * pool stays fixed, its' workers own the deques the others steal from.
+ * returns NULL on bad config or failure.
+ */
+threadpool* create_threadpool_ex(const threadpool_config_t* config)
 {
     // check input
-    if(num_threads_in_pool <= 0 || num_threads_in_pool > MAXT_IN_POOL)
+    if(config == NULL || config->num_threads <= 0 || config->num_threads > MAXT_IN_POOL)
         return NULL;
 
-    /* init threadpool and its' values */
-    threadpool* tp = (threadpool*)malloc(sizeof(threadpool));
+    if(config->queue != QUEUE_LIST && config->queue != QUEUE_RING && config->queue != QUEUE_STEAL)
+        return NULL;
+
+    if(config->queue != QUEUE_LIST && (config->ring_size <= 0 || config->ring_size > MAX_RING_SIZE))
+        return NULL;
+
+    // a stealing pool is always fixed, max_threads of a fixed pool isn't looked at
+    int elastic = (config->queue != QUEUE_STEAL && config->max_threads > config->num_threads);
+    if(elastic && (config->max_threads > MAXT_IN_POOL || config->grow_wait < 0 || config->grow_qsize < 0 || config->idle_timeout <= 0))
+        return NULL;
+
+    // admission control of a stealing pool isn't supported, its' limits aren't looked at
+    int shedding = (config->queue != QUEUE_STEAL && (config->max_queue > 0 || config->shed_target > 0));
+    if(shedding && (config->max_queue < 0 || config->shed_target < 0 || (config->shed_target > 0 && config->shed_interval <= 0)))
+        return NULL;
+
+    /* init threadpool and its' values, the positions of the ring are aligned to cache lines so the pool is too */
+    threadpool* tp = (threadpool*)aligned_alloc(CACHE_LINE, sizeof(threadpool));
     if(tp == NULL)
         return NULL;
+    memset(tp, 0, sizeof(threadpool));
 
     // set the number of threads in threadpool to be the number that was entered
-    tp->num_threads = num_threads_in_pool;
+    tp->num_threads = config->num_threads;
+    tp->queue = config->queue;
+
+    // an elastic pool keeps room for max_threads threads, the ones that aren't running are THREAD_FREE
+    tp->min_threads = config->num_threads;
+    tp->max_threads = elastic ? config->max_threads : config->num_threads;
+    tp->peak_threads = config->num_threads;
+    tp->grow_wait = (long long)config->grow_wait * 1000000;
+    tp->grow_qsize = config->grow_qsize;
+    tp->idle_timeout = config->idle_timeout;
+
+    // the queue delay of a shedding pool is measured like the one of an elastic pool
+    tp->timed = (elastic || (shedding && config->shed_target > 0));
+    tp->max_queue = shedding ? config->max_queue : 0;
+    tp->shed_target = shedding ? (long long)config->shed_target * 1000000 : 0;
+    tp->shed_interval = shedding ? (long long)config->shed_interval * 1000000 : 0;
     
     // allocate memory for threads
-    tp->threads = (pthread_t*)malloc(sizeof(pthread_t)*num_threads_in_pool);
-    if(tp->threads == NULL)
+    tp->threads = (pthread_t*)malloc(sizeof(pthread_t)*tp->max_threads);
+    tp->thread_state = (int*)calloc(tp->max_threads, sizeof(int));
+    if(tp->threads == NULL || tp->thread_state == NULL)
     {
+        free(tp->threads);
+        free(tp->thread_state);
         free(tp);
         return NULL;
     }
@@ -66,15 +184,31 @@ threadpool* create_threadpool(int num_threads_in_pool)
     if(check != 0)
     {
         free(tp->threads);
+        free(tp->thread_state);
         free(tp);
         return NULL;
     }
 
-    // condition value on size of job list
-    check = pthread_cond_init(&tp->q_not_empty, NULL);
+    // lock on adding and retiring threads
+    check = pthread_mutex_init(&tp->grow_lock, NULL);
     if(check != 0)
     {
         free(tp->threads);
+        free(tp->thread_state);
+        free(tp);
+        return NULL;
+    }
+
+    // condition value on size of job list, the idle timeout of an elastic pool is measured on the monotonic clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    check = pthread_cond_init(&tp->q_not_empty, &attr);
+    pthread_condattr_destroy(&attr);
+    if(check != 0)
+    {
+        free(tp->threads);
+        free(tp->thread_state);
         free(tp);
         return NULL;
     }
@@ -84,24 +218,76 @@ threadpool* create_threadpool(int num_threads_in_pool)
     if(check != 0)
     {
         free(tp->threads);
+        free(tp->thread_state);
         free(tp);
         return NULL;
     }
 
+    // from here on a failure frees whatever was built with free_threadpool
+    if(tp->queue == QUEUE_RING)
+    {
+        if(sem_init(&tp->ring_wake, 0, 0) != 0 || ring_init(&tp->ring, config->ring_size) == FAILED)
+        {
+            free_threadpool(tp);
+            return NULL;
+        }
+    }
+
+    /* every worker of a stealing pool gets an empty deque and an inbox, the ring slots are split between the inboxes */
+    if(tp->queue == QUEUE_STEAL)
+    {
+        tp->workers = (worker_t*)aligned_alloc(CACHE_LINE, sizeof(worker_t)*config->num_threads);
+        if(tp->workers == NULL)
+        {
+            free_threadpool(tp);
+            return NULL;
+        }
+        memset(tp->workers, 0, sizeof(worker_t)*config->num_threads);
+        tp->num_workers = config->num_threads;
+
+        int inbox_size = config->ring_size / config->num_threads;
+        if(inbox_size < MIN_INBOX_SIZE)
+            inbox_size = MIN_INBOX_SIZE;
+
+        int i;
+        for(i = 0; i < config->num_threads; i++)
+        {
+            worker_t* worker = &tp->workers[i];
+            worker->tp = tp;
+            worker->id = i;
+            worker->state = WORKER_RUNNING;
+            worker->deque = (work_t*)malloc(sizeof(work_t)*DEQUE_SIZE);
+            if(worker->deque == NULL || ring_init(&worker->inbox, inbox_size) == FAILED)
+            {
+                free_threadpool(tp);
+                return NULL;
+            }
+        }
+    }
+
     // values for destroy pool function
     tp->shutdown = NO_SHUTDOWN;
     tp->dont_accept = ACCEPT;
 
 
-    // create threads and send them to do_work function with the threadpool as an argument
+    // create threads and send them to do_work function with the threadpool as an argument (a worker of a stealing pool gets its' own struct)
     int i;
-    for(i = 0; i < num_threads_in_pool; i++)
+    for(i = 0; i < config->num_threads; i++)
     {
-        if(pthread_create(&tp->threads[i], NULL, do_work, (void*)tp) != 0)
+        int check;
+        if(tp->queue == QUEUE_STEAL)
+            check = pthread_create(&tp->threads[i], NULL, do_steal_work, (void*)&tp->workers[i]);
+        else
+            check = pthread_create(&tp->threads[i], NULL, do_work, (void*)tp);
+
+        if(check != 0)
         {
+            // only the threads that were created are joined
+            tp->num_threads = i;
             destroy_threadpool(tp);
             return NULL;
         }
+        tp->thread_state[i] = THREAD_RUNNING;
     }
 
     return tp;
@@ -137,6 +323,53 @@ void dispatch(threadpool* from_me, dispatch_fn dispatch_to_here, void *arg)
     if(from_me == NULL || dispatch_to_here == NULL)
         return;
 
+    /* ring and stealing queues - no lock and no allocation, destroy_threadpool waits for the dispatch calls that got in */
+    if(from_me->queue != QUEUE_LIST)
+    {
+        __atomic_add_fetch(&from_me->dispatching, 1, __ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&from_me->dont_accept, __ATOMIC_SEQ_CST) == DONT_ACCEPT)
+        {
+            __atomic_sub_fetch(&from_me->dispatching, 1, __ATOMIC_SEQ_CST);
+            return;
+        }
+
+        if(from_me->queue == QUEUE_RING)
+        {
+            int elastic = (from_me->max_threads > from_me->min_threads);
+            long long enqueued = from_me->timed ? now_ns() : 0;
+
+            /* the ring is full, let the workers run until a slot is free */
+            while(ring_put(&from_me->ring, dispatch_to_here, arg, enqueued) == FAILED)
+            {
+                /* a worker of this pool would wait for itself, it runs the job instead */
+                if(current_ring_pool == from_me)
+                {
+                    dispatch_to_here(arg);
+                    __atomic_sub_fetch(&from_me->dispatching, 1, __ATOMIC_SEQ_CST);
+                    return;
+                }
+
+                // the threads can't keep up, an elastic pool gets one more
+                if(elastic)
+                    grow_pool(from_me);
+                sched_yield();
+            }
+
+            /* the job is published before the idle workers are counted */
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            wake_worker(from_me);
+
+            if(elastic && from_me->grow_qsize > 0 && __atomic_load_n(&from_me->idle_workers, __ATOMIC_SEQ_CST) == 0
+               && ring_count(&from_me->ring) > from_me->grow_qsize)
+                grow_pool(from_me);
+        }
+        else
+            steal_dispatch(from_me, dispatch_to_here, arg);
+
+        __atomic_sub_fetch(&from_me->dispatching, 1, __ATOMIC_SEQ_CST);
+        return;
+    }
+
     /* critical section - adding job to job list */
     pthread_mutex_lock(&(from_me->qlock));
 
@@ -159,6 +392,10 @@ void dispatch(threadpool* from_me, dispatch_fn dispatch_to_here, void *arg)
     
     // argument for the routine
     work->arg = arg;
+
+    // an elastic or shedding pool measures how long the job waits in the list
+    int elastic = (from_me->max_threads > from_me->min_threads);
+    work->enqueued = from_me->timed ? now_ns() : 0;
     
     // next job in queue
     work->next = NULL;
@@ -179,12 +416,43 @@ void dispatch(threadpool* from_me, dispatch_fn dispatch_to_here, void *arg)
 
     // increase by 1 the size of the queue
     from_me->qsize++;
+
+    // too many jobs wait and no thread is free to take them, the pool grows after the lock is released
+    int grow = (elastic && from_me->grow_qsize > 0 && from_me->qsize > from_me->grow_qsize && from_me->idle_workers == 0);
     
     /* signal that there is a job in the job list */
     pthread_mutex_unlock(&from_me->qlock);
     pthread_cond_signal(&from_me->q_not_empty);
+
+    if(grow)
+        grow_pool(from_me);
+}
+
+/**
+ * try_dispatch is dispatch with admission control (QUEUE_LIST and
+ * QUEUE_RING): the job is turned away when max_queue jobs already wait,
+ * or when the time the jobs waited in the queue stayed above shed_target
+ * for shed_interval (CoDel), until a job waits less than shed_target or
+ * the queue is empty. a turned away job is only counted, the caller
+ * answers for it.
+ * returns SUCCESS if the job was dispatched, FAILED if it was turned away.
+ */
+int try_dispatch(threadpool* from_me, dispatch_fn dispatch_to_here, void *arg)
+{
+    if(from_me == NULL || dispatch_to_here == NULL)
+        return FAILED;
+
+    if((from_me->max_queue > 0 || from_me->shed_target > 0) && overloaded(from_me))
+    {
+        __atomic_add_fetch(&from_me->shed, 1, __ATOMIC_RELAXED);
+        return FAILED;
+    }
+
+    dispatch(from_me, dispatch_to_here, arg);
+    return SUCCESS;
 }
 
+
 /**
  * The work function of the thread
  * this function should:
@@ -202,6 +470,9 @@ void* do_work(void* p)
 
     threadpool* tp = (threadpool*)p;
 
+    if(tp->queue == QUEUE_RING)
+        return do_ring_work(tp);
+
     while(TRUE)
     {        
         pthread_mutex_lock(&(tp->qlock));
@@ -216,7 +487,26 @@ void* do_work(void* p)
         /* check if there is a job waiting */
         if(tp->qsize == 0)
         {    
-            pthread_cond_wait(&(tp->q_not_empty), &(tp->qlock));
+            __atomic_add_fetch(&tp->idle_workers, 1, __ATOMIC_SEQ_CST);
+            if(tp->max_threads > tp->min_threads)
+            {
+                struct timespec deadline;
+                deadline_after(&deadline, tp->idle_timeout);
+                int check = pthread_cond_timedwait(&(tp->q_not_empty), &(tp->qlock), &deadline);
+                __atomic_sub_fetch(&tp->idle_workers, 1, __ATOMIC_SEQ_CST);
+
+                /* no job for idle_timeout ms, a thread above the minimum leaves the pool */
+                if(check == ETIMEDOUT && tp->qsize == 0 && tp->shutdown == NO_SHUTDOWN && retire_thread(tp) == SUCCESS)
+                {
+                    pthread_mutex_unlock(&tp->qlock);
+                    return NULL;
+                }
+            }
+            else
+            {
+                pthread_cond_wait(&(tp->q_not_empty), &(tp->qlock));
+                __atomic_sub_fetch(&tp->idle_workers, 1, __ATOMIC_SEQ_CST);
+            }
         }
 
         /* check if shutdown process has started */
@@ -258,6 +548,8 @@ void* do_work(void* p)
         /* run the function that we took from the job list */
         if(work)
         {
+            if(tp->timed)
+                job_waited(tp, work->enqueued);
             work->routine(work->arg);
             free(work);
         }
@@ -274,6 +566,33 @@ void destroy_threadpool(threadpool* destroyme)
 {    
     if(destroyme == NULL)
         return;
+
+    int i;
+
+    /* ring and stealing queues - stop accepting, wait for the dispatch calls that got in, then every worker gets one more wake up */
+    if(destroyme->queue != QUEUE_LIST)
+    {
+        __atomic_store_n(&destroyme->dont_accept, DONT_ACCEPT, __ATOMIC_SEQ_CST);
+        while(__atomic_load_n(&destroyme->dispatching, __ATOMIC_SEQ_CST) > 0)
+            sched_yield();
+
+        // the workers run what is left in the queues, a worker leaves when it finds them all empty
+        __atomic_store_n(&destroyme->shutdown, SHUTDOWN, __ATOMIC_SEQ_CST);
+        for(i = 0; i < destroyme->max_threads; i++)
+        {
+            if(destroyme->queue == QUEUE_RING)
+                sem_post(&destroyme->ring_wake);
+            else if(__atomic_exchange_n(&destroyme->workers[i].state, WORKER_RUNNING, __ATOMIC_SEQ_CST) == WORKER_PARKED)
+            {
+                __atomic_add_fetch(&destroyme->searching, 1, __ATOMIC_SEQ_CST);
+                syscall(SYS_futex, &destroyme->workers[i].state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+            }
+        }
+
+        join_threads(destroyme);
+        free_threadpool(destroyme);
+        return;
+    }
     
     // lock mutex
     // dont accept new jobs to be added to the job list
@@ -301,14 +620,672 @@ void destroy_threadpool(threadpool* destroyme)
     // destroy condition values
     // free threads array
     // free threadpool
+    join_threads(destroyme);
+    free_threadpool(destroyme);
+}
+
+
+/* the work function of a thread of a ring queue pool, a worker that finds the ring empty counts itself as idle and sleeps */
+static void* do_ring_work(threadpool* tp)
+{
+    work_t work;
+    current_ring_pool = tp;
+    while(TRUE)
+    {
+        if(ring_take(&tp->ring, &work) == SUCCESS)
+        {
+            if(tp->timed)
+                job_waited(tp, work.enqueued);
+            work.routine(work.arg);
+            continue;
+        }
+
+        // no dispatch call is running once shutdown is set, so the ring is really empty
+        if(__atomic_load_n(&tp->shutdown, __ATOMIC_SEQ_CST) == SHUTDOWN)
+            return NULL;
+
+        /* look again after being counted, a job that is added from now on wakes someone up */
+        __atomic_add_fetch(&tp->idle_workers, 1, __ATOMIC_SEQ_CST);
+        if(ring_take(&tp->ring, &work) == SUCCESS)
+        {
+            // not idle after all, unless a producer already counted on this worker (then it gets a spare wake up)
+            int idle = __atomic_load_n(&tp->idle_workers, __ATOMIC_SEQ_CST);
+            while(idle > 0 && !__atomic_compare_exchange_n(&tp->idle_workers, &idle, idle - 1, TRUE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+                ;
+            if(tp->timed)
+                job_waited(tp, work.enqueued);
+            work.routine(work.arg);
+            continue;
+        }
+
+        /* a thread of an elastic pool sleeps at most idle_timeout ms, then leaves if the pool is above its' minimum */
+        if(tp->max_threads > tp->min_threads)
+        {
+            if(ring_sleep(tp) == FAILED && retire_thread(tp) == SUCCESS)
+                return NULL;
+            continue;
+        }
+
+        while(sem_wait(&tp->ring_wake) != 0 && errno == EINTR)
+            ;
+    }
+}
+
+
+/* wakes up one idle worker, if there is one */
+static void wake_worker(threadpool* tp)
+{
+    int idle = __atomic_load_n(&tp->idle_workers, __ATOMIC_SEQ_CST);
+    while(idle > 0)
+    {
+        /* every idle worker is woken up once, the next dispatch calls don't pay for a system call */
+        if(__atomic_compare_exchange_n(&tp->idle_workers, &idle, idle - 1, TRUE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        {
+            sem_post(&tp->ring_wake);
+            return;
+        }
+    }
+}
+
+
+/* allocates the slots of a ring of at least size jobs, every slot starts free for the producer of its' own position */
+static int ring_init(job_ring_t* ring, int size)
+{
+    size_t slots = 1;
+    while(slots < (size_t)size)
+        slots <<= 1;
+
+    ring->slots = (ring_slot_t*)aligned_alloc(CACHE_LINE, ((sizeof(ring_slot_t)*slots + CACHE_LINE - 1) / CACHE_LINE) * CACHE_LINE);
+    if(ring->slots == NULL)
+        return FAILED;
+
+    size_t i;
+    for(i = 0; i < slots; i++)
+        ring->slots[i].seq = i;
+    ring->mask = slots - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    return SUCCESS;
+}
+
+
+/* adds a job to the slot at the tail of the ring (Vyukov's bounded queue), FAILED if the ring is full */
+static int ring_put(job_ring_t* ring, dispatch_fn routine, void* arg, long long enqueued)
+{
+    size_t pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    ring_slot_t* slot;
+    while(TRUE)
+    {
+        slot = &ring->slots[pos & ring->mask];
+        size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        /* the slot is free for this position, claim it */
+        if(diff == 0)
+        {
+            if(__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+
+        /* the slot still holds the job of the previous lap */
+        else if(diff < 0)
+            return FAILED;
+
+        /* another producer took this position */
+        else
+            pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    }
+
+    slot->work.routine = routine;
+    slot->work.arg = arg;
+    slot->work.enqueued = enqueued;
+    slot->work.next = NULL;
+
+    /* publish the job to the consumers */
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    return SUCCESS;
+}
+
+
+/* takes the job from the slot at the head of the ring, FAILED if there is no job ready there */
+static int ring_take(job_ring_t* ring, work_t* work)
+{
+    size_t pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    ring_slot_t* slot;
+    while(TRUE)
+    {
+        slot = &ring->slots[pos & ring->mask];
+        size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        /* the slot holds the job of this position, claim it */
+        if(diff == 0)
+        {
+            if(__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+
+        /* the job of this position isn't there yet */
+        else if(diff < 0)
+            return FAILED;
+
+        /* another consumer took this position */
+        else
+            pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    }
+
+    *work = slot->work;
+
+    /* the slot is free for the producer of the next lap */
+    __atomic_store_n(&slot->seq, pos + ring->mask + 1, __ATOMIC_RELEASE);
+    return SUCCESS;
+}
+
+
+/* adds a job to a stealing pool, a worker keeps its' own jobs and a job from outside goes to the next inbox */
+static void steal_dispatch(threadpool* tp, dispatch_fn routine, void* arg)
+{
+    worker_t* self = current_worker;
+    if(self != NULL && self->tp == tp && deque_push(self, routine, arg) == SUCCESS)
+    {
+        /* the worker is busy with the current job, someone idle may steal the new one */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        wake_parked(tp, self->id + 1);
+        return;
+    }
+
+    /* round-robin, a full inbox passes the job to the next one */
+    while(TRUE)
+    {
+        unsigned int first = __atomic_fetch_add(&tp->next_worker, 1, __ATOMIC_RELAXED);
+        int i;
+        for(i = 0; i < tp->num_threads; i++)
+        {
+            int id = (first + i) % tp->num_threads;
+            if(ring_put(&tp->workers[id].inbox, routine, arg, 0) == SUCCESS)
+            {
+                __atomic_thread_fence(__ATOMIC_SEQ_CST);
+                wake_parked(tp, id);
+                return;
+            }
+        }
+
+        /* every inbox is full, a worker of this pool would wait for itself so it runs the job instead */
+        if(self != NULL && self->tp == tp)
+        {
+            routine(arg);
+            return;
+        }
+
+        /* let the workers run */
+        sched_yield();
+    }
+}
+
+
+/* the work function of a thread of a stealing pool */
+static void* do_steal_work(void* p)
+{
+    worker_t* self = (worker_t*)p;
+    threadpool* tp = self->tp;
+    current_worker = self;
+
+    // TRUE after a wake up, until the worker found a job or parks again
+    int searching = FALSE;
+    work_t work;
+    while(TRUE)
+    {
+        if(find_work(self, &work) == SUCCESS)
+        {
+            /* the last searcher found a job, there may be more so someone else starts searching */
+            if(searching && __atomic_sub_fetch(&tp->searching, 1, __ATOMIC_SEQ_CST) == 0)
+                wake_parked(tp, self->id + 1);
+            searching = FALSE;
+
+            work.routine(work.arg);
+            continue;
+        }
+
+        if(searching)
+            __atomic_sub_fetch(&tp->searching, 1, __ATOMIC_SEQ_CST);
+        searching = FALSE;
+
+        // no dispatch call is running once shutdown is set, so all the queues are really empty
+        if(__atomic_load_n(&tp->shutdown, __ATOMIC_SEQ_CST) == SHUTDOWN)
+            return NULL;
+
+        /* park: counted as idle first and then one more look, a job that is added from now on wakes someone up */
+        __atomic_store_n(&self->state, WORKER_PARKED, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&tp->idle_workers, 1, __ATOMIC_SEQ_CST);
+
+        int found = find_work(self, &work);
+        if(found == SUCCESS || __atomic_load_n(&tp->shutdown, __ATOMIC_SEQ_CST) == SHUTDOWN)
+        {
+            // not parked after all, unless someone already woke this worker up (and counted it as searching)
+            int parked = WORKER_PARKED;
+            if(__atomic_compare_exchange_n(&self->state, &parked, WORKER_RUNNING, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+                __atomic_sub_fetch(&tp->idle_workers, 1, __ATOMIC_SEQ_CST);
+            else
+                searching = TRUE;
+
+            if(found == SUCCESS)
+            {
+                if(searching && __atomic_sub_fetch(&tp->searching, 1, __ATOMIC_SEQ_CST) == 0)
+                    wake_parked(tp, self->id + 1);
+                searching = FALSE;
+
+                work.routine(work.arg);
+            }
+            continue;
+        }
+
+        /* sleep until wake_parked or destroy_threadpool sets the state back to running */
+        while(__atomic_load_n(&self->state, __ATOMIC_SEQ_CST) == WORKER_PARKED)
+            syscall(SYS_futex, &self->state, FUTEX_WAIT_PRIVATE, WORKER_PARKED, NULL, NULL, 0);
+        searching = TRUE;
+    }
+}
+
+
+/* looks for a job: the bottom of the own deque, the own inbox, then the other workers (deque top and inbox) */
+static int find_work(worker_t* self, work_t* work)
+{
+    threadpool* tp = self->tp;
+    if(deque_pop(self, work) == SUCCESS || ring_take(&self->inbox, work) == SUCCESS)
+        return SUCCESS;
+
+    /* a lost race with another thief means the victim may still have jobs, look again */
+    int retry = TRUE;
+    while(retry)
+    {
+        retry = FALSE;
+        int i;
+        for(i = 1; i < tp->num_threads; i++)
+        {
+            worker_t* victim = &tp->workers[(self->id + i) % tp->num_threads];
+            int check = deque_steal(victim, work);
+            if(check == SUCCESS)
+                return SUCCESS;
+            if(check == RETRY)
+                retry = TRUE;
+
+            if(ring_take(&victim->inbox, work) == SUCCESS)
+                return SUCCESS;
+        }
+    }
+    return FAILED;
+}
+
+
+/* the owner adds a job at the bottom of its' deque (Chase-Lev), FAILED if the deque is full */
+static int deque_push(worker_t* self, dispatch_fn routine, void* arg)
+{
+    long bottom = __atomic_load_n(&self->bottom, __ATOMIC_RELAXED);
+    long top = __atomic_load_n(&self->top, __ATOMIC_ACQUIRE);
+    if(bottom - top >= DEQUE_SIZE)
+        return FAILED;
+
+    work_t* slot = &self->deque[bottom & (DEQUE_SIZE - 1)];
+    __atomic_store_n(&slot->routine, routine, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->arg, arg, __ATOMIC_RELAXED);
+
+    /* the job is written before the thieves can see it */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&self->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return SUCCESS;
+}
+
+
+/* the owner takes the newest job from the bottom of its' deque, FAILED if it is empty */
+static int deque_pop(worker_t* self, work_t* work)
+{
+    long bottom = __atomic_load_n(&self->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&self->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long top = __atomic_load_n(&self->top, __ATOMIC_RELAXED);
+
+    if(top > bottom)
+    {
+        __atomic_store_n(&self->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return FAILED;
+    }
+
+    work_t* slot = &self->deque[bottom & (DEQUE_SIZE - 1)];
+    work->routine = __atomic_load_n(&slot->routine, __ATOMIC_RELAXED);
+    work->arg = __atomic_load_n(&slot->arg, __ATOMIC_RELAXED);
+    if(top < bottom)
+        return SUCCESS;
+
+    /* the last job, a thief may be taking it right now */
+    int won = __atomic_compare_exchange_n(&self->top, &top, top + 1, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    __atomic_store_n(&self->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return won ? SUCCESS : FAILED;
+}
+
+
+/* a thief takes the oldest job from the top of a victim's deque, FAILED if it is empty, RETRY if another thread won it */
+static int deque_steal(worker_t* victim, work_t* work)
+{
+    long top = __atomic_load_n(&victim->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long bottom = __atomic_load_n(&victim->bottom, __ATOMIC_ACQUIRE);
+    if(top >= bottom)
+        return FAILED;
+
+    /* the slot is read before the claim, a slot that was reused in between makes the claim fail */
+    work_t* slot = &victim->deque[top & (DEQUE_SIZE - 1)];
+    work->routine = __atomic_load_n(&slot->routine, __ATOMIC_RELAXED);
+    work->arg = __atomic_load_n(&slot->arg, __ATOMIC_RELAXED);
+    if(!__atomic_compare_exchange_n(&victim->top, &top, top + 1, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return RETRY;
+    return SUCCESS;
+}
+
+
+/* wakes up one parked worker of a stealing pool (the one at first if it is parked), unless a worker is already searching */
+static void wake_parked(threadpool* tp, int first)
+{
+    if(__atomic_load_n(&tp->searching, __ATOMIC_SEQ_CST) > 0 || __atomic_load_n(&tp->idle_workers, __ATOMIC_SEQ_CST) == 0)
+        return;
+
     int i;
-    for(i = 0; i < destroyme->num_threads; i++)
-        pthread_join(destroyme->threads[i], NULL);
+    for(i = 0; i < tp->num_threads; i++)
+    {
+        worker_t* worker = &tp->workers[(first + i) % tp->num_threads];
+        int parked = WORKER_PARKED;
+        if(__atomic_compare_exchange_n(&worker->state, &parked, WORKER_RUNNING, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        {
+            // counted as searching before it runs, so the next dispatch calls don't wake up more workers
+            __atomic_add_fetch(&tp->searching, 1, __ATOMIC_SEQ_CST);
+            __atomic_sub_fetch(&tp->idle_workers, 1, __ATOMIC_SEQ_CST);
+            syscall(SYS_futex, &worker->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+            return;
+        }
+    }
+}
+
 
-    pthread_mutex_destroy(&destroyme->qlock);
-    pthread_cond_destroy(&destroyme->q_not_empty);
-    pthread_cond_destroy(&destroyme->q_empty);
-    free(destroyme->threads);
-    free(destroyme);
+/* frees the memory of a pool whose threads are all gone (or were never created) */
+static void free_threadpool(threadpool* tp)
+{
+    pthread_mutex_destroy(&tp->qlock);
+    pthread_mutex_destroy(&tp->grow_lock);
+    pthread_cond_destroy(&tp->q_not_empty);
+    pthread_cond_destroy(&tp->q_empty);
+
+    if(tp->queue == QUEUE_RING)
+        sem_destroy(&tp->ring_wake);
+    free(tp->ring.slots);
+
+    if(tp->workers != NULL)
+    {
+        int i;
+        for(i = 0; i < tp->num_workers; i++)
+        {
+            free(tp->workers[i].deque);
+            free(tp->workers[i].inbox.slots);
+        }
+        free(tp->workers);
+    }
+
+    free(tp->threads);
+    free(tp->thread_state);
+    free(tp);
+}
+
+
+/**
+ * threadpool_get_stats fills the number of threads of the pool, how
+ * it changed, and how long the jobs waited in the queue.
+ */
+void threadpool_get_stats(threadpool* tp, threadpool_stats_t* stats)
+{
+    if(tp == NULL || stats == NULL)
+        return;
+
+    pthread_mutex_lock(&tp->grow_lock);
+    stats->threads = tp->num_threads;
+    stats->min_threads = tp->min_threads;
+    stats->max_threads = tp->max_threads;
+    stats->peak_threads = tp->peak_threads;
+    stats->grown = tp->grown;
+    stats->retired = tp->retired;
+    pthread_mutex_unlock(&tp->grow_lock);
+
+    stats->idle_threads = __atomic_load_n(&tp->idle_workers, __ATOMIC_SEQ_CST);
+    stats->jobs = __atomic_load_n(&tp->jobs, __ATOMIC_RELAXED);
+    stats->wait_ns = __atomic_load_n(&tp->wait_ns, __ATOMIC_RELAXED);
+    stats->max_wait_ns = __atomic_load_n(&tp->max_wait_ns, __ATOMIC_RELAXED);
+    stats->shed = __atomic_load_n(&tp->shed, __ATOMIC_RELAXED);
+    stats->shedding = __atomic_load_n(&tp->shedding, __ATOMIC_RELAXED);
 
+    /* jobs waiting: the list, the ring, or every deque and inbox of a stealing pool */
+    if(tp->queue == QUEUE_LIST)
+    {
+        pthread_mutex_lock(&tp->qlock);
+        stats->qsize = tp->qsize;
+        pthread_mutex_unlock(&tp->qlock);
+    }
+    else if(tp->queue == QUEUE_RING)
+        stats->qsize = (int)ring_count(&tp->ring);
+    else
+    {
+        long qsize = 0;
+        int i;
+        for(i = 0; i < tp->num_threads; i++)
+        {
+            long jobs = __atomic_load_n(&tp->workers[i].bottom, __ATOMIC_RELAXED) - __atomic_load_n(&tp->workers[i].top, __ATOMIC_RELAXED);
+            if(jobs > 0)
+                qsize += jobs;
+            qsize += ring_count(&tp->workers[i].inbox);
+        }
+        stats->qsize = (int)qsize;
+    }
+}
+
+
+/* joins every thread that was started and not joined yet, the threads that are still running must be on their way out */
+static void join_threads(threadpool* tp)
+{
+    // no thread is added once dont_accept is set, the slots are read under the lock and joined without it (a leaving thread takes it)
+    pthread_t threads[MAXT_IN_POOL];
+    int count = 0;
+    int i;
+    pthread_mutex_lock(&tp->grow_lock);
+    for(i = 0; i < tp->max_threads; i++)
+    {
+        if(tp->thread_state[i] != THREAD_FREE)
+            threads[count++] = tp->threads[i];
+        tp->thread_state[i] = THREAD_FREE;
+    }
+    pthread_mutex_unlock(&tp->grow_lock);
+
+    for(i = 0; i < count; i++)
+        pthread_join(threads[i], NULL);
+}
+
+
+/* adds one thread to an elastic pool below max_threads, a thread that is already being added is enough */
+static void grow_pool(threadpool* tp)
+{
+    if(__atomic_load_n(&tp->num_threads, __ATOMIC_RELAXED) >= tp->max_threads)
+        return;
+
+    int growing = FALSE;
+    if(!__atomic_compare_exchange_n(&tp->growing, &growing, TRUE, FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+
+    pthread_mutex_lock(&tp->grow_lock);
+    if(__atomic_load_n(&tp->dont_accept, __ATOMIC_SEQ_CST) == ACCEPT && tp->num_threads < tp->max_threads)
+    {
+        /* the first slot without a running thread, a thread that left there is joined first */
+        int i;
+        for(i = 0; i < tp->max_threads && tp->thread_state[i] == THREAD_RUNNING; i++)
+            ;
+        if(tp->thread_state[i] == THREAD_EXITED)
+            pthread_join(tp->threads[i], NULL);
+        tp->thread_state[i] = THREAD_FREE;
+
+        if(pthread_create(&tp->threads[i], NULL, do_work, (void*)tp) == 0)
+        {
+            tp->thread_state[i] = THREAD_RUNNING;
+            int threads = __atomic_add_fetch(&tp->num_threads, 1, __ATOMIC_SEQ_CST);
+            if(threads > tp->peak_threads)
+                tp->peak_threads = threads;
+            tp->grown++;
+        }
+    }
+    pthread_mutex_unlock(&tp->grow_lock);
+
+    __atomic_store_n(&tp->growing, FALSE, __ATOMIC_RELEASE);
+}
+
+
+/* the calling thread leaves an elastic pool that is above min_threads, FAILED if it has to stay */
+static int retire_thread(threadpool* tp)
+{
+    pthread_mutex_lock(&tp->grow_lock);
+    if(tp->num_threads <= tp->min_threads)
+    {
+        pthread_mutex_unlock(&tp->grow_lock);
+        return FAILED;
+    }
+
+    /* the next thread that is added joins this one */
+    pthread_t self = pthread_self();
+    int i;
+    for(i = 0; i < tp->max_threads; i++)
+    {
+        if(tp->thread_state[i] == THREAD_RUNNING && pthread_equal(tp->threads[i], self))
+        {
+            tp->thread_state[i] = THREAD_EXITED;
+            break;
+        }
+    }
+    __atomic_sub_fetch(&tp->num_threads, 1, __ATOMIC_SEQ_CST);
+    tp->retired++;
+    pthread_mutex_unlock(&tp->grow_lock);
+    return SUCCESS;
+}
+
+
+/**
+ * counts the time a job waited in the queue. a job that waited too long while no
+ * thread is idle grows an elastic pool, and the delay drives the shedding of try_dispatch:
+ * it starts when the delay stayed above shed_target for shed_interval and stops with the
+ * first job that waited less
+ */
+static void job_waited(threadpool* tp, long long enqueued)
+{
+    long long now = now_ns();
+    long long waited = now - enqueued;
+    if(waited < 0)
+        waited = 0;
+
+    __atomic_add_fetch(&tp->jobs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&tp->wait_ns, (unsigned long long)waited, __ATOMIC_RELAXED);
+    unsigned long long max = __atomic_load_n(&tp->max_wait_ns, __ATOMIC_RELAXED);
+    while((unsigned long long)waited > max && !__atomic_compare_exchange_n(&tp->max_wait_ns, &max, (unsigned long long)waited, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+
+    if(tp->shed_target > 0)
+    {
+        if(waited < tp->shed_target)
+        {
+            __atomic_store_n(&tp->first_above, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&tp->shedding, FALSE, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            long long first_above = __atomic_load_n(&tp->first_above, __ATOMIC_RELAXED);
+            if(first_above == 0)
+                __atomic_compare_exchange_n(&tp->first_above, &first_above, now + tp->shed_interval, FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+            else if(now >= first_above)
+                __atomic_store_n(&tp->shedding, TRUE, __ATOMIC_RELAXED);
+        }
+    }
+
+    if(tp->max_threads > tp->min_threads && waited > tp->grow_wait && __atomic_load_n(&tp->idle_workers, __ATOMIC_SEQ_CST) == 0)
+        grow_pool(tp);
+}
+
+
+/* TRUE if try_dispatch has to turn a job away: the queue is at max_queue, or its' delay is above the target for too long */
+static int overloaded(threadpool* tp)
+{
+    long qsize;
+    if(tp->queue == QUEUE_LIST)
+        qsize = __atomic_load_n(&tp->qsize, __ATOMIC_RELAXED);
+    else
+        qsize = ring_count(&tp->ring);
+
+    /* the workers caught up, whatever the last delay was */
+    if(qsize == 0)
+    {
+        if(__atomic_load_n(&tp->shedding, __ATOMIC_RELAXED) || __atomic_load_n(&tp->first_above, __ATOMIC_RELAXED) != 0)
+        {
+            __atomic_store_n(&tp->first_above, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&tp->shedding, FALSE, __ATOMIC_RELAXED);
+        }
+        return FALSE;
+    }
+
+    if(tp->max_queue > 0 && qsize >= tp->max_queue)
+        return TRUE;
+
+    return __atomic_load_n(&tp->shedding, __ATOMIC_RELAXED);
+}
+
+
+/* an idle thread of an elastic ring pool sleeps at most idle_timeout ms, FAILED if nobody woke it up (it isn't counted as idle anymore) */
+static int ring_sleep(threadpool* tp)
+{
+    struct timespec deadline;
+    deadline_after(&deadline, tp->idle_timeout);
+    while(sem_clockwait(&tp->ring_wake, CLOCK_MONOTONIC, &deadline) != 0)
+    {
+        if(errno == EINTR)
+            continue;
+
+        /* timed out, but a producer that already counted on this thread posts a wake up that someone takes */
+        int idle = __atomic_load_n(&tp->idle_workers, __ATOMIC_SEQ_CST);
+        while(idle > 0)
+        {
+            if(__atomic_compare_exchange_n(&tp->idle_workers, &idle, idle - 1, TRUE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+                return FAILED;
+        }
+        return SUCCESS;
+    }
+    return SUCCESS;
+}
+
+
+/* number of jobs in a ring, a moment's view */
+static long ring_count(job_ring_t* ring)
+{
+    long count = (long)(__atomic_load_n(&ring->tail, __ATOMIC_RELAXED) - __atomic_load_n(&ring->head, __ATOMIC_RELAXED));
+    return count > 0 ? count : 0;
+}
+
+
+/* time on the monotonic clock in ns */
+static long long now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+/* the monotonic time ms from now */
+static void deadline_after(struct timespec* deadline, int ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += ms / 1000;
+    deadline->tv_nsec += (long)(ms % 1000) * 1000000;
+    if(deadline->tv_nsec >= 1000000000)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
 }
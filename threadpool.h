@@ -2,6 +2,8 @@
 #define _THREADPOOL_H_
 
 #include <pthread.h>
+#include <semaphore.h>
+#include <stddef.h>
 
 
 /**
@@ -14,6 +16,36 @@
 // maximum number of threads allowed in a pool
 #define MAXT_IN_POOL 200
 
+// kind of job queue of a pool
+#define QUEUE_LIST 0    //linked list of work_t guarded by qlock
+#define QUEUE_RING 1    //fixed-size lock-free ring of work_t slots
+#define QUEUE_STEAL 2   //a deque for every worker, idle workers steal from the others
+
+// default number of slots of a ring, and the biggest one allowed
+#define RING_SIZE 1024
+#define MAX_RING_SIZE (1 << 20)
+
+// slots of the deque of every worker of a QUEUE_STEAL pool, a power of 2
+#define DEQUE_SIZE 256
+
+// size of a cache line, the positions of the ring are kept on their own lines
+#define CACHE_LINE 64
+
+// defaults of an elastic pool: a thread is added when a job waited GROW_WAIT ms in the queue,
+// and a thread above the minimum leaves after IDLE_TIMEOUT ms without a job
+#define GROW_WAIT 5
+#define IDLE_TIMEOUT 10000
+
+// defaults of admission control (CoDel): try_dispatch turns jobs away once the queue delay
+// stayed above SHED_TARGET ms for SHED_INTERVAL ms
+#define SHED_TARGET 5
+#define SHED_INTERVAL 100
+
+// state of a slot of the threads array of an elastic pool
+#define THREAD_FREE 0       //no thread, or the thread that was there was joined
+#define THREAD_RUNNING 1
+#define THREAD_EXITED 2     //the thread left and wasn't joined yet
+
 
 /**
  * the pool holds a queue of this structure
@@ -21,10 +53,88 @@
 typedef struct work_st{
       int (*routine) (void*);  //the threads process function
       void * arg;  //argument to the function
+      long long enqueued;  //CLOCK_MONOTONIC ns when it was dispatched, only elastic and shedding pools keep it
       struct work_st* next;  
 } work_t;
 
 
+/**
+ * one slot of the ring queue, the job is stored in the slot itself.
+ * seq tells whose turn it is: equal to the position when the slot is
+ * free for a producer, position + 1 when it holds a job for a consumer
+ */
+typedef struct ring_slot_st{
+      size_t seq;
+      work_t work;
+} ring_slot_t;
+
+
+/**
+ * bounded lock-free queue of jobs (Vyukov's), any number of
+ * threads may add and take
+ */
+typedef struct job_ring_st{
+      ring_slot_t* slots;
+      size_t mask;          //number of slots - 1
+      size_t tail __attribute__((aligned(CACHE_LINE)));  //next position to add a job
+      size_t head __attribute__((aligned(CACHE_LINE)));  //next position to take a job
+} job_ring_t;
+
+
+/**
+ * a thread of a QUEUE_STEAL pool. jobs it dispatches itself go to the
+ * bottom of its' own deque (Chase-Lev), jobs from outside the pool go
+ * to its' inbox, and other workers steal from the top of the deque
+ */
+typedef struct worker_st{
+      struct _threadpool_st* tp;
+      int id;
+      work_t* deque;        //DEQUE_SIZE slots
+      job_ring_t inbox;     //jobs that were dispatched to this worker from outside the pool
+      long top __attribute__((aligned(CACHE_LINE)));     //next job to steal
+      long bottom __attribute__((aligned(CACHE_LINE)));  //next free slot, only the owner changes it
+      int state __attribute__((aligned(CACHE_LINE)));    //running or parked, the worker sleeps on it (futex)
+} worker_t;
+
+
+/**
+ * how to build a pool, see create_threadpool_ex
+ */
+typedef struct threadpool_config_st{
+      int num_threads;  //number of threads in the pool, the minimum of an elastic pool
+      int queue;        //QUEUE_LIST, QUEUE_RING or QUEUE_STEAL
+      int ring_size;    //slots of the ring (or of the inbox of every worker), rounded up to a power of 2
+      int max_threads;  //the pool grows up to max_threads with load, num_threads (or less) keeps it fixed
+      int grow_wait;    //ms a job may wait in the queue before a thread is added
+      int grow_qsize;   //jobs waiting in the queue before a thread is added, 0 looks only at the wait
+      int idle_timeout; //ms a thread above num_threads stays idle before it leaves
+      int max_queue;    //try_dispatch turns jobs away while this many wait, 0 means no limit
+      int shed_target;  //ms of queue delay try_dispatch aims for, 0 doesn't look at the delay
+      int shed_interval;    //ms the delay may stay above shed_target before jobs are turned away
+} threadpool_config_t;
+
+
+/**
+ * what threadpool_get_stats returns, the counters of the queue wait
+ * are kept by elastic and shedding pools only
+ */
+typedef struct threadpool_stats_st{
+      int threads;              //threads alive now
+      int idle_threads;         //threads waiting for a job
+      int min_threads;
+      int max_threads;
+      int peak_threads;         //most threads that were alive at once
+      unsigned long grown;      //threads that were added because of load
+      unsigned long retired;    //threads that left after idle_timeout
+      int qsize;                //jobs waiting in the queue
+      unsigned long jobs;       //jobs taken from the queue
+      unsigned long long wait_ns;       //time those jobs waited in the queue
+      unsigned long long max_wait_ns;   //longest time a job waited
+      unsigned long shed;       //jobs try_dispatch turned away
+      int shedding;             //TRUE while the queue delay is above shed_target
+} threadpool_stats_t;
+
+
 /**
  * The actual pool
  */
@@ -39,6 +149,36 @@ typedef struct _threadpool_st {
 	pthread_cond_t q_empty;
     int shutdown;            //1 if the pool is in destruction process     
     int dont_accept;       //1 if destroy function has begun
+    int queue;               //QUEUE_LIST, QUEUE_RING or QUEUE_STEAL
+    sem_t ring_wake;         //idle workers of the ring queue sleep on it
+    int idle_workers;        //number of idle workers that weren't woken up yet (ring and steal queues)
+    int dispatching;         //number of dispatch calls that are adding a job right now
+    worker_t* workers;       //the workers of a QUEUE_STEAL pool
+    int num_workers;         //number of workers that were allocated, freed even if their thread was never created
+    int searching;           //workers of a QUEUE_STEAL pool that were woken up and didn't find a job yet
+    unsigned int next_worker;   //inbox the next job from outside the pool goes to
+    job_ring_t ring;         //the ring queue
+    int min_threads;         //an elastic pool doesn't shrink below it
+    int max_threads;         //size of threads and thread_state, an elastic pool doesn't grow above it
+    int* thread_state;       //THREAD_FREE, THREAD_RUNNING or THREAD_EXITED for every slot of threads
+    pthread_mutex_t grow_lock;  //lock on adding and retiring threads
+    int growing;             //1 while a thread is being added
+    long long grow_wait;     //ns, see threadpool_config_t
+    int grow_qsize;
+    int idle_timeout;        //ms
+    int peak_threads;
+    unsigned long grown;
+    unsigned long retired;
+    unsigned long jobs;
+    unsigned long long wait_ns;
+    unsigned long long max_wait_ns;
+    int timed;               //TRUE if the jobs are timestamped (elastic or shedding pool)
+    int max_queue;           //see threadpool_config_t
+    long long shed_target;   //ns
+    long long shed_interval; //ns
+    long long first_above;   //ns when the queue delay may turn jobs away if it doesn't go below shed_target, 0 if it is below
+    int shedding;            //TRUE while try_dispatch turns jobs away because of the delay
+    unsigned long shed;
 } threadpool;
 
 
@@ -63,6 +203,27 @@ typedef int (*dispatch_fn)(void *);
 threadpool* create_threadpool(int num_threads_in_pool);
 
 
+/**
+ * create_threadpool_ex creates a pool as described by config.
+ * with QUEUE_RING the jobs are kept in a fixed-size ring that
+ * dispatch and the workers use without taking a lock or allocating
+ * memory, dispatch waits when the ring is full (a worker of the
+ * pool runs the job itself instead, it would wait for itself).
+ * with QUEUE_STEAL every worker has its' own deque: jobs dispatched
+ * by a worker stay with it, jobs from outside the pool are spread
+ * round-robin, and an idle worker steals from the others before it
+ * sleeps on its' own futex.
+ * when max_threads is bigger than num_threads the pool is elastic
+ * (QUEUE_LIST and QUEUE_RING): it starts with num_threads threads,
+ * adds one when a job waited grow_wait ms in the queue (or more than
+ * grow_qsize jobs wait) and no thread is idle, and a thread above
+ * num_threads leaves after idle_timeout ms without a job. a QUEUE_STEAL
+ * pool stays fixed, its' workers own the deques the others steal from.
+ * returns NULL on bad config or failure.
+ */
+threadpool* create_threadpool_ex(const threadpool_config_t* config);
+
+
 /**
  * dispatch enter a "job" of type work_t into the queue.
  * when an available thread takes a job from the queue, it will
@@ -76,6 +237,18 @@ threadpool* create_threadpool(int num_threads_in_pool);
  */
 void dispatch(threadpool* from_me, dispatch_fn dispatch_to_here, void *arg);
 
+
+/**
+ * try_dispatch is dispatch with admission control (QUEUE_LIST and
+ * QUEUE_RING): the job is turned away when max_queue jobs already wait,
+ * or when the time the jobs waited in the queue stayed above shed_target
+ * for shed_interval (CoDel), until a job waits less than shed_target or
+ * the queue is empty. a turned away job is only counted, the caller
+ * answers for it.
+ * returns SUCCESS if the job was dispatched, FAILED if it was turned away.
+ */
+int try_dispatch(threadpool* from_me, dispatch_fn dispatch_to_here, void *arg);
+
 /**
  * The work function of the thread
  * this function should:
@@ -97,4 +270,11 @@ void* do_work(void* p);
 void destroy_threadpool(threadpool* destroyme);
 
 
+/**
+ * threadpool_get_stats fills the number of threads of the pool, how
+ * it changed, and how long the jobs waited in the queue.
+ */
+void threadpool_get_stats(threadpool* tp, threadpool_stats_t* stats);
+
+
 #endif
\ No newline at end of file
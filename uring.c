@@ -0,0 +1,320 @@
+/* NAME: Ofir Cohen
+ * ID: 312255847
+ * DATE:
+ *
+ * io_uring made with the system calls, the rings are mapped here and
+ * filled and reaped with acquire/release loads and stores like the kernel
+ * expects, one system call submits every entry that was filled.
+ */
+
+/* INCLUDES */
+#include "uring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/time_types.h>
+
+
+/* DEFINES */
+// the flags the ring is asked for first, only this thread submits and completions are reaped when it enters the kernel
+#define URING_SETUP_FLAGS (IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER)
+
+
+/* FUNCTIONS */
+static int map_rings(uring_t* ring, struct io_uring_params* params);
+static void probe_ops(uring_t* ring);
+
+
+/**
+ * create_uring makes a ring and asks the kernel which opcodes it supports.
+ */
+uring_t* create_uring(unsigned int entries)
+{
+    uring_t* ring = (uring_t*)calloc(1, sizeof(uring_t));
+    if(ring == NULL)
+        return NULL;
+    ring->fd = -1;
+
+    /* an older kernel doesn't know the flags, the ring is made without them */
+    struct io_uring_params params;
+    bzero(&params, sizeof(params));
+    params.flags = URING_SETUP_FLAGS;
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if(ring->fd < 0 && errno == EINVAL)
+    {
+        bzero(&params, sizeof(params));
+        ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    }
+
+    if(ring->fd < 0 || map_rings(ring, &params) < 0)
+    {
+        destroy_uring(ring);
+        return NULL;
+    }
+
+    ring->features = params.features;
+    probe_ops(ring);
+    return ring;
+}
+
+
+/**
+ * uring_supports returns 1 if the kernel supports opcode.
+ */
+int uring_supports(uring_t* ring, int opcode)
+{
+    return (opcode >= 0 && opcode < 256) ? ring->ops[opcode] : 0;
+}
+
+
+/**
+ * uring_add_buffers registers a ring of count provided buffers of size bytes.
+ */
+int uring_add_buffers(uring_t* ring, int group, unsigned int count, unsigned int size)
+{
+    /* the kernel reads the ring from our memory, it has to start on a page */
+    size_t ring_size = count * sizeof(struct io_uring_buf);
+    void* mem = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED)
+        return -1;
+
+    struct io_uring_buf_reg reg;
+    bzero(&reg, sizeof(reg));
+    reg.ring_addr = (unsigned long)mem;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if(syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        munmap(mem, ring_size);
+        return -1;
+    }
+
+    char* buffers = (char*)mmap(NULL, (size_t)count * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(buffers == MAP_FAILED)
+    {
+        syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(mem, ring_size);
+        return -1;
+    }
+
+    ring->buf_ring = (struct io_uring_buf_ring*)mem;
+    ring->buffers = buffers;
+    ring->buf_count = count;
+    ring->buf_size = size;
+    ring->buf_group = group;
+    ring->buf_tail = 0;
+
+    unsigned int id;
+    for(id = 0; id < count; id++)
+        uring_recycle_buffer(ring, id);
+    return 0;
+}
+
+
+/**
+ * uring_buffer returns the provided buffer with id.
+ */
+char* uring_buffer(uring_t* ring, unsigned int id)
+{
+    return ring->buffers + (size_t)id * ring->buf_size;
+}
+
+
+/**
+ * uring_recycle_buffer puts a provided buffer at the tail of the ring again.
+ */
+void uring_recycle_buffer(uring_t* ring, unsigned int id)
+{
+    /* the tail of the ring shares the first slot with its' resv field, so a slot is filled field by field */
+    struct io_uring_buf* buf = &ring->buf_ring->bufs[ring->buf_tail & (ring->buf_count - 1)];
+    buf->addr = (unsigned long)uring_buffer(ring, id);
+    buf->len = ring->buf_size;
+    buf->bid = id;
+    ring->buf_tail++;
+    __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * uring_get_sqe returns the next free submission entry.
+ */
+struct io_uring_sqe* uring_get_sqe(uring_t* ring)
+{
+    unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if(ring->sq_local - head >= ring->sq_entries)
+    {
+        /* the ring is full, what was filled goes to the kernel now */
+        uring_submit_and_wait(ring, 0);
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if(ring->sq_local - head >= ring->sq_entries)
+            return NULL;
+    }
+
+    struct io_uring_sqe* sqe = &ring->sqes[ring->sq_local & ring->sq_mask];
+    bzero(sqe, sizeof(struct io_uring_sqe));
+    ring->sq_local++;
+    return sqe;
+}
+
+
+/**
+ * uring_submit_and_wait submits the filled entries and waits for a completion.
+ */
+int uring_submit_and_wait(uring_t* ring, int timeout_ms)
+{
+    /* the kernel takes the entries up to the new tail, the ones it didn't take last time are counted too */
+    __atomic_store_n(ring->sq_tail, ring->sq_local, __ATOMIC_RELEASE);
+    unsigned int submit = ring->sq_local - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if(submit == 0 && timeout_ms == 0)
+        return 0;
+
+    unsigned int flags = 0;
+    unsigned int wait_nr = 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    void* argp = NULL;
+    size_t argsz = 0;
+
+    if(timeout_ms != 0)
+    {
+        flags |= IORING_ENTER_GETEVENTS;
+        wait_nr = 1;
+    }
+    if(timeout_ms > 0)
+    {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        bzero(&arg, sizeof(arg));
+        arg.ts = (unsigned long)&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        argp = &arg;
+        argsz = sizeof(arg);
+    }
+
+    if(syscall(__NR_io_uring_enter, ring->fd, submit, wait_nr, flags, argp, argsz) < 0)
+        return -errno;
+    return 0;
+}
+
+
+/**
+ * uring_peek_cqe returns the next completion, NULL if there is none.
+ */
+struct io_uring_cqe* uring_peek_cqe(uring_t* ring)
+{
+    unsigned int head = *ring->cq_head;
+    if(head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+
+/**
+ * uring_cqe_seen gives the completion back to the kernel.
+ */
+void uring_cqe_seen(uring_t* ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * destroy_uring closes the ring and unmaps its' memory.
+ */
+void destroy_uring(uring_t* ring)
+{
+    if(ring == NULL)
+        return;
+
+    /* the kernel lets go of the provided buffers with the ring */
+    if(ring->fd >= 0)
+        close(ring->fd);
+    if(ring->buffers != NULL)
+        munmap(ring->buffers, (size_t)ring->buf_count * ring->buf_size);
+    if(ring->buf_ring != NULL)
+        munmap(ring->buf_ring, ring->buf_count * sizeof(struct io_uring_buf));
+    if(ring->sqes != NULL)
+        munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if(ring->sq_ring != NULL)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    free(ring);
+}
+
+
+/* map the submission ring, the completion ring (one mapping for both on newer kernels) and the entries. returns 0, -1 on failure */
+static int map_rings(uring_t* ring, struct io_uring_params* params)
+{
+    ring->sq_ring_size = params->sq_off.array + params->sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+    if(params->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    void* sq = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if(sq == MAP_FAILED)
+        return -1;
+    ring->sq_ring = sq;
+
+    void* cq = sq;
+    if(!(params->features & IORING_FEAT_SINGLE_MMAP))
+    {
+        cq = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if(cq == MAP_FAILED)
+            return -1;
+    }
+    ring->cq_ring = cq;
+
+    ring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED)
+        return -1;
+    ring->sqes = (struct io_uring_sqe*)sqes;
+
+    ring->sq_head = (unsigned int*)((char*)sq + params->sq_off.head);
+    ring->sq_tail = (unsigned int*)((char*)sq + params->sq_off.tail);
+    ring->sq_mask = *(unsigned int*)((char*)sq + params->sq_off.ring_mask);
+    ring->sq_entries = *(unsigned int*)((char*)sq + params->sq_off.ring_entries);
+    ring->sq_array = (unsigned int*)((char*)sq + params->sq_off.array);
+    ring->sq_local = *ring->sq_tail;
+
+    ring->cq_head = (unsigned int*)((char*)cq + params->cq_off.head);
+    ring->cq_tail = (unsigned int*)((char*)cq + params->cq_off.tail);
+    ring->cq_mask = *(unsigned int*)((char*)cq + params->cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)((char*)cq + params->cq_off.cqes);
+
+    /* entry i always sits in slot i, the array never changes */
+    unsigned int i;
+    for(i = 0; i < ring->sq_entries; i++)
+        ring->sq_array[i] = i;
+    return 0;
+}
+
+
+/* fill the table of the opcodes the kernel supports, it stays empty on a kernel that can't be asked */
+static void probe_ops(uring_t* ring)
+{
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = (struct io_uring_probe*)calloc(1, len);
+    if(probe == NULL)
+        return;
+
+    if(syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0)
+    {
+        int i;
+        for(i = 0; i < probe->ops_len; i++)
+        {
+            if(probe->ops[i].flags & IO_URING_OP_SUPPORTED)
+                ring->ops[probe->ops[i].op] = 1;
+        }
+    }
+    free(probe);
+}
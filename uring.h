@@ -0,0 +1,130 @@
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+
+/**
+ * uring.h
+ *
+ * This file declares a small wrapper of io_uring, made with the system
+ * calls themselves (there is no liburing): the submission and completion
+ * rings of one thread, the opcodes the running kernel knows (asked for
+ * when the ring is made, so the caller falls back to epoll on an old
+ * kernel, or when io_uring is disabled) and a ring of provided buffers
+ * the kernel picks a buffer from when data arrived, so a connection
+ * waiting for its' request doesn't hold a buffer of its' own.
+ * the ring isn't locked, only the thread that made it may use it.
+ */
+
+
+/**
+ * a ring, the pointers lead into the memory shared with the kernel
+ */
+typedef struct uring_st{
+    int fd;
+    unsigned int features;      //IORING_FEAT_* of the kernel
+    unsigned char ops[256];     //non-zero for every opcode the kernel supports
+    /* submission ring */
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_array;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+    unsigned int sq_local;      //tail of the entries that were filled and not given to the kernel yet
+    struct io_uring_sqe* sqes;
+    /* completion ring */
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe* cqes;
+    /* mappings */
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    /* provided buffers */
+    struct io_uring_buf_ring* buf_ring;
+    char* buffers;
+    unsigned int buf_count;
+    unsigned int buf_size;
+    unsigned short buf_tail;
+    int buf_group;
+} uring_t;
+
+
+/**
+ * create_uring makes a ring of entries submission entries (twice as
+ * many completions) and asks the kernel which opcodes it supports.
+ * returns NULL if the kernel has no io_uring, or it is disabled.
+ */
+uring_t* create_uring(unsigned int entries);
+
+
+/**
+ * uring_supports returns 1 if the kernel of ring supports opcode, 0 if it doesn't.
+ */
+int uring_supports(uring_t* ring, int opcode);
+
+
+/**
+ * uring_add_buffers gives the kernel count buffers of size bytes in
+ * group, for the requests with IOSQE_BUFFER_SELECT. count is a power of two.
+ * returns 0, -1 on failure (the kernel has no ring of provided buffers).
+ */
+int uring_add_buffers(uring_t* ring, int group, unsigned int count, unsigned int size);
+
+
+/**
+ * uring_buffer returns the provided buffer the kernel filled, the id is
+ * the one in the flags of the completion (IORING_CQE_BUFFER_SHIFT).
+ */
+char* uring_buffer(uring_t* ring, unsigned int id);
+
+
+/**
+ * uring_recycle_buffer gives a provided buffer back to the kernel once its' data was used.
+ */
+void uring_recycle_buffer(uring_t* ring, unsigned int id);
+
+
+/**
+ * uring_get_sqe returns a zeroed submission entry, the full ring is
+ * submitted first if it has to.
+ * returns NULL if there is no room.
+ */
+struct io_uring_sqe* uring_get_sqe(uring_t* ring);
+
+
+/**
+ * uring_submit_and_wait submits all the entries that were filled in one
+ * system call and waits until there is a completion or timeout_ms
+ * passed (-1 waits forever, 0 doesn't wait).
+ * returns 0, or -errno (-ETIME when the timeout passed, -EINTR).
+ */
+int uring_submit_and_wait(uring_t* ring, int timeout_ms);
+
+
+/**
+ * uring_peek_cqe returns the next completion, NULL if there is none,
+ * it stays in the ring until uring_cqe_seen.
+ */
+struct io_uring_cqe* uring_peek_cqe(uring_t* ring);
+
+
+/**
+ * uring_cqe_seen gives the completion that uring_peek_cqe returned back to the kernel.
+ */
+void uring_cqe_seen(uring_t* ring);
+
+
+/**
+ * destroy_uring unmaps the rings and the provided buffers and closes
+ * the ring, requests still in flight are cancelled by the kernel.
+ */
+void destroy_uring(uring_t* ring);
+
+
+#endif